@@ -2,6 +2,9 @@
 #include "pit.h"
 #include "pic.h"
 #include "../../syscalls/sys.h"
+#include "../../mm/paging.h"
+#include "../../mm/vma.h"
+#include "../../threading/threading.h"
 
 typedef struct {
     uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
@@ -35,6 +38,10 @@ extern void exception_simd_stub();
 extern void syscall_stub();
 extern void ide_primary_stub();
 extern void ide_secondary_stub();
+extern void pci_irq5_stub();
+extern void pci_irq9_stub();
+extern void pci_irq10_stub();
+extern void pci_irq11_stub();
 
 idt_entry idt[IDT_ENTRIES];
 idt_ptr_t idt_ptr;
@@ -125,6 +132,11 @@ void handle_exception_page_fault(interrupt_frame_t* frame) {
     uint64_t cr2_value;
     asm volatile("mov %%cr2, %0" : "=r"(cr2_value));
     
+    if (paging_handle_fault(cr2_value, error_code)) return;
+    
+    Process* current = get_current_process();
+    if (current && current->vmas && vma_handle_fault(current->cr3, current->vmas, cr2_value, error_code)) return;
+    
     kprintf("PAGE FAULT at address 0x%x\n", cr2_value);
     kprintf("Error code: 0x%x\n", error_code);
     kprintf("RIP: 0x%x\n", frame->rip);
@@ -197,6 +209,55 @@ void handle_syscall(interrupt_frame_t* frame) {
         case 3:
             write(frame->rdi, (const char*)frame->rsi, (int)frame->rdx);
             break;
+
+        case 7:
+            frame->rax = fork(frame);
+            break;
+
+        case 8:
+            frame->rax = pipe((int*)frame->rdi);
+            break;
+
+        case 9:
+            frame->rax = futex((uint32_t*)frame->rdi, (int)frame->rsi, (uint32_t)frame->rdx);
+            break;
+
+        case 10:
+            frame->rax = dup((int)frame->rdi);
+            break;
+
+        case 11:
+            frame->rax = dup2((int)frame->rdi, (int)frame->rsi);
+            break;
+
+        case 12:
+            frame->rax = waitpid((int)frame->rdi);
+            break;
+
+        case 13:
+            frame->rax = (uint64_t)mmap((void*)frame->rdi, frame->rsi, (int)frame->rdx,
+                                        (int)frame->r10, (int)frame->r8, frame->r9);
+            break;
+
+        case 14:
+            frame->rax = munmap((void*)frame->rdi, frame->rsi);
+            break;
+
+        case 15:
+            frame->rax = msync((void*)frame->rdi, frame->rsi, (int)frame->rdx);
+            break;
+
+        case 16:
+            frame->rax = shm_open((const char*)frame->rdi, (int)frame->rsi, frame->rdx);
+            break;
+
+        case 17:
+            frame->rax = shm_unlink((const char*)frame->rdi);
+            break;
+
+        case 18:
+            frame->rax = fsync((int)frame->rdi);
+            break;
             
         default:
             kprintf("UNKNOWN SYSCALL: %d\n", syscall_number);
@@ -238,12 +299,17 @@ void idt_init() {
     idt_set_entry(0x2E, (uint64_t)ide_primary_stub, 0x08, 0x8E);
     idt_set_entry(0x2F, (uint64_t)ide_secondary_stub, 0x08, 0x8E);
 
+    idt_set_entry(0x25, (uint64_t)pci_irq5_stub, 0x08, 0x8E);
+    idt_set_entry(0x29, (uint64_t)pci_irq9_stub, 0x08, 0x8E);
+    idt_set_entry(0x2A, (uint64_t)pci_irq10_stub, 0x08, 0x8E);
+    idt_set_entry(0x2B, (uint64_t)pci_irq11_stub, 0x08, 0x8E);
+
     idt_set_entry(0x80, (uint64_t)syscall_stub, 0x08, 0xEE);
     
     idt_ptr.limit = sizeof(idt) - 1;
     idt_ptr.base  = (uint64_t)&idt[0];
 
-    pit_set_frequency(1000);
+    pit_set_frequency(TIMER_HZ);
 
     idt_load((uint64_t)&idt_ptr);
 
@@ -21,6 +21,10 @@ global exception_simd_stub
 global syscall_stub
 global ide_primary_stub
 global ide_secondary_stub
+global pci_irq5_stub
+global pci_irq9_stub
+global pci_irq10_stub
+global pci_irq11_stub
 
 section .text
 
@@ -99,6 +103,22 @@ EXCEPTION_NO_ERR syscall_stub, handle_syscall
 EXCEPTION_NO_ERR ide_primary_stub, handle_ide_primary
 EXCEPTION_NO_ERR ide_secondary_stub, handle_ide_secondary
 
+;Shared PCI interrupt lines, rdi = the IRQ
+%macro PCI_IRQ 2
+%1:
+    PUSH
+    mov rdi, %2
+    extern pci_handle_irq
+    call pci_handle_irq
+    POP
+    iretq
+%endmacro
+
+PCI_IRQ pci_irq5_stub, 5
+PCI_IRQ pci_irq9_stub, 9
+PCI_IRQ pci_irq10_stub, 10
+PCI_IRQ pci_irq11_stub, 11
+
 default_isr_stub:
     PUSH
     POP
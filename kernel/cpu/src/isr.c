@@ -1,4 +1,5 @@
 #include "pic.h"
+#include "pit.h"
 #include "../../../lib/definitions.h"
 #include "../../drivers/keyboard/keyboard.h"
 #include "../../threading/threading.h"
@@ -9,11 +10,28 @@ static volatile uint8_t g_last_scancode = 0;
 
 void isr_timer_handler() {
     g_timer_ticks++;
-    //schedule();
 
     pic_send_eoi(0);
+    sleep_queue_tick(g_timer_ticks);
+    scheduler_tick();
 }
 
 uint64_t timer_get_ticks() {
     return g_timer_ticks;
+}
+
+//Tick count refined with the PIT counter, for measuring things shorter than a tick
+uint64_t timer_get_us() {
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    uint64_t ticks = g_timer_ticks;
+    uint32_t count = pit_read_count();
+    //IRQ0 raised but not handled yet: the counter has already wrapped
+    outb(PIC1_COMMAND, 0x0A);
+    if (inb(PIC1_COMMAND) & 1) ticks++;
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+
+    uint32_t divisor = PIT_BASE_FRQ / TIMER_HZ;
+    uint32_t elapsed = count <= divisor ? divisor - count : 0;
+    return ticks * (1000000 / TIMER_HZ) + (uint64_t)elapsed * 1000000 / PIT_BASE_FRQ;
 }
\ No newline at end of file
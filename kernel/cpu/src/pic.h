@@ -37,8 +37,17 @@ static inline void pic_send_eoi(uint8_t irq) {
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+static inline void pic_unmask_irq(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+        irq = 2;
+    }
+    outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+}
+
 void isr_timer_handler();
 uint64_t timer_get_ticks();
+uint64_t timer_get_us();
 void isr_keyboard_handler();
 uint8_t keyboard_get_scancode();
 
@@ -6,6 +6,7 @@
 #define PIT_CHANNEL0 0x40
 #define PIT_COMMAND 0x43
 #define PIT_BASE_FRQ 1193182UL
+#define TIMER_HZ 1000
 
 static inline void pit_set_frequency(uint32_t hz) {
     if (hz == 0) {
@@ -14,10 +15,18 @@ static inline void pit_set_frequency(uint32_t hz) {
 
     uint32_t divisor = PIT_BASE_FRQ / hz;
 
-    outb(PIT_COMMAND, 0x36);
+    //Rate generator: same IRQ rate as square wave, but the count drops by 1 so it can be read back
+    outb(PIT_COMMAND, 0x34);
 
     outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
     outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
 }
 
+static inline uint16_t pit_read_count() {
+    outb(PIT_COMMAND, 0x00);
+    uint8_t lo = inb(PIT_CHANNEL0);
+    uint8_t hi = inb(PIT_CHANNEL0);
+    return ((uint16_t)hi << 8) | lo;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "ahci.h"
+#include "../PCI/pci.h"
+#include "../../mm/frame.h"
+
+#define AHCI_MAX_CONTROLLERS 4
+#define AHCI_TIMEOUT 1000000
+
+typedef struct {
+    AhciHba* hba;
+    AhciPort* ports[AHCI_MAX_PORTS];
+} AhciController;
+
+static AhciController ahci_controllers[AHCI_MAX_CONTROLLERS];
+static int ahci_controller_count = 0;
+static int ahci_disk_count = 0;
+
+static int ahci_block_start(BlockDevice* dev, BlockRequest* cmd);
+
+static const BlockOps ahci_block_ops = {
+    .start = ahci_block_start,
+};
+
+static bool ahci_wait_clear(volatile uint32_t* reg, uint32_t bits) {
+    for (uint32_t t = 0; t < AHCI_TIMEOUT; t++) {
+        if (!(*reg & bits)) return true;
+    }
+    return false;
+}
+
+static bool ahci_port_stop(AhciPortRegs* regs) {
+    regs->cmd &= ~AHCI_PxCMD_ST;
+    if (!ahci_wait_clear(&regs->cmd, AHCI_PxCMD_CR)) return false;
+    regs->cmd &= ~AHCI_PxCMD_FRE;
+    return ahci_wait_clear(&regs->cmd, AHCI_PxCMD_FR);
+}
+
+static bool ahci_port_start(AhciPortRegs* regs) {
+    if (!ahci_wait_clear(&regs->tfd, AHCI_TFD_BSY | AHCI_TFD_DRQ)) return false;
+    regs->cmd |= AHCI_PxCMD_FRE;
+    regs->cmd |= AHCI_PxCMD_ST;
+    return true;
+}
+
+//Describes the buffers of a command, merging ones that follow each other in memory.
+//0 if a buffer is not word aligned
+static int ahci_build_prdt(AhciCmdTable* table, BlockRequest* cmd) {
+    int n = 0;
+    uint64_t end = 0;
+    for (BlockRequest* req = cmd; req; req = (BlockRequest*)req->io.merged) {
+        uint64_t addr = (uint64_t)req->buffer;
+        uint32_t bytes = (uint32_t)req->io.sectors * BLOCK_SECTOR_SIZE;
+        if (addr & 1) return 0;
+
+        if (n > 0 && addr == end) {
+            table->prdt[n - 1].dbc += bytes;
+        } else {
+            if (n == AHCI_PRDT_ENTRIES) return 0;
+            table->prdt[n].dba = (uint32_t)addr;
+            table->prdt[n].dbau = (uint32_t)(addr >> 32);
+            table->prdt[n].rsv = 0;
+            table->prdt[n].dbc = bytes - 1;
+            n++;
+        }
+        end = addr + bytes;
+    }
+    return n;
+}
+
+static void ahci_fis_rw(AhciPort* port, AhciFisH2D* fis, BlockRequest* cmd, int tag) {
+    uint32_t lba = cmd->io.lba;
+    uint16_t span = cmd->io.span;
+    bool write = cmd->io.write;
+
+    memset(fis, 0, sizeof(AhciFisH2D));
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = 0x80;
+    if (cmd->flush) {
+        //Never queued: the block layer only starts a flush with nothing else in flight
+        fis->command = ATA_CMD_FLUSH_CACHE_EXT;
+        return;
+    }
+    fis->lba0 = (uint8_t)lba;
+    fis->lba1 = (uint8_t)(lba >> 8);
+    fis->lba2 = (uint8_t)(lba >> 16);
+    fis->lba3 = (uint8_t)(lba >> 24);
+    fis->device = 0x40;
+
+    if (port->ncq) {
+        //First party DMA: the count moves to the features and the tag takes its place
+        fis->command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        fis->featurel = (uint8_t)span;
+        fis->featureh = (uint8_t)(span >> 8);
+        fis->countl = (uint8_t)(tag << 3);
+    } else {
+        fis->command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        fis->countl = (uint8_t)span;
+        fis->counth = (uint8_t)(span >> 8);
+    }
+}
+
+//BlockOps.start: takes a free slot, the HBA fetches the command from there on its own
+static int ahci_block_start(BlockDevice* dev, BlockRequest* cmd) {
+    AhciPort* port = (AhciPort*)dev->driver;
+
+    uint64_t flags = spin_lock_irqsave(&port->lock);
+    uint32_t all = port->slots == 32 ? 0xFFFFFFFF : (1u << port->slots) - 1;
+    uint32_t free = ~port->busy & all;
+    if (!free) {
+        spin_unlock_irqrestore(&port->lock, flags);
+        return -1;
+    }
+    int tag = __builtin_ctz(free);
+
+    AhciCmdTable* table = port->tables[tag];
+    int prds = cmd->flush ? 0 : ahci_build_prdt(table, cmd);
+    if (!prds && !cmd->flush) {
+        spin_unlock_irqrestore(&port->lock, flags);
+        return -1;
+    }
+    ahci_fis_rw(port, (AhciFisH2D*)table->cfis, cmd, tag);
+
+    AhciCmdHeader* header = &port->headers[tag];
+    header->flags = (sizeof(AhciFisH2D) / 4) | (cmd->io.write ? (1 << 6) : 0);
+    header->prdtl = prds;
+    header->prdbc = 0;
+
+    port->busy |= 1u << tag;
+    port->active[tag] = cmd;
+    __sync_synchronize();
+    if (port->ncq && !cmd->flush) port->regs->sact = 1u << tag;
+    port->regs->ci = 1u << tag;
+
+    spin_unlock_irqrestore(&port->lock, flags);
+    return 0;
+}
+
+static void ahci_port_interrupt(AhciPort* port) {
+    BlockRequest* done[AHCI_MAX_SLOTS];
+    int status = 0;
+    int count = 0;
+
+    uint64_t flags = spin_lock_irqsave(&port->lock);
+    AhciPortRegs* regs = port->regs;
+    uint32_t is = regs->is;
+    regs->is = is;
+
+    uint32_t finished;
+    if (is & AHCI_PxIS_ERROR) {
+        //The port stops on an error and NCQ does not say which tag failed, so everything
+        //outstanding fails and the port is restarted for whatever comes next
+        kprintf("ahci: port %d error, is 0x%x tfd 0x%x\n", port->index, is, regs->tfd);
+        finished = port->busy;
+        status = -1;
+        ahci_port_stop(regs);
+        regs->serr = 0xFFFFFFFF;
+        regs->is = 0xFFFFFFFF;
+        ahci_port_start(regs);
+    } else {
+        finished = port->busy & ~(regs->sact | regs->ci);
+    }
+
+    while (finished) {
+        int tag = __builtin_ctz(finished);
+        finished &= finished - 1;
+        done[count++] = port->active[tag];
+        port->active[tag] = NULL;
+        port->busy &= ~(1u << tag);
+    }
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    //Starts the device's next commands from here, so it must run with the port unlocked
+    for (int i = 0; i < count; i++) block_complete(done[i], status);
+}
+
+static void ahci_handle_interrupt(void* data) {
+    AhciController* controller = (AhciController*)data;
+    uint32_t is = controller->hba->is;
+    if (!is) return;
+
+    for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+        if ((is & (1u << i)) && controller->ports[i]) ahci_port_interrupt(controller->ports[i]);
+    }
+    controller->hba->is = is;
+}
+
+//IDENTIFY through slot 0, polled: the port's interrupts are not enabled yet
+static bool ahci_identify(AhciPort* port, uint16_t* id) {
+    AhciCmdTable* table = port->tables[0];
+    table->prdt[0].dba = (uint32_t)(uint64_t)id;
+    table->prdt[0].dbau = 0;
+    table->prdt[0].dbc = 512 - 1;
+
+    AhciFisH2D* fis = (AhciFisH2D*)table->cfis;
+    memset(fis, 0, sizeof(AhciFisH2D));
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = 0x80;
+    fis->command = ATA_CMD_IDENTIFY;
+
+    port->headers[0].flags = sizeof(AhciFisH2D) / 4;
+    port->headers[0].prdtl = 1;
+    port->headers[0].prdbc = 0;
+    __sync_synchronize();
+    port->regs->ci = 1;
+
+    for (uint32_t t = 0; t < AHCI_TIMEOUT; t++) {
+        if (port->regs->is & AHCI_PxIS_TFES) break;
+        if (!(port->regs->ci & 1)) return !(port->regs->tfd & AHCI_TFD_ERR);
+    }
+    return false;
+}
+
+static bool ahci_port_memory(AhciPort* port) {
+    uint64_t list = frame_alloc();
+    if (!list) return false;
+    memset((void*)list, 0, PAGE_SIZE);
+
+    //The command list takes the first 1KB, the received FIS area follows at 1KB
+    port->headers = (AhciCmdHeader*)list;
+    port->regs->clb = (uint32_t)list;
+    port->regs->clbu = 0;
+    port->regs->fb = (uint32_t)(list + 1024);
+    port->regs->fbu = 0;
+
+    for (uint32_t slot = 0; slot < port->slots; slot++) {
+        uint64_t table = frame_alloc();
+        if (!table) return false;
+        memset((void*)table, 0, PAGE_SIZE);
+        port->tables[slot] = (AhciCmdTable*)table;
+        port->headers[slot].ctba = (uint32_t)table;
+        port->headers[slot].ctbau = 0;
+    }
+    return true;
+}
+
+static void ahci_port_probe(AhciController* controller, int index) {
+    AhciPortRegs* regs = &controller->hba->ports[index];
+    uint32_t ssts = regs->ssts;
+    if ((ssts & 0x0F) != AHCI_DET_PRESENT || ((ssts >> 8) & 0x0F) != AHCI_IPM_ACTIVE) return;
+    if (regs->sig != AHCI_SIG_ATA) {
+        kprintf("AHCI: port %d is not a disk (signature 0x%x)\n", index, regs->sig);
+        return;
+    }
+
+    AhciPort* port = kmalloc(sizeof(AhciPort));
+    if (!port) return;
+    memset(port, 0, sizeof(AhciPort));
+    port->regs = regs;
+    port->index = index;
+    port->lock = SPINLOCK_INIT;
+    port->slots = AHCI_CAP_NCS(controller->hba->cap);
+
+    uint64_t identify = frame_alloc();
+    if (!ahci_port_stop(regs) || !identify || !ahci_port_memory(port)) {
+        kprintf("ahci_port_probe: cannot set up port %d\n", index);
+        return;
+    }
+    regs->serr = 0xFFFFFFFF;
+    regs->is = 0xFFFFFFFF;
+    if (!ahci_port_start(regs) || !ahci_identify(port, (uint16_t*)identify)) {
+        kprintf("ahci_port_probe: IDENTIFY failed on port %d\n", index);
+        frame_free(identify);
+        return;
+    }
+
+    uint16_t* id = (uint16_t*)identify;
+    char model[41];
+    for (int i = 0; i < 40; i += 2) {
+        model[i]     = (id[27 + i/2] >> 8) & 0xFF;
+        model[i + 1] =  id[27 + i/2]       & 0xFF;
+    }
+    model[40] = '\0';
+
+    //Words 100-103 with LBA48, 60-61 without. Requests carry 32 bit LBAs
+    uint64_t sectors = id[60] | ((uint32_t)id[61] << 16);
+    if (id[83] & (1 << 10)) {
+        sectors = id[100] | ((uint64_t)id[101] << 16) | ((uint64_t)id[102] << 32);
+    }
+    if (sectors > 0xFFFFFFFF) sectors = 0xFFFFFFFF;
+
+    //Word 76 bit 8: NCQ, word 75: its queue depth - 1. Word 85 bit 5: write cache enabled
+    port->ncq = (controller->hba->cap & AHCI_CAP_SNCQ) && (id[76] & (1 << 8));
+    port->block.write_cache = (id[85] & (1 << 5)) != 0;
+    uint32_t depth = 1;
+    if (port->ncq) {
+        depth = (id[75] & 0x1F) + 1;
+        if (depth > port->slots) depth = port->slots;
+    }
+    frame_free(identify);
+
+    strcpy(port->block.name, "sata0");
+    port->block.name[4] = '0' + ahci_disk_count++;
+    port->block.sectors = sectors;
+    port->block.max_sectors = AHCI_MAX_SECTORS;
+    port->block.queue_depth = depth;
+    port->block.speed = 3;
+    port->block.persistent = true;
+    port->block.ops = &ahci_block_ops;
+    port->block.driver = port;
+
+    kprintf("AHCI: port %d: %s, %s depth %d\n", index, model, port->ncq ? "NCQ" : "no NCQ", depth);
+    regs->ie = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS |
+               AHCI_PxIS_DPS | AHCI_PxIS_ERROR;
+    controller->ports[index] = port;
+    block_register(&port->block);
+}
+
+static void ahci_init_controller(const PciDevice* d) {
+    if (ahci_controller_count == AHCI_MAX_CONTROLLERS) return;
+    AhciController* controller = &ahci_controllers[ahci_controller_count];
+
+    uint32_t bar5 = pci_config_read32(d->bus, d->device, d->function, 0x24) & 0xFFFFFFF0;
+    AhciHba* hba = map_mmio(bar5, sizeof(AhciHba));
+    if (!bar5 || !hba) {
+        kprintf("ahci_init: cannot map ABAR 0x%x\n", bar5);
+        return;
+    }
+    pci_enable_device(d);
+
+    //Reset into AHCI mode, then bring up every implemented port that has a disk
+    hba->ghc |= AHCI_GHC_AE;
+    hba->ghc |= AHCI_GHC_HR;
+    if (!ahci_wait_clear(&hba->ghc, AHCI_GHC_HR)) {
+        kprint("ahci_init: controller reset timed out\n");
+        return;
+    }
+    hba->ghc |= AHCI_GHC_AE;
+    controller->hba = hba;
+    ahci_controller_count++;
+
+    if (pci_irq_register(d, ahci_handle_interrupt, controller) < 0) {
+        kprint("ahci_init: no interrupt, controller not used\n");
+        return;
+    }
+
+    uint32_t implemented = hba->pi;
+    kprintf("AHCI: ports 0x%x, %d command slots%s\n", implemented,
+            AHCI_CAP_NCS(hba->cap), (hba->cap & AHCI_CAP_SNCQ) ? ", NCQ" : "");
+    for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (implemented & (1u << i)) ahci_port_probe(controller, i);
+    }
+
+    hba->is = 0xFFFFFFFF;
+    hba->ghc |= AHCI_GHC_IE;
+}
+
+void ahci_init() {
+    for (int i = 0; i < pci_get_device_count(); i++) {
+        const PciDevice* d = pci_get_device(i);
+        if (d->class_code == 0x01 && d->subclass == 0x06 && d->prog_if == 0x01) ahci_init_controller(d);
+    }
+}
\ No newline at end of file
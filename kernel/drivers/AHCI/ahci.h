@@ -0,0 +1,125 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include "../../../lib/definitions.h"
+#include "../../mm/paging.h"
+#include "../../threading/src/spinlock.h"
+#include "../block/block.h"
+
+#define AHCI_MAX_PORTS      32
+#define AHCI_MAX_SLOTS      32
+#define AHCI_PRDT_ENTRIES   248     //a command table fills exactly one frame
+#define AHCI_MAX_SECTORS    AHCI_PRDT_ENTRIES   //one entry per merged request at worst
+
+#define AHCI_GHC_HR         (1u << 0)
+#define AHCI_GHC_IE         (1u << 1)
+#define AHCI_GHC_AE         (1u << 31)
+#define AHCI_CAP_NCS(cap)   ((((cap) >> 8) & 0x1F) + 1)
+#define AHCI_CAP_SNCQ       (1u << 30)
+
+#define AHCI_PxCMD_ST       (1u << 0)
+#define AHCI_PxCMD_FRE      (1u << 4)
+#define AHCI_PxCMD_FR       (1u << 14)
+#define AHCI_PxCMD_CR       (1u << 15)
+
+#define AHCI_PxIS_DHRS      (1u << 0)
+#define AHCI_PxIS_PSS       (1u << 1)
+#define AHCI_PxIS_DSS       (1u << 2)
+#define AHCI_PxIS_SDBS      (1u << 3)
+#define AHCI_PxIS_DPS       (1u << 5)
+#define AHCI_PxIS_IFS       (1u << 27)
+#define AHCI_PxIS_HBDS      (1u << 28)
+#define AHCI_PxIS_HBFS      (1u << 29)
+#define AHCI_PxIS_TFES      (1u << 30)
+#define AHCI_PxIS_ERROR     (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_TFD_ERR        0x01
+#define AHCI_TFD_DRQ        0x08
+#define AHCI_TFD_BSY        0x80
+
+#define AHCI_SIG_ATA        0x00000101
+#define AHCI_DET_PRESENT    3
+#define AHCI_IPM_ACTIVE     1
+
+#define FIS_TYPE_REG_H2D    0x27
+
+#define ATA_CMD_IDENTIFY            0xEC
+#define ATA_CMD_READ_DMA_EXT        0x25
+#define ATA_CMD_WRITE_DMA_EXT       0x35
+#define ATA_CMD_FLUSH_CACHE_EXT     0xEA
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED  0x61
+
+typedef volatile struct {
+    uint32_t clb, clbu;         //command list
+    uint32_t fb, fbu;           //received FIS area
+    uint32_t is, ie, cmd, rsv0;
+    uint32_t tfd, sig, ssts, sctl, serr;
+    uint32_t sact;              //NCQ tags the device still owns
+    uint32_t ci;                //slots issued to the HBA
+    uint32_t sntf, fbs;
+    uint32_t rsv1[11];
+    uint32_t vendor[4];
+} AhciPortRegs;
+
+typedef volatile struct {
+    uint32_t cap, ghc, is, pi, vs;
+    uint32_t ccc_ctl, ccc_ports, em_loc, em_ctl, cap2, bohc;
+    uint8_t  rsv[0xA0 - 0x2C];
+    uint8_t  vendor[0x100 - 0xA0];
+    AhciPortRegs ports[AHCI_MAX_PORTS];
+} AhciHba;
+
+typedef struct {
+    uint16_t flags;             //FIS length in dwords in bits 0-4, bit 6 write
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba, ctbau;
+    uint32_t rsv[4];
+} __attribute__((packed)) AhciCmdHeader;
+
+typedef struct {
+    uint32_t dba, dbau;
+    uint32_t rsv;
+    uint32_t dbc;               //bytes - 1, bit 0 must be set
+} __attribute__((packed)) AhciPrd;
+
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t rsv[48];
+    AhciPrd prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed)) AhciCmdTable;
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;              //bit 7: command, not control
+    uint8_t command;
+    uint8_t featurel;
+    uint8_t lba0, lba1, lba2, device;
+    uint8_t lba3, lba4, lba5, featureh;
+    uint8_t countl, counth, icc, control;
+    uint8_t rsv[4];
+} __attribute__((packed)) AhciFisH2D;
+
+/*
+ * One SATA disk. With NCQ every one of the port's command slots is a tag the
+ * drive may work on and finish in any order, so the block layer keeps up to
+ * queue_depth commands in flight; without it the port takes one at a time.
+ */
+typedef struct AhciPort {
+    BlockDevice block;
+    AhciPortRegs* regs;
+    int index;
+    AhciCmdHeader* headers;
+    AhciCmdTable* tables[AHCI_MAX_SLOTS];
+    spinlock_t lock;
+    uint32_t slots;
+    uint32_t busy;              //slots handed to the HBA
+    BlockRequest* active[AHCI_MAX_SLOTS];
+    bool ncq;
+} AhciPort;
+
+void ahci_init();
+
+#endif
\ No newline at end of file
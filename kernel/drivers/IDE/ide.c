@@ -1,18 +1,23 @@
 #include "ide.h"
 #include "../PCI/pci.h"
 #include "../../cpu/src/pic.h"
+#include "../../threading/threading.h"
+#include "../../mm/frame.h"
+#include "../../threading/src/spinlock.h"
 
+//Per channel: the command the drive is working on. Each drive is its own block device with
+//a queue depth of one, the channel only has to keep two drives from talking over each other
 typedef struct {
-    int busy;
-    int drive;
-    uint8_t command;
-    uint32_t lba;
-    uint8_t sector_count;
-    uint16_t* buffer;
-    uint16_t words_left;
-    uint8_t sectors_left;
-    int callback_ready;
-} ide_channel_status_t;
+    spinlock_t lock;
+    BlockRequest* active;
+    IdeDisk* disk;
+    uint16_t sectors_left;
+    BlockRequest* pio_req;
+    uint16_t pio_sector;
+    uint8_t stage;
+    bool dma;
+    bool pio_only;              //DMA failed once, the retry goes by PIO
+} IdeCommand;
 
 IDEChannel ide_channels[2] = {
     {ATA_PRIMARY, 0x3F6, 0},     /* will be overwritten if controller is in native mode */
@@ -21,7 +26,15 @@ IDEChannel ide_channels[2] = {
 
 static uint16_t lba_count = 129;        /*1 sector for bootloader, 128 for the first load*/
 
-static ide_channel_status_t channel_status[2] = { {0}, {0} };
+static IdeCommand ide_commands[2] = { {SPINLOCK_INIT}, {SPINLOCK_INIT} };
+
+static IdeDisk ide_disks[4];
+
+static int ide_block_start(BlockDevice* dev, BlockRequest* cmd);
+
+static const BlockOps ide_block_ops = {
+    .start = ide_block_start,
+};
 
 static int ata_get_channel_bases(void) {
     for (int i = 0; i < pci_get_device_count(); ++i) {
@@ -48,6 +61,16 @@ static int ata_get_channel_bases(void) {
                     ide_channels[0].base,
                     ide_channels[0].control_base,
                     d->prog_if);
+
+            //progIF bit 7: the controller can master the bus, its registers are behind BAR4
+            uint32_t bar4 = pci_config_read32(d->bus, d->device, d->function, 0x20);
+            if ((d->prog_if & 0x80) && (bar4 & 1) && (bar4 & 0xFFFC)) {
+                uint32_t command = pci_config_read32(d->bus, d->device, d->function, 0x04);
+                pci_config_write32(d->bus, d->device, d->function, 0x04, command | 0x05);
+                ide_channels[0].bmide = bar4 & 0xFFFC;
+                ide_channels[1].bmide = (bar4 & 0xFFFC) + 8;
+                kprintf("IDE: bus master at 0x%x\n", ide_channels[0].bmide);
+            }
             return 0;
         }
     }
@@ -70,8 +93,32 @@ static int ata_wait(uint16_t io, int check_err) {
 
 void ide_wait(uint16_t io) { ata_wait(io, 0); }
 
+static int ata_wait_not_busy(uint16_t io) {
+    for (uint32_t t = 0; t < 1000000; ++t) {
+        if (!(inb(io + ATA_REG_STATUS) & ATA_SR_BSY)) return 0;
+    }
+    return -2;
+}
+
+//PRD table in a frame of its own, it must not cross 64KB
+static void ide_dma_init(int channel) {
+    IDEChannel* ch = &ide_channels[channel];
+    if (!ch->bmide) return;
+
+    uint64_t frame = frame_alloc();
+    if (!frame) {
+        kprintf("ide_dma_init: falling back to PIO on channel %d\n", channel);
+        ch->bmide = 0;
+        return;
+    }
+    ch->prdt = (IdePrd*)frame;
+    outb(ch->bmide + BM_REG_COMMAND, 0);
+    outb(ch->bmide + BM_REG_STATUS, BM_SR_ERR | BM_SR_IRQ);
+}
+
 static inline void ide_enable_irq(int channel) {
     outb(ide_channels[channel].control_base, 0);
+    pic_unmask_irq(14 + channel);
 }
 
 void ide_init(void) {
@@ -103,51 +150,160 @@ void ide_init(void) {
     model[40] = '\0';
     kprintf("Primary master detected: %s\n", model);
 
+    //Word 49 bit 8: the drive does DMA
+    if (!(id[49] & 0x100)) ide_channels[0].bmide = 0;
+    ide_dma_init(0);
     ide_enable_irq(0);
+
+    //Words 60-61: sectors addressable with 28 bit LBA
+    IdeDisk* disk = &ide_disks[0];
+    disk->drive = 0;
+    strcpy(disk->block.name, "ide0");
+    disk->block.sectors = id[60] | ((uint32_t)id[61] << 16);
+    disk->block.max_sectors = IDE_MAX_SECTORS;
+    disk->block.queue_depth = 1;
+    disk->block.speed = ide_channels[0].bmide ? 2 : 1;
+    disk->block.persistent = true;
+    disk->block.write_cache = (id[85] & (1 << 5)) != 0;     //word 85 bit 5: write cache enabled
+    disk->block.ops = &ide_block_ops;
+    disk->block.driver = disk;
+    block_register(&disk->block);
     kprint("IDE initialization complete.\n");
 }
 
-static int ide_pio_28(uint8_t drive, uint32_t lba,
-                      uint8_t cmd, uint16_t sectors,
-                      const uint16_t *wbuf, uint16_t *rbuf)
-{
-    int      channel   = drive & 1;
-    int      ata_drive = (drive & 2) >> 1;
-    uint16_t io        = ide_channels[channel].base;
-
-    int w = ata_wait(io, 1);
-    if (w) return w;
-
+static void ide_taskfile(uint16_t io, int ata_drive, uint32_t lba, uint16_t sectors) {
     outb(io + ATA_REG_SECTOR_COUNT, (uint8_t)sectors);
     outb(io + ATA_REG_LBA_LOW, (uint8_t)  lba);
     outb(io + ATA_REG_LBA_MID, (uint8_t)( lba >> 8));
     outb(io + ATA_REG_LBA_HIGH, (uint8_t)( lba >>16));
     outb(io + ATA_REG_DRIVE_SELECT, 0xE0 | (ata_drive << 4) | ((lba >> 24) & 0x0F));
+}
 
-    outb(io + ATA_REG_COMMAND, cmd);
-
-    for (uint16_t s = 0; s < sectors; ++s) {
-        if (ata_wait(io, 1) != 0) return 0;
+//Requests of one command are chained through io.merged, io is their first member
+static inline BlockRequest* ide_next_merged(BlockRequest* req) {
+    return (BlockRequest*)req->io.merged;
+}
 
-        if (cmd == ATA_CMD_READ_PIO) {
-            for (int i = 0; i < 256; ++i) *rbuf++ = inw(io + ATA_REG_DATA);
-        } else {
-            for (int i = 0; i < 256; ++i) outw(io + ATA_REG_DATA, *wbuf++);
+//Describes every buffer of the command, splitting at each 64KB boundary. 0 if the
+//command does not fit the table or a buffer is not word aligned
+static int ide_build_prdt(IdePrd* prdt, BlockRequest* cmd) {
+    int n = 0;
+    for (BlockRequest* req = cmd; req; req = ide_next_merged(req)) {
+        uint64_t phys = (uint64_t)req->buffer;
+        uint32_t bytes = (uint32_t)req->io.sectors * 512;
+        if (phys & 1) return 0;
+
+        while (bytes > 0) {
+            if (n == IDE_PRD_MAX) return 0;
+            uint32_t chunk = 0x10000 - (phys & 0xFFFF);
+            if (chunk > bytes) chunk = bytes;
+            prdt[n].address = (uint32_t)phys;
+            prdt[n].byte_count = (uint16_t)chunk;
+            prdt[n].flags = 0;
+            phys += chunk;
+            bytes -= chunk;
+            n++;
         }
     }
+    prdt[n - 1].flags = IDE_PRD_EOT;
+    return n;
+}
+
+//Moves the command's next sector, walking from one merged request's buffer to the next
+static void ide_pio_sector(uint16_t io, IdeCommand* c) {
+    BlockRequest* req = c->pio_req;
+    uint16_t* words = (uint16_t*)((uint8_t*)req->buffer + (uint32_t)c->pio_sector * 512);
+    if (c->active->io.write) {
+        for (int i = 0; i < 256; ++i) outw(io + ATA_REG_DATA, words[i]);
+    } else {
+        for (int i = 0; i < 256; ++i) words[i] = inw(io + ATA_REG_DATA);
+    }
+
+    c->sectors_left--;
+    if (++c->pio_sector == req->io.sectors) {
+        c->pio_req = ide_next_merged(req);
+        c->pio_sector = 0;
+    }
+}
+
+//Issues the channel's active command, ide_handle_interrupt drives it from there. Channel lock held
+static int ide_start(int channel) {
+    IDEChannel*  ch        = &ide_channels[channel];
+    IdeCommand*  c         = &ide_commands[channel];
+    BlockRequest* cmd      = c->active;
+    uint16_t     io        = ch->base;
+    int          ata_drive = (c->disk->drive & 2) >> 1;
+    bool         write     = cmd->io.write;
+
+    if (cmd->flush) {
+        if (ata_wait_not_busy(io)) return -1;
+        c->stage = IDE_STAGE_FLUSH;
+        outb(io + ATA_REG_DRIVE_SELECT, 0xE0 | (ata_drive << 4));
+        outb(io + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+        return 0;
+    }
+
+    c->sectors_left = cmd->io.span;
+    c->pio_req = cmd;
+    c->pio_sector = 0;
+    c->stage = IDE_STAGE_TRANSFER;
+    c->dma = !c->pio_only && ch->bmide && ide_build_prdt(ch->prdt, cmd);
+
+    if (ata_wait_not_busy(io)) return -1;
+
+    if (c->dma) {
+        uint16_t bm = ch->bmide;
+        outb(bm + BM_REG_COMMAND, 0);
+        outl(bm + BM_REG_PRDT, (uint32_t)(uint64_t)ch->prdt);
+        outb(bm + BM_REG_STATUS, BM_SR_ERR | BM_SR_IRQ);
+        ide_taskfile(io, ata_drive, cmd->io.lba, cmd->io.span);
+        outb(io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+        outb(bm + BM_REG_COMMAND, BM_CMD_START | (write ? 0 : BM_CMD_READ));
+        return 0;
+    }
+
+    ide_taskfile(io, ata_drive, cmd->io.lba, cmd->io.span);
+    outb(io + ATA_REG_COMMAND, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+    if (write) {
+        //The first sector of a write is requested by DRQ alone, every other step raises an IRQ
+        if (ata_wait(io, 1) != 0) return -1;
+        ide_pio_sector(io, c);
+    }
+    return 0;
+}
 
-    if (cmd == ATA_CMD_WRITE_PIO) {
-        ata_wait(io, 0);
-        outb(io + ATA_REG_COMMAND, 0xE7);
+//BlockOps.start: the block layer has already merged and ordered the command
+static int ide_block_start(BlockDevice* dev, BlockRequest* cmd) {
+    IdeDisk* disk = (IdeDisk*)dev->driver;
+    int channel = disk->drive & 1;
+    IdeCommand* c = &ide_commands[channel];
+
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    if (c->active) {
+        //The other drive of the channel is mid-command
+        spin_unlock_irqrestore(&c->lock, flags);
+        return -1;
     }
-    return 1;
+    c->active = cmd;
+    c->disk = disk;
+    c->pio_only = false;
+    int result = ide_start(channel);
+    if (result != 0) c->active = NULL;
+    spin_unlock_irqrestore(&c->lock, flags);
+    return result;
+}
+
+//Maps a drive number to its block device, -1 if nothing was found there
+static int ide_block_id(uint8_t drive) {
+    IdeDisk* disk = &ide_disks[drive & 3];
+    return disk->block.ops ? disk->block.id : -1;
 }
 
 int ide_read_sectors (uint8_t d, uint32_t l, uint16_t c, void *b)
-{ return ide_pio_28(d, l, ATA_CMD_READ_PIO,  c, NULL, b); }
+{ return block_read(ide_block_id(d), l, c, b); }
 
 int ide_write_sectors(uint8_t d, uint32_t l, uint16_t c, const void *b)
-{ return ide_pio_28(d, l, ATA_CMD_WRITE_PIO, c, b, NULL); }
+{ return block_write(ide_block_id(d), l, c, b); }
 
 int ide_read (uint8_t d, uint32_t l, uint8_t c, uint16_t *b)
 { return ide_read_sectors (d, l, c, b); }
@@ -156,55 +312,57 @@ int ide_write(uint8_t d, uint32_t l, uint8_t c, uint16_t *b)
 { return ide_write_sectors(d, l, c, b); }
 
 void ide_handle_interrupt(int channel) {
-    uint16_t io = ide_channels[channel].base;
-    ide_channel_status_t *s = &channel_status[channel];
-
-    if (!s->busy) goto eoi;
-
-    uint8_t st = inb(io + ATA_REG_STATUS);
-
-    if (st & ATA_SR_ERR) {
-        s->busy = 0;
-        s->callback_ready = 1;
-        goto eoi;
-    }
-
-    if (s->command == ATA_CMD_READ_PIO && (st & ATA_SR_DRQ)) {
-        int words = (s->words_left < 256) ? s->words_left : 256;
-
-        for (int i = 0; i < words; ++i) *s->buffer++ = inw(io + ATA_REG_DATA);
-
-        s->words_left   -= words;
-        if (s->words_left == 0) {
-            s->sectors_left--;
-            if (s->sectors_left) {
-                s->words_left = 256;
-            } else {
-                s->busy = 0;
-                s->callback_ready = 1;
+    IDEChannel* ch = &ide_channels[channel];
+    IdeCommand* c = &ide_commands[channel];
+    uint16_t io = ch->base;
+    bool finished = false;
+    int status = 0;
+
+    uint64_t flags = spin_lock_irqsave(&c->lock);
+    BlockRequest* cmd = c->active;
+
+    if (!cmd) {
+        //Nothing in flight, reading the status acknowledges it
+        inb(io + ATA_REG_STATUS);
+    } else if (c->stage == IDE_STAGE_FLUSH) {
+        uint8_t st = inb(io + ATA_REG_STATUS);
+        finished = true;
+        status = (st & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+    } else if (c->dma) {
+        uint8_t bm_status = inb(ch->bmide + BM_REG_STATUS);
+        outb(ch->bmide + BM_REG_COMMAND, 0);
+        outb(ch->bmide + BM_REG_STATUS, BM_SR_ERR | BM_SR_IRQ);
+        uint8_t st = inb(io + ATA_REG_STATUS);
+        if ((st & (ATA_SR_ERR | ATA_SR_DF)) || (bm_status & BM_SR_ERR)) {
+            kprintf("ide_handle_interrupt: DMA at lba %d failed (bm status 0x%x), retrying by PIO\n",
+                    cmd->io.lba, bm_status);
+            c->pio_only = true;
+            if (ide_start(channel) != 0) {
+                finished = true;
+                status = -1;
             }
+        } else {
+            finished = true;
         }
-    }
-
-    else if (s->command == ATA_CMD_WRITE_PIO && (st & ATA_SR_DRQ)) {
-        int words = (s->words_left < 256) ? s->words_left : 256;
-
-        for (int i = 0; i < words; ++i) outw(io + ATA_REG_DATA, *s->buffer++);
-
-        s->words_left   -= words;
-        if (s->words_left == 0) {
-            s->sectors_left--;
-            if (s->sectors_left) {
-                s->words_left = 256;
-            } else {
-                outb(io + ATA_REG_COMMAND, 0xE7);
-                s->command = 0;
-            }
+    } else {
+        uint8_t st = inb(io + ATA_REG_STATUS);
+        if (st & (ATA_SR_ERR | ATA_SR_DF)) {
+            finished = true;
+            status = -1;
+        } else if (c->sectors_left == 0) {
+            finished = true;
+        } else if (st & ATA_SR_DRQ) {
+            ide_pio_sector(io, c);
+            if (!cmd->io.write && c->sectors_left == 0) finished = true;
         }
     }
+    if (finished) c->active = NULL;
 
-eoi:
+    spin_unlock_irqrestore(&c->lock, flags);
     pic_send_eoi(14 + channel);
+
+    //Starts the device's next command from here, so it must run with the channel unlocked
+    if (finished) block_complete(cmd, status);
 }
 
 static uint16_t ide_get_lba_count(void) 
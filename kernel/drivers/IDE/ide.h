@@ -2,6 +2,8 @@
 #define IDE_H
 
 #include "../../../lib/definitions.h"
+#include "../../mm/paging.h"
+#include "../block/block.h"
 
 #define ATA_PRIMARY 0x1F0
 #define ATA_SECONDARY 0x170
@@ -42,13 +44,49 @@
 #define ATA_CMD_WRITE_PIO       0x30
 #define ATA_CMD_WRITE_PIO_EXT   0x34
 #define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_CACHE_FLUSH     0xE7
+
+//Bus master IDE registers, from BAR4, the secondary channel's at +8
+#define BM_REG_COMMAND  0x00
+#define BM_REG_STATUS   0x02
+#define BM_REG_PRDT     0x04
+
+#define BM_CMD_START    0x01
+#define BM_CMD_READ     0x08    //device to memory
+#define BM_SR_ACTIVE    0x01
+#define BM_SR_ERR       0x02
+#define BM_SR_IRQ       0x04
+
+#define IDE_PRD_EOT     0x8000
+#define IDE_PRD_MAX     (PAGE_SIZE / sizeof(IdePrd))
+
+//Physical region descriptor: one piece of a DMA transfer, which may not cross a 64KB boundary
+typedef struct {
+    uint32_t address;
+    uint16_t byte_count;        //0 means 64KB
+    uint16_t flags;
+} __attribute__((packed)) IdePrd;
 
 typedef struct {
     uint16_t base;
     uint16_t control_base;
     uint8_t  nIEN;
+    uint16_t bmide;             //0 without bus mastering, PIO only
+    IdePrd*  prdt;
 } IDEChannel;
 
+#define IDE_STAGE_TRANSFER 0
+#define IDE_STAGE_FLUSH    1
+#define IDE_MAX_SECTORS    255     //per ATA command, merged requests included
+
+//A drive as the block layer sees it, drive is the channel in bit 0 and slave in bit 1
+typedef struct IdeDisk {
+    BlockDevice block;
+    uint8_t drive;
+} IdeDisk;
+
 void ide_init();
 void ide_handle_interrupt(int channel);
 int ide_read (uint8_t d, uint32_t l, uint8_t c, uint16_t *b);
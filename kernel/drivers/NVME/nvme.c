@@ -0,0 +1,374 @@
+#include "nvme.h"
+#include "../PCI/pci.h"
+#include "../../mm/frame.h"
+#include "../../cpu/src/pic.h"
+
+#define NVME_MAX_CONTROLLERS 4
+
+static int nvme_count = 0;
+
+static int nvme_block_start(BlockDevice* dev, BlockRequest* cmd);
+static void nvme_block_poll(BlockDevice* dev);
+
+static const BlockOps nvme_block_ops = {
+    .start = nvme_block_start,
+    .poll = nvme_block_poll,
+};
+
+static inline uint32_t nvme_read32(NvmeController* c, uint32_t reg) {
+    return *(volatile uint32_t*)(c->regs + reg);
+}
+
+static inline void nvme_write32(NvmeController* c, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(c->regs + reg) = value;
+}
+
+static inline uint64_t nvme_read64(NvmeController* c, uint32_t reg) {
+    return nvme_read32(c, reg) | ((uint64_t)nvme_read32(c, reg + 4) << 32);
+}
+
+static inline void nvme_write64(NvmeController* c, uint32_t reg, uint64_t value) {
+    nvme_write32(c, reg, (uint32_t)value);
+    nvme_write32(c, reg + 4, (uint32_t)(value >> 32));
+}
+
+//CAP.TO is in 500ms units
+static bool nvme_wait_ready(NvmeController* c, bool ready) {
+    uint64_t deadline = timer_get_us() + c->timeout_us;
+    while (((nvme_read32(c, NVME_REG_CSTS) & NVME_CSTS_RDY) != 0) != ready) {
+        if (nvme_read32(c, NVME_REG_CSTS) & NVME_CSTS_CFS) return false;
+        if (timer_get_us() > deadline) return false;
+    }
+    return true;
+}
+
+//Queue memory is a frame each, io queues also get a PRP list frame per command id
+static bool nvme_queue_create(NvmeController* c, NvmeQueue* q, uint16_t id, uint16_t size, bool io) {
+    memset(q, 0, sizeof(NvmeQueue));
+    q->sq = (NvmeCommand*)frame_alloc();
+    q->cq = (volatile NvmeCompletion*)frame_alloc();
+    if (!q->sq || !q->cq) return false;
+    memset(q->sq, 0, PAGE_SIZE);
+    memset((void*)q->cq, 0, PAGE_SIZE);
+
+    q->id = id;
+    q->size = size;
+    q->sq_doorbell = (volatile uint32_t*)(c->regs + NVME_REG_DOORBELLS + (2 * id) * c->doorbell_stride);
+    q->cq_doorbell = (volatile uint32_t*)(c->regs + NVME_REG_DOORBELLS + (2 * id + 1) * c->doorbell_stride);
+    q->phase = 1;
+    q->lock = SPINLOCK_INIT;
+
+    uint32_t depth = size - 1 < NVME_QUEUE_DEPTH ? size - 1 : NVME_QUEUE_DEPTH;
+    q->free = depth == 32 ? 0xFFFFFFFF : (1u << depth) - 1;
+    if (!io) return true;
+
+    for (uint32_t i = 0; i < depth; i++) {
+        q->prp_lists[i] = (uint64_t*)frame_alloc();
+        if (!q->prp_lists[i]) return false;
+    }
+    return true;
+}
+
+//Whatever nvme_queue_create got before it finished or failed
+static void nvme_queue_free(NvmeQueue* q) {
+    if (q->sq) frame_free((uint64_t)q->sq);
+    if (q->cq) frame_free((uint64_t)q->cq);
+    for (int i = 0; i < NVME_QUEUE_DEPTH; i++) {
+        if (q->prp_lists[i]) frame_free((uint64_t)q->prp_lists[i]);
+    }
+    memset(q, 0, sizeof(NvmeQueue));
+}
+
+//Queue lock held
+static void nvme_submit(NvmeQueue* q, NvmeCommand* cmd) {
+    q->sq[q->sq_tail] = *cmd;
+    q->sq_tail = (q->sq_tail + 1) % q->size;
+    __sync_synchronize();
+    *q->sq_doorbell = q->sq_tail;
+}
+
+//Next new completion or NULL. The caller hands it back with nvme_consume. Queue lock held
+static volatile NvmeCompletion* nvme_peek(NvmeQueue* q) {
+    volatile NvmeCompletion* cqe = &q->cq[q->cq_head];
+    return (cqe->status & 1) == q->phase ? cqe : NULL;
+}
+
+static void nvme_consume(NvmeQueue* q) {
+    if (++q->cq_head == q->size) {
+        q->cq_head = 0;
+        q->phase ^= 1;
+    }
+}
+
+//Admin commands only run during setup, one at a time and polled
+static bool nvme_admin(NvmeController* c, NvmeCommand* cmd, uint32_t* result) {
+    NvmeQueue* q = &c->admin;
+    cmd->cid = 0;
+    nvme_submit(q, cmd);
+
+    uint64_t deadline = timer_get_us() + c->timeout_us;
+    volatile NvmeCompletion* cqe;
+    while (!(cqe = nvme_peek(q))) {
+        if (timer_get_us() > deadline) {
+            kprintf("nvme_admin: opcode 0x%x timed out\n", cmd->opcode);
+            return false;
+        }
+    }
+    uint16_t status = cqe->status >> 1;
+    if (result) *result = cqe->result;
+    nvme_consume(q);
+    *q->cq_doorbell = q->cq_head;
+
+    if (status) kprintf("nvme_admin: opcode 0x%x failed with status 0x%x\n", cmd->opcode, status);
+    return status == 0;
+}
+
+static bool nvme_identify(NvmeController* c, uint32_t nsid, uint32_t cns, void* buffer) {
+    NvmeCommand cmd;
+    memset(&cmd, 0, sizeof(NvmeCommand));
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = (uint64_t)buffer;
+    cmd.cdw10 = cns;
+    return nvme_admin(c, &cmd, NULL);
+}
+
+//Completion queue first, its submission queue posts to it
+static bool nvme_create_io_queue(NvmeController* c, NvmeQueue* q, uint16_t id, uint16_t size) {
+    if (!nvme_queue_create(c, q, id, size, true)) return false;
+
+    NvmeCommand cmd;
+    memset(&cmd, 0, sizeof(NvmeCommand));
+    cmd.opcode = NVME_ADMIN_CREATE_CQ;
+    cmd.prp1 = (uint64_t)q->cq;
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | id;
+    cmd.cdw11 = 0x3;            //interrupts enabled, physically contiguous
+    if (!nvme_admin(c, &cmd, NULL)) return false;
+
+    memset(&cmd, 0, sizeof(NvmeCommand));
+    cmd.opcode = NVME_ADMIN_CREATE_SQ;
+    cmd.prp1 = (uint64_t)q->sq;
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | id;
+    cmd.cdw11 = ((uint32_t)id << 16) | 0x1;
+    return nvme_admin(c, &cmd, NULL);
+}
+
+//PRP1 is the buffer, PRP2 the second page or a list of every page after the first
+static uint64_t nvme_build_prp2(NvmeQueue* q, uint16_t cid, uint64_t addr, uint32_t bytes) {
+    uint32_t first = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+    if (bytes <= first) return 0;
+
+    uint64_t next = addr + first;
+    uint32_t rest = bytes - first;
+    if (rest <= PAGE_SIZE) return next;
+
+    uint64_t* list = q->prp_lists[cid];
+    for (uint32_t i = 0; i * PAGE_SIZE < rest; i++) list[i] = next + (uint64_t)i * PAGE_SIZE;
+    return (uint64_t)list;
+}
+
+//BlockOps.start: on the calling cpu's queue pair, so cpus never contend for a submission queue
+static int nvme_block_start(BlockDevice* dev, BlockRequest* req) {
+    NvmeController* c = (NvmeController*)dev->driver;
+    NvmeQueue* q = &c->io[this_cpu() % c->io_count];
+
+    uint64_t flags = spin_lock_irqsave(&q->lock);
+    if (!q->free) {
+        spin_unlock_irqrestore(&q->lock, flags);
+        return -1;
+    }
+    uint16_t cid = __builtin_ctz(q->free);
+    uint64_t addr = (uint64_t)req->buffer;
+    uint32_t bytes = (uint32_t)req->io.span * BLOCK_SECTOR_SIZE;
+
+    NvmeCommand cmd;
+    memset(&cmd, 0, sizeof(NvmeCommand));
+    cmd.cid = cid;
+    cmd.nsid = c->nsid;
+    if (req->flush) {
+        cmd.opcode = NVME_CMD_FLUSH;
+    } else {
+        cmd.opcode = req->io.write ? NVME_CMD_WRITE : NVME_CMD_READ;
+        cmd.prp1 = addr;
+        cmd.prp2 = nvme_build_prp2(q, cid, addr, bytes);
+        cmd.cdw10 = req->io.lba;
+        cmd.cdw11 = 0;
+        cmd.cdw12 = req->io.span - 1;
+    }
+
+    q->free &= ~(1u << cid);
+    q->active[cid] = req;
+    nvme_submit(q, &cmd);
+    spin_unlock_irqrestore(&q->lock, flags);
+    return 0;
+}
+
+static void nvme_reap(NvmeController* c) {
+    for (int i = 0; i < c->io_count; i++) {
+        NvmeQueue* q = &c->io[i];
+        BlockRequest* done[NVME_QUEUE_DEPTH];
+        int status[NVME_QUEUE_DEPTH];
+        int count = 0;
+
+        uint64_t flags = spin_lock_irqsave(&q->lock);
+        volatile NvmeCompletion* cqe;
+        while (count < NVME_QUEUE_DEPTH && (cqe = nvme_peek(q))) {
+            uint16_t cid = cqe->cid;
+            status[count] = (cqe->status >> 1) ? -1 : 0;
+            done[count++] = q->active[cid];
+            q->active[cid] = NULL;
+            q->free |= 1u << cid;
+            nvme_consume(q);
+        }
+        if (count) *q->cq_doorbell = q->cq_head;
+        spin_unlock_irqrestore(&q->lock, flags);
+
+        for (int j = 0; j < count; j++) block_complete(done[j], status[j]);
+    }
+}
+
+static void nvme_handle_interrupt(void* data) {
+    nvme_reap((NvmeController*)data);
+}
+
+//BlockOps.poll, used instead of the interrupt when the controller has none
+static void nvme_block_poll(BlockDevice* dev) {
+    nvme_reap((NvmeController*)dev->driver);
+}
+
+static bool nvme_enable(NvmeController* c, uint16_t admin_size) {
+    nvme_write32(c, NVME_REG_CC, nvme_read32(c, NVME_REG_CC) & ~NVME_CC_EN);
+    if (!nvme_wait_ready(c, false)) return false;
+
+    if (!nvme_queue_create(c, &c->admin, 0, admin_size, false)) return false;
+    nvme_write32(c, NVME_REG_AQA, ((uint32_t)(admin_size - 1) << 16) | (admin_size - 1));
+    nvme_write64(c, NVME_REG_ASQ, (uint64_t)c->admin.sq);
+    nvme_write64(c, NVME_REG_ACQ, (uint64_t)c->admin.cq);
+
+    //NVM command set, 4KB pages, round robin arbitration
+    nvme_write32(c, NVME_REG_CC, NVME_CC_EN | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    return nvme_wait_ready(c, true);
+}
+
+//Brings the controller up as far as a block device it can register. false leaves the rest to
+//nvme_teardown, whatever was set up so far
+static bool nvme_setup(NvmeController* c, const PciDevice* d, uint8_t* identify) {
+    uint64_t bar0 = pci_bar_address(d, 0);
+    c->regs = map_mmio(bar0, NVME_REG_DOORBELLS + PAGE_SIZE);
+    if (!c->regs) {
+        kprintf("nvme_probe: cannot map BAR0 0x%x\n", (uint32_t)bar0);
+        return false;
+    }
+    pci_enable_device(d);
+
+    uint64_t cap = nvme_read64(c, NVME_REG_CAP);
+    uint32_t entries = (cap & 0xFFFF) + 1;
+    uint16_t size = entries < NVME_QUEUE_ENTRIES ? entries : NVME_QUEUE_ENTRIES;
+    c->doorbell_stride = 4u << ((cap >> 32) & 0xF);
+    c->timeout_us = (((cap >> 24) & 0xFF) + 1) * 500000ULL;
+    if (!nvme_enable(c, size)) {
+        kprint("nvme_probe: controller did not become ready\n");
+        return false;
+    }
+
+    //Identify controller: MDTS at byte 77, namespace count at 516, volatile write cache at 525
+    if (!nvme_identify(c, 0, 1, identify)) return false;
+    uint8_t mdts = identify[77];
+    uint32_t namespaces = *(uint32_t*)(identify + 516);
+    bool write_cache = identify[525] & 1;
+
+    //Identify namespace 1: size at 0, formatted LBA size index at 26, formats from 128
+    c->nsid = 1;
+    if (namespaces < 1 || !nvme_identify(c, c->nsid, 0, identify)) return false;
+    uint64_t nsze = *(uint64_t*)identify;
+    uint8_t format = identify[26] & 0x0F;
+    uint8_t lbads = (*(uint32_t*)(identify + 128 + 4 * format) >> 16) & 0xFF;
+    if (lbads != 9) {
+        kprintf("nvme_probe: namespace 1 uses %d byte blocks, only 512 are supported\n", 1 << lbads);
+        return false;
+    }
+
+    //One queue pair per cpu, as many as the controller grants
+    uint32_t wanted = cpu_count > 0 ? cpu_count : 1;
+    uint32_t granted = 0;
+    NvmeCommand cmd;
+    memset(&cmd, 0, sizeof(NvmeCommand));
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEATURE_QUEUES;
+    cmd.cdw11 = ((wanted - 1) << 16) | (wanted - 1);
+    if (nvme_admin(c, &cmd, &granted)) {
+        uint32_t pairs = ((granted & 0xFFFF) < (granted >> 16) ? (granted & 0xFFFF) : (granted >> 16)) + 1;
+        if (pairs < wanted) wanted = pairs;
+    }
+    for (uint32_t i = 0; i < wanted; i++) {
+        if (!nvme_create_io_queue(c, &c->io[i], i + 1, size)) {
+            nvme_queue_free(&c->io[i]);
+            break;
+        }
+        c->io_count++;
+    }
+    if (!c->io_count) {
+        kprint("nvme_probe: no I/O queue\n");
+        return false;
+    }
+
+    uint32_t max_sectors = NVME_MAX_SECTORS;
+    if (mdts && ((PAGE_SIZE << mdts) / BLOCK_SECTOR_SIZE) < max_sectors) {
+        max_sectors = (PAGE_SIZE << mdts) / BLOCK_SECTOR_SIZE;
+    }
+
+    strcpy(c->block.name, "nvme0");
+    c->block.name[4] = '0' + nvme_count++;
+    c->block.sectors = nsze > 0xFFFFFFFF ? 0xFFFFFFFF : nsze;
+    c->block.max_sectors = max_sectors;
+    c->block.max_segments = 1;      //PRPs cannot describe merged buffers that are not page aligned
+    c->block.dma_align = 3;
+    c->block.queue_depth = size - 1 < NVME_QUEUE_DEPTH ? size - 1 : NVME_QUEUE_DEPTH;
+    c->block.speed = 5;
+    c->block.persistent = true;
+    c->block.write_cache = write_cache;
+    c->block.ops = &nvme_block_ops;
+    c->block.driver = c;
+    return true;
+}
+
+//Disabling the controller drops every queue it had, so their frames can go
+static void nvme_teardown(NvmeController* c) {
+    if (c->regs) {
+        nvme_write32(c, NVME_REG_CC, nvme_read32(c, NVME_REG_CC) & ~NVME_CC_EN);
+        nvme_wait_ready(c, false);
+    }
+    nvme_queue_free(&c->admin);
+    for (int i = 0; i < MAX_CPUS; i++) nvme_queue_free(&c->io[i]);
+    kfree(c);
+}
+
+static void nvme_probe(const PciDevice* d) {
+    NvmeController* c = kmalloc(sizeof(NvmeController));
+    uint8_t* identify = (uint8_t*)frame_alloc();
+    if (!c || !identify) {
+        if (c) kfree(c);
+        if (identify) frame_free((uint64_t)identify);
+        return;
+    }
+    memset(c, 0, sizeof(NvmeController));
+
+    bool ok = nvme_setup(c, d, identify);
+    frame_free((uint64_t)identify);
+    if (!ok) {
+        nvme_teardown(c);
+        return;
+    }
+
+    c->block.polled = pci_irq_register(d, nvme_handle_interrupt, c) < 0;
+    kprintf("NVMe: %d queue pairs of %d, %s completion\n", c->io_count, c->io[0].size,
+            c->block.polled ? "polled" : "interrupt");
+    block_register(&c->block);
+}
+
+void nvme_init() {
+    for (int i = 0; i < pci_get_device_count(); i++) {
+        const PciDevice* d = pci_get_device(i);
+        if (d->class_code == 0x01 && d->subclass == 0x08 && d->prog_if == 0x02) nvme_probe(d);
+    }
+}
\ No newline at end of file
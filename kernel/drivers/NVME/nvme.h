@@ -0,0 +1,97 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include "../../../lib/definitions.h"
+#include "../../mm/paging.h"
+#include "../../threading/threading.h"
+#include "../../threading/src/spinlock.h"
+#include "../block/block.h"
+
+#define NVME_REG_CAP        0x00
+#define NVME_REG_VS         0x08
+#define NVME_REG_INTMS      0x0C
+#define NVME_REG_INTMC      0x10
+#define NVME_REG_CC         0x14
+#define NVME_REG_CSTS       0x1C
+#define NVME_REG_AQA        0x24
+#define NVME_REG_ASQ        0x28
+#define NVME_REG_ACQ        0x30
+#define NVME_REG_DOORBELLS  0x1000
+
+#define NVME_CC_EN          (1u << 0)
+#define NVME_CC_IOSQES      (6u << 16)      //64 byte submission entries
+#define NVME_CC_IOCQES      (4u << 20)      //16 byte completion entries
+#define NVME_CSTS_RDY       (1u << 0)
+#define NVME_CSTS_CFS       (1u << 1)
+
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+#define NVME_FEATURE_QUEUES     0x07
+#define NVME_CMD_FLUSH          0x00
+#define NVME_CMD_WRITE          0x01
+#define NVME_CMD_READ           0x02
+
+#define NVME_QUEUE_ENTRIES  64
+#define NVME_QUEUE_DEPTH    32      //commands in flight per queue pair
+#define NVME_MAX_SECTORS    256     //128KB, at most 33 pages
+#define NVME_PRP_PER_PAGE   (PAGE_SIZE / sizeof(uint64_t))
+
+typedef struct {
+    uint8_t  opcode;
+    uint8_t  flags;
+    uint16_t cid;
+    uint32_t nsid;
+    uint64_t rsv;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+} __attribute__((packed)) NvmeCommand;
+
+typedef struct {
+    uint32_t result;
+    uint32_t rsv;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;            //bit 0 is the phase tag
+} __attribute__((packed)) NvmeCompletion;
+
+/*
+ * A submission queue and the completion queue it posts to. New completions
+ * are told apart from old ones by the phase tag, which the controller flips
+ * on every pass through the queue.
+ */
+typedef struct NvmeQueue {
+    uint16_t id;
+    uint16_t size;
+    NvmeCommand* sq;
+    volatile NvmeCompletion* cq;
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;
+    spinlock_t lock;
+    uint32_t free;              //command ids not in flight
+    BlockRequest* active[NVME_QUEUE_DEPTH];
+    uint64_t* prp_lists[NVME_QUEUE_DEPTH];
+} NvmeQueue;
+
+//One namespace of one controller, with an I/O queue pair for every cpu
+typedef struct NvmeController {
+    BlockDevice block;
+    volatile uint8_t* regs;
+    uint32_t doorbell_stride;
+    uint32_t nsid;
+    uint64_t timeout_us;          //for the controller to change state or answer an admin command
+    NvmeQueue admin;
+    NvmeQueue io[MAX_CPUS];
+    int io_count;
+} NvmeController;
+
+void nvme_init();
+
+#endif
\ No newline at end of file
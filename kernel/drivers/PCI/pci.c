@@ -1,8 +1,18 @@
 #include "pci.h"
+#include "../../cpu/src/pic.h"
 
 static PciDevice pci_devices[MAX_PCI_DEVICES];
 static int pci_device_count = 0;
 
+typedef struct {
+    pci_irq_handler_t handler;
+    void* data;
+} PciIrqHandler;
+
+//Only the lines the interrupt router hands out to PCI have a stub in interrupts.asm
+static const uint8_t pci_irq_lines[] = {5, 9, 10, 11};
+static PciIrqHandler pci_irq_handlers[16][PCI_IRQ_HANDLERS];
+
 uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset) {
     uint32_t address = (1u << 31)            |
                        ((uint32_t)bus      << 16) |
@@ -13,8 +23,8 @@ uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_
     return inl(PCI_CONFIG_DATA);
 }
 
-static void pci_config_write32(uint8_t bus, uint8_t device, uint8_t function,
-                               uint8_t offset, uint32_t value)
+void pci_config_write32(uint8_t bus, uint8_t device, uint8_t function,
+                        uint8_t offset, uint32_t value)
 {
     uint32_t address = (1u << 31)            |
                        ((uint32_t)bus      << 16) |
@@ -55,6 +65,7 @@ static void pci_add_device(uint8_t bus, uint8_t dev, uint8_t func) {
     d->prog_if   = (classReg >> 8) & 0xFF;
     d->subclass  = (classReg >> 16) & 0xFF;
     d->class_code= (classReg >> 24) & 0xFF;
+    d->irq_line  = pci_config_read8(bus, dev, func, 0x3C);
 
     kprintf("Found PCI device: Bus %d, Device %d, Function %d\n", bus, dev, func);
     kprintf("Vendor ID: 0x%x, Device ID: 0x%x\n", d->vendor_id, d->device_id);
@@ -109,4 +120,55 @@ int pci_get_device_count(void) {return pci_device_count;}
 
 const PciDevice* pci_get_device(int index) {
     return (index < pci_device_count) ? &pci_devices[index] : NULL;
+}
+
+//Memory and I/O decoding plus bus mastering, everything a DMA capable driver needs
+void pci_enable_device(const PciDevice* d) {
+    uint32_t command = pci_config_read32(d->bus, d->device, d->function, 0x04);
+    pci_config_write32(d->bus, d->device, d->function, 0x04, command | 0x07);
+}
+
+//Base of an I/O or memory BAR without its flag bits, 64 bit memory BARs span two slots
+uint64_t pci_bar_address(const PciDevice* d, int bar) {
+    uint8_t offset = 0x10 + bar * 4;
+    uint32_t low = pci_config_read32(d->bus, d->device, d->function, offset);
+    if (low & 1) return low & 0xFFFFFFFC;
+
+    uint64_t address = low & 0xFFFFFFF0;
+    if (((low >> 1) & 3) == 2) {
+        address |= (uint64_t)pci_config_read32(d->bus, d->device, d->function, offset + 4) << 32;
+    }
+    return address;
+}
+
+//Hooks handler to the device's INTx line, which may be shared. Returns the IRQ or -1
+int pci_irq_register(const PciDevice* d, pci_irq_handler_t handler, void* data) {
+    uint8_t irq = d->irq_line;
+    bool routed = false;
+    for (uint32_t i = 0; i < sizeof(pci_irq_lines); i++) {
+        if (pci_irq_lines[i] == irq) routed = true;
+    }
+    if (!routed) {
+        kprintf("pci_irq_register: IRQ %d of %x:%x is not supported\n", irq, d->vendor_id, d->device_id);
+        return -1;
+    }
+
+    for (int i = 0; i < PCI_IRQ_HANDLERS; i++) {
+        if (pci_irq_handlers[irq][i].handler) continue;
+        pci_irq_handlers[irq][i].handler = handler;
+        pci_irq_handlers[irq][i].data = data;
+        pic_unmask_irq(irq);
+        return irq;
+    }
+    kprintf("pci_irq_register: too many devices on IRQ %d\n", irq);
+    return -1;
+}
+
+//Level triggered and shared: every handler checks its own device
+void pci_handle_irq(uint8_t irq) {
+    for (int i = 0; i < PCI_IRQ_HANDLERS; i++) {
+        PciIrqHandler* h = &pci_irq_handlers[irq][i];
+        if (h->handler) h->handler(h->data);
+    }
+    pic_send_eoi(irq);
 }
\ No newline at end of file
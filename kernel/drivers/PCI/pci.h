@@ -24,11 +24,21 @@ typedef struct PciDevice {
     uint8_t  subclass;
     uint8_t  prog_if;
     uint8_t  revision;
+    uint8_t  irq_line;          //legacy INTx routed by the firmware, 0xFF if none
 } PciDevice;
 
+#define PCI_IRQ_HANDLERS 4      //devices sharing one line
+
+typedef void (*pci_irq_handler_t)(void* data);
+
 void pci_init(void);
 int pci_get_device_count(void);
 const PciDevice* pci_get_device(int index);
 uint32_t pci_config_read32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset, uint32_t value);
+void pci_enable_device(const PciDevice* d);
+uint64_t pci_bar_address(const PciDevice* d, int bar);
+int pci_irq_register(const PciDevice* d, pci_irq_handler_t handler, void* data);
+void pci_handle_irq(uint8_t irq);
 
 #endif
\ No newline at end of file
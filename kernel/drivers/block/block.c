@@ -0,0 +1,336 @@
+#include "block.h"
+#include "../../mm/paging.h"
+#include "../../threading/src/spinlock.h"
+
+static BlockDevice* block_devices[BLOCK_MAX_DEVICES];
+static int block_device_count = 0;
+
+static int block_device_read(Device* device, uint32_t lba, uint8_t* buffer, uint32_t count) {
+    return block_read(((BlockDevice*)device)->id, lba, count, buffer);
+}
+
+static int block_device_write(Device* device, uint32_t lba, uint8_t* buffer, uint32_t count) {
+    return block_write(((BlockDevice*)device)->id, lba, count, buffer);
+}
+
+//The driver has filled in name, sectors, max_sectors, ops and what else it knows. Returns the id
+int block_register(BlockDevice* dev) {
+    if (block_device_count == BLOCK_MAX_DEVICES) {
+        kprintf("block_register: no room for %s\n", dev->name);
+        return -1;
+    }
+
+    dev->device.name = dev->name;
+    dev->device.read = block_device_read;
+    dev->device.write = block_device_write;
+    if (!dev->queue_depth) dev->queue_depth = 1;
+    if (!dev->max_sectors) dev->max_sectors = 255;
+    if (!dev->max_segments) dev->max_segments = dev->max_sectors;
+    if (!dev->dma_align) dev->dma_align = 1;
+
+    dev->lock = SPINLOCK_INIT;
+    elevator_init(&dev->elevator, dev->max_sectors, dev->max_segments);
+    dev->in_flight = 0;
+    dev->plugged = 0;
+    dev->dispatching = false;
+    dev->flushing = false;
+    dev->held_head = dev->held_tail = NULL;
+    dev->done_head = dev->done_tail = NULL;
+    wait_queue_init(&dev->wait);
+    memset(&dev->stats, 0, sizeof(BlockStats));
+
+    dev->id = block_device_count;
+    block_devices[block_device_count++] = dev;
+    kprintf("block: %s is device %d, %d sectors\n", dev->name, dev->id, (uint32_t)dev->sectors);
+    return dev->id;
+}
+
+int block_count() {
+    return block_device_count;
+}
+
+BlockDevice* block_get(int id) {
+    return (id >= 0 && id < block_device_count) ? block_devices[id] : NULL;
+}
+
+BlockDevice* block_find(const char* name) {
+    for (int i = 0; i < block_device_count; i++) {
+        if (strcmp(block_devices[i]->name, name) == 0) return block_devices[i];
+    }
+    return NULL;
+}
+
+//Id of the fastest device, only counting ones that keep their data if persistent is set. -1 if none
+int block_fastest(bool persistent) {
+    int best = -1;
+    for (int i = 0; i < block_device_count; i++) {
+        if (persistent && !block_devices[i]->persistent) continue;
+        if (best < 0 || block_devices[i]->speed > block_devices[best]->speed) best = i;
+    }
+    return best;
+}
+
+//Finished requests wait on the done list until the lock is dropped. Lock held
+static void block_retire(BlockDevice* dev, BlockRequest* cmd, int status) {
+    BlockRequest* req = cmd;
+    while (req) {
+        BlockRequest* merged = (BlockRequest*)req->io.merged;
+        req->error = status;
+        req->next = NULL;
+        if (dev->done_tail) dev->done_tail->next = req;
+        else dev->done_head = req;
+        dev->done_tail = req;
+
+        if (status) dev->stats.errors++;
+        else if (req->flush) dev->stats.flushes++;
+        else if (req->io.write) {
+            dev->stats.writes++;
+            dev->stats.sectors_written += req->io.sectors;
+        } else {
+            dev->stats.reads++;
+            dev->stats.sectors_read += req->io.sectors;
+        }
+        req = merged;
+    }
+}
+
+//Callbacks run without the lock so they can submit again; once status is set the
+//submitter may free the request, so nothing touches it afterwards
+static void block_run_completions(BlockDevice* dev) {
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    BlockRequest* req = dev->done_head;
+    dev->done_head = dev->done_tail = NULL;
+    spin_unlock_irqrestore(&dev->lock, flags);
+    if (!req) return;
+
+    while (req) {
+        BlockRequest* next = req->next;
+        int error = req->error;
+        if (req->callback) req->callback(req, error);
+        req->status = error;
+        req = next;
+    }
+    wake_up_all(&dev->wait);
+}
+
+//Once no flush is with the driver, what was held behind one goes to the elevator, up to the
+//next flush. Lock held
+static void block_release_held(BlockDevice* dev) {
+    while (dev->held_head && !dev->held_head->flush) {
+        BlockRequest* req = dev->held_head;
+        dev->held_head = req->next;
+        if (!dev->held_head) dev->held_tail = NULL;
+        req->next = NULL;
+        elevator_add(&dev->elevator, &req->io);
+    }
+}
+
+//Feeds the driver commands until it has queue_depth of them. A held flush lets the elevator
+//drain and then goes out alone. Drivers may complete a command from inside start, which lands
+//back here and is left to the loop already running
+static void block_run_queue(BlockDevice* dev) {
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    if (dev->dispatching) {
+        spin_unlock_irqrestore(&dev->lock, flags);
+        block_run_completions(dev);
+        return;
+    }
+    dev->dispatching = true;
+
+    while (!dev->plugged && !dev->flushing && dev->in_flight < dev->queue_depth) {
+        BlockRequest* cmd;
+        block_release_held(dev);
+        if (!elevator_empty(&dev->elevator)) {
+            cmd = (BlockRequest*)elevator_next(&dev->elevator);
+        } else if (dev->held_head && dev->in_flight == 0) {
+            cmd = dev->held_head;
+            dev->held_head = cmd->next;
+            if (!dev->held_head) dev->held_tail = NULL;
+            cmd->next = NULL;
+            dev->flushing = true;
+        } else {
+            break;
+        }
+        dev->in_flight++;
+
+        spin_unlock_irqrestore(&dev->lock, flags);
+        int started = dev->ops->start(dev, cmd);
+        flags = spin_lock_irqsave(&dev->lock);
+
+        if (started != 0) {
+            dev->in_flight--;
+            if (cmd->flush) dev->flushing = false;
+            block_retire(dev, cmd, -1);
+        }
+    }
+
+    dev->dispatching = false;
+    memcpy(&dev->stats.queue, &dev->elevator.stats, sizeof(ElevatorStats));
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    block_run_completions(dev);
+}
+
+void block_submit(BlockRequest* req) {
+    BlockDevice* dev = req->dev;
+    req->status = BLOCK_REQ_PENDING;
+    req->next = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    if (req->flush && !dev->write_cache) {
+        //Without a write cache everything completed is already durable
+        block_retire(dev, req, 0);
+    } else if (!req->flush && (!req->buffer || ((uint64_t)req->buffer & dev->dma_align) ||
+        req->io.sectors == 0 || req->io.sectors > dev->max_sectors ||
+        req->io.lba + req->io.sectors > dev->sectors ||
+        (uint64_t)req->buffer + (uint32_t)req->io.sectors * BLOCK_SECTOR_SIZE > MEMORY_SIZE)) {
+        block_retire(dev, req, -1);
+    } else if (req->flush || dev->flushing || dev->held_head) {
+        //Nothing overtakes a flush, so it and all that follows it wait their turn in order
+        req->io.unit = 0;
+        if (dev->held_tail) dev->held_tail->next = req;
+        else dev->held_head = req;
+        dev->held_tail = req;
+    } else {
+        req->io.unit = 0;
+        elevator_add(&dev->elevator, &req->io);
+    }
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    block_run_queue(dev);
+}
+
+//Called by the driver once for every command it accepted, from any context
+void block_complete(BlockRequest* cmd, int status) {
+    BlockDevice* dev = cmd->dev;
+
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    dev->in_flight--;
+    if (cmd->flush) dev->flushing = false;
+    block_retire(dev, cmd, status);
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    block_run_queue(dev);
+}
+
+//0 once req completed successfully, -1 on error. Do not wait with the device plugged
+int block_wait(BlockRequest* req) {
+    BlockDevice* dev = req->dev;
+    if (dev->polled) {
+        while (req->status == BLOCK_REQ_PENDING) dev->ops->poll(dev);
+        return req->status;
+    }
+    wait_event(&dev->wait, req->status != BLOCK_REQ_PENDING);
+    return req->status;
+}
+
+//While plugged, requests only collect in the elevator so that a burst can be merged before
+//any of it is dispatched
+void block_plug(BlockDevice* dev) {
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    dev->plugged++;
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+void block_unplug(BlockDevice* dev) {
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    if (dev->plugged > 0) dev->plugged--;
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    block_run_queue(dev);
+}
+
+static inline bool kernel_buffer(BlockDevice* dev, const void* buffer, uint32_t bytes) {
+    uint64_t addr = (uint64_t)buffer;
+    return !(addr & dev->dma_align) && addr + bytes <= MEMORY_SIZE;
+}
+
+//Kernel buffers go out as one plugged burst of max_sectors commands
+static int transfer_direct(BlockDevice* dev, uint32_t lba, uint32_t count, bool write, uint8_t* buffer) {
+    uint32_t commands = (count + dev->max_sectors - 1) / dev->max_sectors;
+    BlockRequest* reqs = kmalloc(commands * sizeof(BlockRequest));
+    if (!reqs) return 0;
+    memset(reqs, 0, commands * sizeof(BlockRequest));
+
+    block_plug(dev);
+    for (uint32_t i = 0; i < commands; i++) {
+        uint32_t first = i * dev->max_sectors;
+        reqs[i].dev = dev;
+        reqs[i].io.lba = lba + first;
+        reqs[i].io.sectors = count - first > dev->max_sectors ? dev->max_sectors : count - first;
+        reqs[i].io.write = write;
+        reqs[i].buffer = buffer + first * BLOCK_SECTOR_SIZE;
+        block_submit(&reqs[i]);
+    }
+    block_unplug(dev);
+
+    int ok = 1;
+    for (uint32_t i = 0; i < commands; i++) {
+        if (block_wait(&reqs[i]) != 0) ok = 0;
+    }
+    kfree(reqs);
+    return ok;
+}
+
+//User memory, or anything else the device cannot reach, is bounced a piece at a time
+static int transfer_bounced(BlockDevice* dev, uint32_t lba, uint32_t count, bool write, uint8_t* buffer) {
+    uint8_t* bounce = kmalloc(BLOCK_BOUNCE_SIZE);
+    if (!bounce) return 0;
+
+    uint32_t per_bounce = BLOCK_BOUNCE_SIZE / BLOCK_SECTOR_SIZE;
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t n = count - done > per_bounce ? per_bounce : count - done;
+        uint8_t* part = buffer + done * BLOCK_SECTOR_SIZE;
+        if (write) memcpy(bounce, part, n * BLOCK_SECTOR_SIZE);
+        if (!transfer_direct(dev, lba + done, n, write, bounce)) break;
+        if (!write) memcpy(part, bounce, n * BLOCK_SECTOR_SIZE);
+        done += n;
+    }
+    kfree(bounce);
+    return done == count;
+}
+
+static int block_transfer(int id, uint32_t lba, uint32_t count, bool write, void* buffer) {
+    BlockDevice* dev = block_get(id);
+    if (!dev || !buffer) return 0;
+    if (count == 0) return 1;
+
+    if (kernel_buffer(dev, buffer, count * BLOCK_SECTOR_SIZE)) {
+        return transfer_direct(dev, lba, count, write, buffer);
+    }
+    return transfer_bounced(dev, lba, count, write, buffer);
+}
+
+//Synchronous transfers of any length to any buffer, 1 on success
+int block_read(int id, uint32_t lba, uint32_t count, void* buffer) {
+    return block_transfer(id, lba, count, false, buffer);
+}
+
+int block_write(int id, uint32_t lba, uint32_t count, const void* buffer) {
+    return block_transfer(id, lba, count, true, (void*)buffer);
+}
+
+//Waits until everything written so far is on the medium, 1 on success
+int block_flush(int id) {
+    BlockDevice* dev = block_get(id);
+    if (!dev) return 0;
+
+    BlockRequest req;
+    memset(&req, 0, sizeof(BlockRequest));
+    req.dev = dev;
+    req.flush = true;
+    block_submit(&req);
+    return block_wait(&req) == 0;
+}
+
+bool block_get_stats(int id, BlockStats* stats) {
+    BlockDevice* dev = block_get(id);
+    if (!dev) return false;
+
+    uint64_t flags = spin_lock_irqsave(&dev->lock);
+    memcpy(stats, &dev->stats, sizeof(BlockStats));
+    memcpy(&stats->queue, &dev->elevator.stats, sizeof(ElevatorStats));
+    spin_unlock_irqrestore(&dev->lock, flags);
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include "../../../lib/definitions.h"
+#include "../devices/device.h"
+#include "../../threading/threading.h"
+#include "elevator.h"
+
+#define BLOCK_MAX_DEVICES 8
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_NAME_LEN    16
+#define BLOCK_BOUNCE_SIZE (64 * 1024)
+#define BLOCK_REQ_PENDING 1
+
+struct BlockDevice;
+
+/*
+ * One transfer. block_submit() hands it to the device's elevator and returns
+ * at once; the driver completes it later, usually from its interrupt. status
+ * stays BLOCK_REQ_PENDING until then and is 0 or -1 afterwards. A flush
+ * carries no data: it is a barrier that starts once everything before it is
+ * done, nothing starts beside it, and it completes once the device's write
+ * cache is on the medium. Whatever is submitted after it is held back until
+ * then, so nothing can overtake it.
+ */
+typedef struct BlockRequest {
+    IoRequest io;               //lba, sectors and write, must stay first
+    struct BlockDevice* dev;
+    void*    buffer;            //kernel memory: it may complete in another address space
+    void   (*callback)(struct BlockRequest* req, int status);     //may run in an interrupt
+    void*    private;
+    bool     flush;
+    volatile int status;
+    int      error;
+    struct BlockRequest* next;  //the driver's until completion
+} BlockRequest;
+
+typedef struct BlockOps {
+    //Starts the command headed by cmd, merged requests follow through io.merged, or a flush.
+    //0 once the driver owns it, and then it calls block_complete() for it exactly once
+    int (*start)(struct BlockDevice* dev, BlockRequest* cmd);
+    //Optional: completes whatever the hardware has finished, for devices without an interrupt
+    void (*poll)(struct BlockDevice* dev);
+} BlockOps;
+
+typedef struct BlockStats {
+    ElevatorStats queue;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t flushes;
+    uint64_t errors;
+} BlockStats;
+
+/*
+ * A disk of any kind. The driver fills in the name, geometry and ops and
+ * registers it; the layer owns queueing, merging, plugging and accounting,
+ * and device.read/device.write give synchronous access to the rest of the
+ * kernel.
+ */
+typedef struct BlockDevice {
+    Device device;
+    char name[BLOCK_NAME_LEN];
+    int id;
+    uint64_t sectors;
+    uint32_t max_sectors;       //per command
+    uint32_t max_segments;      //buffers per command, 0 for no limit
+    uint32_t dma_align;         //address bits a buffer must have clear, 1 if not set
+    uint32_t queue_depth;       //commands the hardware takes at once
+    uint32_t speed;             //relative, higher is faster
+    bool persistent;            //contents survive a reboot
+    bool polled;                //no interrupt, block_wait() spins on ops->poll
+    bool write_cache;           //writes are only durable after a flush, drivers only see flushes if set
+    const BlockOps* ops;
+    void* driver;
+
+    spinlock_t lock;
+    Elevator elevator;
+    uint32_t in_flight;
+    int plugged;
+    bool dispatching;
+    bool flushing;              //a flush is with the driver
+    BlockRequest* held_head;    //a flush waiting for the queue to drain, then everything after it
+    BlockRequest* held_tail;
+    BlockRequest* done_head;
+    BlockRequest* done_tail;
+    WaitQueue wait;
+    BlockStats stats;
+} BlockDevice;
+
+int block_register(BlockDevice* dev);
+int block_count();
+BlockDevice* block_get(int id);
+BlockDevice* block_find(const char* name);
+int block_fastest(bool persistent);
+
+void block_submit(BlockRequest* req);
+int block_wait(BlockRequest* req);
+void block_complete(BlockRequest* cmd, int status);
+void block_plug(BlockDevice* dev);
+void block_unplug(BlockDevice* dev);
+
+int block_read(int id, uint32_t lba, uint32_t count, void* buffer);
+int block_write(int id, uint32_t lba, uint32_t count, const void* buffer);
+int block_flush(int id);
+bool block_get_stats(int id, BlockStats* stats);
+
+#endif
\ No newline at end of file
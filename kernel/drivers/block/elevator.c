@@ -0,0 +1,132 @@
+#include "elevator.h"
+#include "../../cpu/src/pic.h"
+
+void elevator_init(Elevator* e, uint32_t max_sectors, uint32_t max_segments) {
+    memset(e, 0, sizeof(Elevator));
+    e->max_sectors = max_sectors;
+    e->max_segments = max_segments;
+}
+
+bool elevator_empty(Elevator* e) {
+    return !e->reads && !e->writes;
+}
+
+static uint32_t command_end(IoRequest* cmd) {
+    return cmd->lba + cmd->span;
+}
+
+//Joins req to a queued command it continues or precedes, false if there is none
+static bool try_merge(Elevator* e, IoRequest** queue, IoRequest* req) {
+    for (IoRequest** link = queue; *link; link = &(*link)->next) {
+        IoRequest* cmd = *link;
+        if (cmd->unit != req->unit || cmd->span + req->sectors > e->max_sectors ||
+            cmd->segments >= e->max_segments) continue;
+
+        if (command_end(cmd) == req->lba) {
+            IoRequest* last = cmd;
+            while (last->merged) last = last->merged;
+            last->merged = req;
+            cmd->span += req->sectors;
+            cmd->segments++;
+            return true;
+        }
+        if (req->lba + req->sectors == cmd->lba) {
+            //req heads the command now and takes its place in the queue, which keeps it sorted
+            req->merged = cmd;
+            req->span = cmd->span + req->sectors;
+            req->segments = cmd->segments + 1;
+            req->oldest_us = cmd->oldest_us;
+            req->next = cmd->next;
+            *link = req;
+            return true;
+        }
+    }
+    return false;
+}
+
+void elevator_add(Elevator* e, IoRequest* req) {
+    req->span = req->sectors;
+    req->segments = 1;
+    req->queued_us = timer_get_us();
+    req->oldest_us = req->queued_us;
+    req->next = NULL;
+    req->merged = NULL;
+    e->stats.requests++;
+
+    IoRequest** queue = req->write ? &e->writes : &e->reads;
+    if (try_merge(e, queue, req)) {
+        e->stats.merged++;
+        return;
+    }
+
+    IoRequest** link = queue;
+    while (*link && (*link)->lba < req->lba) link = &(*link)->next;
+    req->next = *link;
+    *link = req;
+}
+
+static IoRequest* oldest(IoRequest* queue) {
+    IoRequest* found = queue;
+    for (IoRequest* cmd = queue; cmd; cmd = cmd->next) {
+        if (cmd->oldest_us < found->oldest_us) found = cmd;
+    }
+    return found;
+}
+
+//First command at or past the head position, wrapping around to the lowest LBA
+static IoRequest* sweep(Elevator* e, IoRequest* queue) {
+    for (IoRequest* cmd = queue; cmd; cmd = cmd->next) {
+        if (cmd->lba >= e->position) return cmd;
+    }
+    return queue;
+}
+
+static void unlink_command(IoRequest** queue, IoRequest* cmd) {
+    IoRequest** link = queue;
+    while (*link != cmd) link = &(*link)->next;
+    *link = cmd->next;
+    cmd->next = NULL;
+}
+
+//Takes the next command off the queues: the returned request heads it and the rest follow
+//through merged. NULL when nothing is queued
+IoRequest* elevator_next(Elevator* e) {
+    if (elevator_empty(e)) return NULL;
+
+    uint64_t now = timer_get_us();
+    IoRequest* cmd = NULL;
+
+    IoRequest* current = e->batch_write ? e->writes : e->reads;
+    if (e->batch_left > 0 && current) {
+        cmd = sweep(e, current);
+        e->batch_left--;
+    } else {
+        bool write = !e->reads || (e->writes && e->writes_starved >= ELEVATOR_WRITE_STARVE);
+        IoRequest* queue = write ? e->writes : e->reads;
+        uint64_t expire = write ? ELEVATOR_WRITE_EXPIRE : ELEVATOR_READ_EXPIRE;
+
+        IoRequest* first = oldest(queue);
+        if (now - first->oldest_us > expire) {
+            cmd = first;
+            e->stats.expired++;
+        } else {
+            cmd = sweep(e, queue);
+        }
+
+        if (write) e->writes_starved = 0;
+        else if (e->writes) e->writes_starved++;
+        e->batch_write = write;
+        e->batch_left = ELEVATOR_BATCH - 1;
+    }
+
+    unlink_command(cmd->write ? &e->writes : &e->reads, cmd);
+    e->position = command_end(cmd);
+    e->stats.commands++;
+
+    for (IoRequest* req = cmd; req; req = req->merged) {
+        uint64_t wait = now - req->queued_us;
+        e->stats.wait_us += wait;
+        if (wait > e->stats.max_wait_us) e->stats.max_wait_us = wait;
+    }
+    return cmd;
+}
\ No newline at end of file
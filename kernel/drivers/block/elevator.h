@@ -0,0 +1,59 @@
+#ifndef ELEVATOR_H
+#define ELEVATOR_H
+
+#include "../../../lib/definitions.h"
+
+#define ELEVATOR_BATCH          16          //commands dispatched before the direction is reconsidered
+#define ELEVATOR_READ_EXPIRE    50000       //us a read may wait before it is served out of order
+#define ELEVATOR_WRITE_EXPIRE   500000
+#define ELEVATOR_WRITE_STARVE   2           //read batches a waiting write lets pass
+
+//Part of a driver's request the scheduler sorts and merges on, the first member of it
+typedef struct IoRequest {
+    uint32_t lba;
+    uint16_t sectors;
+    bool     write;
+    uint8_t  unit;              //drive behind a shared queue, only the same one's requests merge
+    uint16_t span;              //sectors of the whole command while this heads one
+    uint16_t segments;          //requests in it, each a buffer of its own
+    uint64_t queued_us;
+    uint64_t oldest_us;         //queued_us of the command's oldest request, for its deadline
+    struct IoRequest* next;     //sorted queue
+    struct IoRequest* merged;   //requests after this one in the same command, by lba
+} IoRequest;
+
+typedef struct ElevatorStats {
+    uint64_t requests;
+    uint64_t commands;
+    uint64_t merged;            //requests that rode along on another's command
+    uint64_t wait_us;           //total time requests spent queued
+    uint64_t max_wait_us;
+    uint64_t expired;           //served out of order because their deadline passed
+} ElevatorStats;
+
+/*
+ * Deadline elevator. Reads and writes are kept in LBA order, and a request
+ * touching either end of a queued command of the same direction joins it, up
+ * to max_sectors and max_segments requests. Dispatch sweeps upward from the last position in batches,
+ * reads first; a batch starts at the oldest request instead once that one
+ * has waited past its deadline, and writes get a batch after at most
+ * ELEVATOR_WRITE_STARVE read batches.
+ */
+typedef struct Elevator {
+    IoRequest* reads;
+    IoRequest* writes;
+    uint32_t max_sectors;
+    uint32_t max_segments;
+    uint32_t position;
+    int batch_left;
+    bool batch_write;
+    int writes_starved;
+    ElevatorStats stats;
+} Elevator;
+
+void elevator_init(Elevator* e, uint32_t max_sectors, uint32_t max_segments);
+void elevator_add(Elevator* e, IoRequest* req);
+IoRequest* elevator_next(Elevator* e);
+bool elevator_empty(Elevator* e);
+
+#endif
\ No newline at end of file
@@ -3,11 +3,12 @@
 
 #include "../../../lib/definitions.h"
 
+//Returns 1 on success, 0 on failure
 typedef struct Device {
     char* name;
     void (*init)();
-    void (*read)(uint32_t lba, uint8_t* buffer, uint32_t count);
-    void (*write)(uint32_t lba, uint8_t* buffer, uint32_t count);
+    int (*read)(struct Device* dev, uint32_t lba, uint8_t* buffer, uint32_t count);
+    int (*write)(struct Device* dev, uint32_t lba, uint8_t* buffer, uint32_t count);
 } Device;
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "../../cpu/src/pic.h"
 #include "../../../lib/definitions.h"
 #include "../vga/vga.h"
+#include "../../threading/threading.h"
 //#include "macros.h"
 
 #define BUFFER_SIZE 2048
@@ -15,6 +16,8 @@ volatile uint8_t g_caps_lock_on = 0;
 volatile uint8_t g_arrow_key_pressed = 0;
 uint8_t g_macro_count = 0;
 
+static WaitQueue keyboard_wait_queue = WAIT_QUEUE_INIT;
+
 const char scancode_set1[128] = {
     0,      KEY_ESC, '1',    '2',    '3',    '4',    '5',    '6',
     '7',    '8',    '9',    '0',    '-',    '=',    KEY_BACKSPACE, KEY_TAB,
@@ -115,6 +118,7 @@ void isr_keyboard_handler() {
         }
 
         //check_for_macros();
+        if (g_last_char) wake_up_all(&keyboard_wait_queue);
     }
 
     pic_send_eoi(1);
@@ -143,7 +147,7 @@ char* keyboard_read_line() {
 
     while (1) {
         char c;
-        while ((c = keyboard_get_char()) == 0) asm volatile ("hlt");
+        wait_event(&keyboard_wait_queue, (c = keyboard_get_char()) != 0);
 
         g_last_char = 0;
 
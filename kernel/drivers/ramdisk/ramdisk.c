@@ -0,0 +1,104 @@
+#include "ramdisk.h"
+#include "../../mm/frame.h"
+
+static int ramdisk_count = 0;
+
+static int ramdisk_start(BlockDevice* dev, BlockRequest* cmd);
+
+static const BlockOps ramdisk_ops = {
+    .start = ramdisk_start,
+};
+
+//Copies count sectors from lba on, crossing into the next frame where a page ends
+static void ramdisk_copy(Ramdisk* disk, uint32_t lba, uint32_t count, uint8_t* buffer, bool write) {
+    while (count > 0) {
+        uint32_t page = lba / RAMDISK_PAGE_SECTORS;
+        uint32_t first = lba % RAMDISK_PAGE_SECTORS;
+        uint32_t n = RAMDISK_PAGE_SECTORS - first;
+        if (n > count) n = count;
+
+        uint8_t* data = (uint8_t*)disk->pages[page] + first * BLOCK_SECTOR_SIZE;
+        if (write) memcpy(data, buffer, n * BLOCK_SECTOR_SIZE);
+        else memcpy(buffer, data, n * BLOCK_SECTOR_SIZE);
+
+        lba += n;
+        count -= n;
+        buffer += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+//BlockOps.start: done by the time it returns, the merged requests follow each other by lba
+static int ramdisk_start(BlockDevice* dev, BlockRequest* cmd) {
+    Ramdisk* disk = (Ramdisk*)dev->driver;
+    if (!cmd->flush) {
+        uint32_t lba = cmd->io.lba;
+        for (BlockRequest* req = cmd; req; req = (BlockRequest*)req->io.merged) {
+            ramdisk_copy(disk, lba, req->io.sectors, (uint8_t*)req->buffer, req->io.write);
+            lba += req->io.sectors;
+        }
+    }
+    block_complete(cmd, 0);
+    return 0;
+}
+
+//A zeroed disk of sectors, rounded up to whole pages. Returns its block device id or -1
+int ramdisk_create(uint32_t sectors) {
+    if (ramdisk_count == RAMDISK_MAX_DISKS || sectors == 0) return -1;
+
+    Ramdisk* disk = kmalloc(sizeof(Ramdisk));
+    if (!disk) return -1;
+    memset(disk, 0, sizeof(Ramdisk));
+
+    disk->page_count = (sectors + RAMDISK_PAGE_SECTORS - 1) / RAMDISK_PAGE_SECTORS;
+    disk->pages = kmalloc(disk->page_count * sizeof(uint64_t));
+    if (!disk->pages) {
+        kfree(disk);
+        return -1;
+    }
+    for (uint32_t i = 0; i < disk->page_count; i++) {
+        disk->pages[i] = frame_alloc();
+        if (!disk->pages[i]) {
+            kprintf("ramdisk_create: out of frames after %d of %d\n", i, disk->page_count);
+            while (i > 0) frame_free(disk->pages[--i]);
+            kfree(disk->pages);
+            kfree(disk);
+            return -1;
+        }
+        memset((void*)disk->pages[i], 0, PAGE_SIZE);
+    }
+
+    strcpy(disk->block.name, "ram0");
+    disk->block.name[3] = '0' + ramdisk_count++;
+    disk->block.sectors = disk->page_count * RAMDISK_PAGE_SECTORS;
+    disk->block.max_sectors = RAMDISK_MAX_SECTORS;
+    disk->block.speed = 6;
+    disk->block.persistent = false;
+    disk->block.ops = &ramdisk_ops;
+    disk->block.driver = disk;
+    return block_register(&disk->block);
+}
+
+//Fills the whole ramdisk from source, starting at its sector lba. 1 on success
+int ramdisk_load(int ramdisk, int source, uint32_t lba) {
+    BlockDevice* dev = block_get(ramdisk);
+    BlockDevice* src = block_get(source);
+    if (!dev || !src || dev->ops != &ramdisk_ops) return 0;
+    if (lba + dev->sectors > src->sectors) {
+        kprintf("ramdisk_load: %s is too small for the image\n", src->name);
+        return 0;
+    }
+
+    //Straight into the frames, a page at a time
+    Ramdisk* disk = (Ramdisk*)dev->driver;
+    for (uint32_t i = 0; i < disk->page_count; i++) {
+        if (!block_read(source, lba + i * RAMDISK_PAGE_SECTORS, RAMDISK_PAGE_SECTORS, (void*)disk->pages[i])) {
+            kprintf("ramdisk_load: read from %s failed at sector %d\n", src->name, lba + i * RAMDISK_PAGE_SECTORS);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void ramdisk_init() {
+    if (ramdisk_create(RAMDISK_BOOT_SECTORS) < 0) kprint("ramdisk_init: no memory for the boot ramdisk\n");
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "../../../lib/definitions.h"
+#include "../../mm/paging.h"
+#include "../block/block.h"
+
+#define RAMDISK_MAX_DISKS       4
+#define RAMDISK_BOOT_SECTORS    4096    //2MB, created at boot for /tmp
+#define RAMDISK_MAX_SECTORS     1024    //per command, only bounds the elevator's merging
+#define RAMDISK_PAGE_SECTORS    (PAGE_SIZE / BLOCK_SECTOR_SIZE)
+
+/*
+ * A disk held in frames, one per 4KB of it. Commands are copied in place
+ * from start and complete before it returns, so the filesystem on top pays
+ * for its own work and nothing else. The contents are lost on reboot.
+ */
+typedef struct Ramdisk {
+    BlockDevice block;
+    uint64_t* pages;            //frame holding each 4KB of the disk
+    uint32_t page_count;
+} Ramdisk;
+
+void ramdisk_init();
+int ramdisk_create(uint32_t sectors);
+int ramdisk_load(int ramdisk, int source, uint32_t lba);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,456 @@
+#include "virtio.h"
+#include "../../mm/frame.h"
+
+static uint8_t virtio_get_status(VirtioDevice* dev) {
+    return dev->modern ? dev->common->device_status : inb(dev->io_base + VIRTIO_LEGACY_STATUS);
+}
+
+static void virtio_set_status(VirtioDevice* dev, uint8_t status) {
+    if (dev->modern) dev->common->device_status = status;
+    else outb(dev->io_base + VIRTIO_LEGACY_STATUS, status);
+}
+
+//Maps the structures the vendor capabilities point at, the first of each kind wins
+static void virtio_find_caps(VirtioDevice* dev) {
+    const PciDevice* d = dev->pci;
+    uint32_t status = pci_config_read32(d->bus, d->device, d->function, 0x04) >> 16;
+    if (!(status & 0x10)) return;
+
+    uint8_t ptr = pci_config_read32(d->bus, d->device, d->function, 0x34) & 0xFC;
+    while (ptr) {
+        uint32_t header = pci_config_read32(d->bus, d->device, d->function, ptr);
+        uint8_t next = (header >> 8) & 0xFC;
+        if ((header & 0xFF) == 0x09) {
+            uint8_t type = header >> 24;
+            uint8_t bar = pci_config_read32(d->bus, d->device, d->function, ptr + 4) & 0xFF;
+            uint32_t offset = pci_config_read32(d->bus, d->device, d->function, ptr + 8);
+            uint32_t length = pci_config_read32(d->bus, d->device, d->function, ptr + 12);
+            uint64_t base = bar < 6 ? pci_bar_address(d, bar) : 0;
+            volatile uint8_t* regs = base ? map_mmio(base + offset, length) : NULL;
+
+            if (type == VIRTIO_PCI_CAP_COMMON && !dev->common) {
+                dev->common = (VirtioCommonCfg*)regs;
+            } else if (type == VIRTIO_PCI_CAP_NOTIFY && !dev->notify_base) {
+                dev->notify_base = regs;
+                dev->notify_multiplier = pci_config_read32(d->bus, d->device, d->function, ptr + 16);
+            } else if (type == VIRTIO_PCI_CAP_ISR && !dev->isr) {
+                dev->isr = regs;
+            } else if (type == VIRTIO_PCI_CAP_DEVICE && !dev->config) {
+                dev->config = regs;
+            }
+        }
+        ptr = next;
+    }
+}
+
+//Picks the modern transport when the device describes it, the legacy I/O BAR otherwise.
+//Leaves the device reset and acknowledged
+bool virtio_pci_init(VirtioDevice* dev, const PciDevice* pci) {
+    memset(dev, 0, sizeof(VirtioDevice));
+    dev->pci = pci;
+
+    virtio_find_caps(dev);
+    dev->modern = dev->common && dev->notify_base && dev->isr;
+    if (!dev->modern) {
+        uint32_t bar0 = pci_config_read32(pci->bus, pci->device, pci->function, 0x10);
+        if (!(bar0 & 1)) {
+            kprintf("virtio_pci_init: %x:%x has no usable transport\n", pci->vendor_id, pci->device_id);
+            return false;
+        }
+        dev->io_base = bar0 & 0xFFFC;
+    }
+    pci_enable_device(pci);
+
+    virtio_set_status(dev, 0);
+    if (dev->modern) {
+        for (uint32_t t = 0; t < 1000000 && virtio_get_status(dev); t++);
+    }
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return true;
+}
+
+//Accepts the wanted features the device offers, dev->features says which
+bool virtio_negotiate(VirtioDevice* dev, uint64_t wanted) {
+    if (!dev->modern) {
+        uint32_t offered = inl(dev->io_base + VIRTIO_LEGACY_FEATURES);
+        dev->features = offered & wanted & 0xFFFFFFFF;
+        outl(dev->io_base + VIRTIO_LEGACY_GUEST_FEATURES, (uint32_t)dev->features);
+        return true;
+    }
+
+    dev->common->device_feature_select = 0;
+    uint64_t offered = dev->common->device_feature;
+    dev->common->device_feature_select = 1;
+    offered |= (uint64_t)dev->common->device_feature << 32;
+    if (!(offered & VIRTIO_F_VERSION_1)) return false;
+
+    dev->features = offered & (wanted | VIRTIO_F_VERSION_1);
+    dev->common->driver_feature_select = 0;
+    dev->common->driver_feature = (uint32_t)dev->features;
+    dev->common->driver_feature_select = 1;
+    dev->common->driver_feature = (uint32_t)(dev->features >> 32);
+
+    virtio_set_status(dev, virtio_get_status(dev) | VIRTIO_STATUS_FEATURES_OK);
+    return (virtio_get_status(dev) & VIRTIO_STATUS_FEATURES_OK) != 0;
+}
+
+//Page aligned and zeroed. Never freed, the device owns it for good
+static uint8_t* queue_alloc(uint32_t bytes) {
+    uint8_t* memory = kmalloc(bytes + PAGE_SIZE);
+    if (!memory) return NULL;
+    memory = (uint8_t*)(((uint64_t)memory + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1));
+    memset(memory, 0, bytes);
+    return memory;
+}
+
+//Descriptor table, available ring and used ring in the legacy layout, which modern accepts too
+static bool split_queue_init(Virtqueue* vq) {
+    uint16_t size = vq->size;
+    uint32_t avail_offset = size * sizeof(VirtqDesc);
+    uint32_t used_offset = (avail_offset + 6 + 2 * size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint8_t* memory = queue_alloc(used_offset + 6 + sizeof(VirtqUsedElem) * size);
+    if (!memory) return false;
+
+    vq->desc = (VirtqDesc*)memory;
+    vq->avail = (VirtqAvail*)(memory + avail_offset);
+    vq->used = (VirtqUsed*)(memory + used_offset);
+    for (uint16_t i = 0; i < size; i++) vq->desc[i].next = i + 1;
+    return true;
+}
+
+//Descriptor ring followed by the driver's and the device's event suppression. Both wrap
+//counters start at 1, so a zeroed ring holds nothing available and nothing used
+static bool packed_queue_init(Virtqueue* vq) {
+    uint16_t size = vq->size;
+    uint32_t ring_bytes = size * sizeof(VirtqPackedDesc);
+    uint8_t* memory = queue_alloc(ring_bytes + 2 * sizeof(VirtqEvent));
+    if (!memory) return false;
+
+    vq->ring = (VirtqPackedDesc*)memory;
+    vq->driver_event = (VirtqEvent*)(memory + ring_bytes);
+    vq->device_event = (VirtqEvent*)(memory + ring_bytes + sizeof(VirtqEvent));
+    vq->avail_wrap = true;
+    vq->used_wrap = true;
+    for (uint16_t i = 0; i < size; i++) vq->next_id[i] = i + 1;
+    //Interrupts are then asked for one used descriptor at a time, see packed_get_used
+    if (vq->event_idx) {
+        vq->driver_event->off_wrap = 1 << 15;
+        vq->driver_event->flags = VIRTQ_EVENT_F_DESC;
+    }
+    return true;
+}
+
+//Packed when the device offered it and it was negotiated, which only the modern transport can
+bool virtio_queue_init(VirtioDevice* dev, Virtqueue* vq, uint16_t index) {
+    memset(vq, 0, sizeof(Virtqueue));
+    vq->index = index;
+
+    uint16_t size;
+    if (dev->modern) {
+        dev->common->queue_select = index;
+        size = dev->common->queue_size;
+        if (size > VIRTQ_MAX_SIZE) {
+            size = VIRTQ_MAX_SIZE;
+            dev->common->queue_size = size;
+        }
+    } else {
+        outw(dev->io_base + VIRTIO_LEGACY_QUEUE_SELECT, index);
+        size = inw(dev->io_base + VIRTIO_LEGACY_QUEUE_SIZE);
+    }
+    if (size == 0 || size > VIRTQ_MAX_SIZE) {
+        kprintf("virtio_queue_init: queue %d has unusable size %d\n", index, size);
+        return false;
+    }
+    vq->size = size;
+    vq->num_free = size;
+    vq->event_idx = (dev->features & VIRTIO_F_EVENT_IDX) != 0;
+    vq->packed = dev->modern && (dev->features & VIRTIO_F_RING_PACKED);
+    if (!(vq->packed ? packed_queue_init(vq) : split_queue_init(vq))) return false;
+
+    if (dev->features & VIRTIO_F_INDIRECT_DESC) {
+        for (int i = 0; i < VIRTQ_INDIRECT_TABLES; i++) {
+            uint64_t table = frame_alloc();
+            if (!table) break;
+            vq->indirect_pool[i] = (VirtqDesc*)table;
+            vq->indirect_free |= 1u << i;
+        }
+    }
+
+    if (dev->modern) {
+        dev->common->queue_desc = vq->packed ? (uint64_t)vq->ring : (uint64_t)vq->desc;
+        dev->common->queue_driver = vq->packed ? (uint64_t)vq->driver_event : (uint64_t)vq->avail;
+        dev->common->queue_device = vq->packed ? (uint64_t)vq->device_event : (uint64_t)vq->used;
+        vq->notify = (volatile uint16_t*)(dev->notify_base +
+                                          dev->common->queue_notify_off * dev->notify_multiplier);
+        dev->common->queue_enable = 1;
+    } else {
+        outl(dev->io_base + VIRTIO_LEGACY_QUEUE_PFN, (uint32_t)((uint64_t)vq->desc / PAGE_SIZE));
+        vq->notify_port = dev->io_base + VIRTIO_LEGACY_QUEUE_NOTIFY;
+    }
+    return true;
+}
+
+void virtio_driver_ok(VirtioDevice* dev) {
+    virtio_set_status(dev, virtio_get_status(dev) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(VirtioDevice* dev) {
+    virtio_set_status(dev, virtio_get_status(dev) | VIRTIO_STATUS_FAILED);
+}
+
+//Reading the ISR status acknowledges the interrupt, 0 means it was another device's
+uint8_t virtio_isr(VirtioDevice* dev) {
+    return dev->modern ? *dev->isr : inb(dev->io_base + VIRTIO_LEGACY_ISR);
+}
+
+uint32_t virtio_config_read32(VirtioDevice* dev, uint32_t offset) {
+    if (dev->modern) return *(volatile uint32_t*)(dev->config + offset);
+    return inl(dev->io_base + VIRTIO_LEGACY_CONFIG + offset);
+}
+
+//Retried until the device did not change its configuration in between
+uint64_t virtio_config_read64(VirtioDevice* dev, uint32_t offset) {
+    uint64_t value;
+    uint8_t generation;
+    do {
+        generation = dev->modern ? dev->common->config_generation : 0;
+        value = virtio_config_read32(dev, offset) | ((uint64_t)virtio_config_read32(dev, offset + 4) << 32);
+    } while (dev->modern && generation != dev->common->config_generation);
+    return value;
+}
+
+//The event fields sit right after each ring
+static inline volatile uint16_t* avail_used_event(Virtqueue* vq) {
+    return (volatile uint16_t*)((uint8_t*)vq->avail + 4 + 2 * vq->size);
+}
+
+static inline volatile uint16_t* used_avail_event(Virtqueue* vq) {
+    return (volatile uint16_t*)((uint8_t*)vq->used + 4 + sizeof(VirtqUsedElem) * vq->size);
+}
+
+static void fill_desc(VirtqDesc* desc, const VirtqBuffer* buf, bool more) {
+    desc->addr = buf->addr;
+    desc->len = buf->len;
+    desc->flags = (buf->write ? VIRTQ_DESC_F_WRITE : 0) | (more ? VIRTQ_DESC_F_NEXT : 0);
+}
+
+static VirtqDesc* take_indirect(Virtqueue* vq) {
+    int slot = __builtin_ctz(vq->indirect_free);
+    vq->indirect_free &= ~(1u << slot);
+    return vq->indirect_pool[slot];
+}
+
+static void release_indirect(Virtqueue* vq, VirtqDesc* table) {
+    for (int i = 0; i < VIRTQ_INDIRECT_TABLES; i++) {
+        if (vq->indirect_pool[i] == table) vq->indirect_free |= 1u << i;
+    }
+}
+
+//Every descriptor but the first goes live as it is written. The first one's flags are written
+//last, so the device never sees part of a request
+static int packed_add(Virtqueue* vq, const VirtqBuffer* bufs, int count, void* token) {
+    VirtqPackedDesc* table = NULL;
+    if (vq->indirect_free && count > 1 && count <= (int)VIRTQ_INDIRECT_MAX && vq->num_free) {
+        table = (VirtqPackedDesc*)take_indirect(vq);
+        for (int i = 0; i < count; i++) {
+            table[i].addr = bufs[i].addr;
+            table[i].len = bufs[i].len;
+            table[i].id = 0;
+            table[i].flags = bufs[i].write ? VIRTQ_DESC_F_WRITE : 0;
+        }
+    } else if (vq->num_free < count) {
+        return -1;
+    }
+
+    //Each id holds at least one slot, so there is a free id whenever there is a free slot
+    uint16_t id = vq->free_head;
+    vq->free_head = vq->next_id[id];
+    uint16_t slots = table ? 1 : count;
+    uint16_t head = vq->next_avail;
+    uint16_t head_flags = 0;
+
+    for (int i = 0; i < slots; i++) {
+        VirtqPackedDesc* desc = &vq->ring[vq->next_avail];
+        uint16_t flags;
+        if (table) {
+            desc->addr = (uint64_t)table;
+            desc->len = count * sizeof(VirtqPackedDesc);
+            flags = VIRTQ_DESC_F_INDIRECT;
+        } else {
+            desc->addr = bufs[i].addr;
+            desc->len = bufs[i].len;
+            flags = (bufs[i].write ? VIRTQ_DESC_F_WRITE : 0) | (i < slots - 1 ? VIRTQ_DESC_F_NEXT : 0);
+        }
+        desc->id = id;
+        flags |= vq->avail_wrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+        if (i == 0) head_flags = flags;
+        else desc->flags = flags;
+
+        if (++vq->next_avail == vq->size) {
+            vq->next_avail = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
+
+    vq->num_free -= slots;
+    vq->added += slots;
+    vq->chain_len[id] = slots;
+    vq->tokens[id] = token;
+    vq->indirect[id] = (VirtqDesc*)table;
+    __sync_synchronize();
+    vq->ring[head].flags = head_flags;
+    return 0;
+}
+
+//Makes the buffers available as one request, token comes back from virtq_get_used.
+//-1 when there is no room, nothing is queued then. Caller serializes
+int virtq_add(Virtqueue* vq, const VirtqBuffer* bufs, int count, void* token) {
+    if (vq->packed) return packed_add(vq, bufs, count, token);
+    uint16_t head = vq->free_head;
+
+    if (vq->indirect_free && count > 1 && count <= (int)VIRTQ_INDIRECT_MAX && vq->num_free) {
+        VirtqDesc* table = take_indirect(vq);
+        for (int i = 0; i < count; i++) {
+            fill_desc(&table[i], &bufs[i], i < count - 1);
+            table[i].next = i + 1;
+        }
+
+        vq->free_head = vq->desc[head].next;
+        vq->num_free--;
+        vq->desc[head].addr = (uint64_t)table;
+        vq->desc[head].len = count * sizeof(VirtqDesc);
+        vq->desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+        vq->indirect[head] = table;
+    } else {
+        if (vq->num_free < count) return -1;
+        //Free descriptors are already chained through next, so the chain is the free list's front
+        uint16_t idx = head;
+        for (int i = 0; i < count; i++) {
+            fill_desc(&vq->desc[idx], &bufs[i], i < count - 1);
+            if (i < count - 1) idx = vq->desc[idx].next;
+        }
+        vq->free_head = vq->desc[idx].next;
+        vq->num_free -= count;
+        vq->indirect[head] = NULL;
+    }
+
+    vq->tokens[head] = token;
+    vq->avail->ring[vq->avail->idx % vq->size] = head;
+    __sync_synchronize();
+    vq->avail->idx++;
+    return 0;
+}
+
+static bool split_needs_kick(Virtqueue* vq) {
+    uint16_t added = vq->avail->idx;
+    uint16_t old = vq->kicked;
+    vq->kicked = added;
+
+    if (vq->event_idx) {
+        uint16_t event = *used_avail_event(vq);
+        return (uint16_t)(added - event - 1) < (uint16_t)(added - old);
+    }
+    return !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+}
+
+//The device's event offset counts within its wrap counter's lap, so one from the lap before
+//next_avail's is taken a ring size back
+static bool packed_needs_kick(Virtqueue* vq) {
+    uint16_t added = vq->added;
+    vq->added = 0;
+
+    uint16_t flags = vq->device_event->flags;
+    if (flags != VIRTQ_EVENT_F_DESC) return flags != VIRTQ_EVENT_F_DISABLE;
+
+    uint16_t off_wrap = vq->device_event->off_wrap;
+    uint16_t event = off_wrap & 0x7FFF;
+    if ((bool)(off_wrap >> 15) != vq->avail_wrap) event -= vq->size;
+    return (uint16_t)(vq->next_avail - event - 1) < added;
+}
+
+//Tells the device about new requests, unless it said it does not need to hear yet
+void virtq_kick(Virtqueue* vq) {
+    __sync_synchronize();
+    if (!(vq->packed ? packed_needs_kick(vq) : split_needs_kick(vq))) return;
+
+    if (vq->notify) *vq->notify = vq->index;
+    else outw(vq->notify_port, vq->index);
+}
+
+static void release_chain(Virtqueue* vq, uint16_t head) {
+    VirtqDesc* table = vq->indirect[head];
+    uint16_t last = head;
+    uint16_t count = 1;
+
+    if (table) {
+        release_indirect(vq, table);
+        vq->indirect[head] = NULL;
+    } else {
+        while (vq->desc[last].flags & VIRTQ_DESC_F_NEXT) {
+            last = vq->desc[last].next;
+            count++;
+        }
+    }
+    vq->desc[last].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+}
+
+//The device marks a request used in its first slot: AVAIL and USED both equal to the wrap
+//counter of the lap the driver is reading
+static bool packed_is_used(Virtqueue* vq) {
+    uint16_t flags = vq->ring[vq->last_used].flags;
+    bool avail = (flags & VIRTQ_DESC_F_AVAIL) != 0;
+    bool used = (flags & VIRTQ_DESC_F_USED) != 0;
+    return avail == used && used == vq->used_wrap;
+}
+
+static void* packed_get_used(Virtqueue* vq) {
+    if (!packed_is_used(vq)) {
+        if (!vq->event_idx) return NULL;
+        vq->driver_event->off_wrap = vq->last_used | (vq->used_wrap ? 1 << 15 : 0);
+        __sync_synchronize();
+        if (!packed_is_used(vq)) return NULL;
+    }
+    __sync_synchronize();
+
+    uint16_t id = vq->ring[vq->last_used].id;
+    uint16_t slots = vq->chain_len[id];
+    vq->last_used += slots;
+    if (vq->last_used >= vq->size) {
+        vq->last_used -= vq->size;
+        vq->used_wrap = !vq->used_wrap;
+    }
+    vq->num_free += slots;
+
+    if (vq->indirect[id]) {
+        release_indirect(vq, vq->indirect[id]);
+        vq->indirect[id] = NULL;
+    }
+    void* token = vq->tokens[id];
+    vq->tokens[id] = NULL;
+    vq->next_id[id] = vq->free_head;
+    vq->free_head = id;
+    return token;
+}
+
+//Token of the next request the device finished, NULL once there are none. With event
+//indices the device is then asked to interrupt for the very next one
+void* virtq_get_used(Virtqueue* vq) {
+    if (vq->packed) return packed_get_used(vq);
+    if (vq->last_used == vq->used->idx) {
+        if (!vq->event_idx) return NULL;
+        *avail_used_event(vq) = vq->last_used;
+        __sync_synchronize();
+        if (vq->last_used == vq->used->idx) return NULL;
+    }
+    __sync_synchronize();
+
+    uint16_t head = (uint16_t)vq->used->ring[vq->last_used % vq->size].id;
+    vq->last_used++;
+    void* token = vq->tokens[head];
+    vq->tokens[head] = NULL;
+    release_chain(vq, head);
+    return token;
+}
\ No newline at end of file
@@ -0,0 +1,186 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "../../../lib/definitions.h"
+#include "../PCI/pci.h"
+#include "../../mm/paging.h"
+
+#define VIRTIO_VENDOR           0x1AF4
+
+#define VIRTIO_STATUS_ACKNOWLEDGE   1
+#define VIRTIO_STATUS_DRIVER        2
+#define VIRTIO_STATUS_DRIVER_OK     4
+#define VIRTIO_STATUS_FEATURES_OK   8
+#define VIRTIO_STATUS_FAILED        128
+
+#define VIRTIO_F_INDIRECT_DESC  (1ULL << 28)
+#define VIRTIO_F_EVENT_IDX      (1ULL << 29)
+#define VIRTIO_F_VERSION_1      (1ULL << 32)
+#define VIRTIO_F_RING_PACKED    (1ULL << 34)
+
+//Legacy transport: registers behind the I/O BAR0
+#define VIRTIO_LEGACY_FEATURES      0x00
+#define VIRTIO_LEGACY_GUEST_FEATURES 0x04
+#define VIRTIO_LEGACY_QUEUE_PFN     0x08
+#define VIRTIO_LEGACY_QUEUE_SIZE    0x0C
+#define VIRTIO_LEGACY_QUEUE_SELECT  0x0E
+#define VIRTIO_LEGACY_QUEUE_NOTIFY  0x10
+#define VIRTIO_LEGACY_STATUS        0x12
+#define VIRTIO_LEGACY_ISR           0x13
+#define VIRTIO_LEGACY_CONFIG        0x14
+
+//Modern transport: structures found through vendor PCI capabilities
+#define VIRTIO_PCI_CAP_COMMON   1
+#define VIRTIO_PCI_CAP_NOTIFY   2
+#define VIRTIO_PCI_CAP_ISR      3
+#define VIRTIO_PCI_CAP_DEVICE   4
+
+typedef volatile struct {
+    uint32_t device_feature_select;
+    uint32_t device_feature;
+    uint32_t driver_feature_select;
+    uint32_t driver_feature;
+    uint16_t msix_config;
+    uint16_t num_queues;
+    uint8_t  device_status;
+    uint8_t  config_generation;
+    uint16_t queue_select;
+    uint16_t queue_size;
+    uint16_t queue_msix_vector;
+    uint16_t queue_enable;
+    uint16_t queue_notify_off;
+    uint64_t queue_desc;
+    uint64_t queue_driver;
+    uint64_t queue_device;
+} __attribute__((packed)) VirtioCommonCfg;
+
+#define VIRTQ_DESC_F_NEXT       1
+#define VIRTQ_DESC_F_WRITE      2
+#define VIRTQ_DESC_F_INDIRECT   4
+#define VIRTQ_DESC_F_AVAIL      (1 << 7)    //packed: matches the wrap counter of the lap it was made available in
+#define VIRTQ_DESC_F_USED       (1 << 15)   //packed: set equal to AVAIL by the device once used
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+#define VIRTQ_USED_F_NO_NOTIFY      1
+
+#define VIRTQ_EVENT_F_ENABLE    0
+#define VIRTQ_EVENT_F_DISABLE   1
+#define VIRTQ_EVENT_F_DESC      2           //only at off_wrap, needs VIRTIO_F_EVENT_IDX
+
+#define VIRTQ_MAX_SIZE          256
+#define VIRTQ_INDIRECT_MAX      (PAGE_SIZE / sizeof(VirtqDesc))    //descriptors in one indirect table
+#define VIRTQ_INDIRECT_TABLES   16      //a frame each, one per request in flight
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) VirtqDesc;
+
+//Packed ring entry. The device writes the first descriptor of a request back with its id
+//once the whole request is used
+typedef volatile struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t id;
+    uint16_t flags;
+} __attribute__((packed)) VirtqPackedDesc;
+
+//Packed event suppression: the driver's says when to interrupt, the device's when to notify
+typedef volatile struct {
+    uint16_t off_wrap;          //ring offset, wrap counter in bit 15
+    uint16_t flags;
+} __attribute__((packed)) VirtqEvent;
+
+//ring[size] is followed by used_event
+typedef volatile struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__((packed)) VirtqAvail;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed)) VirtqUsedElem;
+
+//ring[size] is followed by avail_event
+typedef volatile struct {
+    uint16_t flags;
+    uint16_t idx;
+    VirtqUsedElem ring[];
+} __attribute__((packed)) VirtqUsed;
+
+//One piece of a request, write means the device writes it
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    bool write;
+} VirtqBuffer;
+
+/*
+ * Split or packed virtqueue. A request of several buffers takes a single ring
+ * slot when the device reads indirect tables, so the ring never limits how
+ * much one request can describe. With event indices both sides say how far
+ * the other may get before it needs an interrupt or a notification.
+ *
+ * A packed ring is one array the driver fills and the device writes back in
+ * place, which wrap counters tell apart lap by lap. Requests are named by a
+ * buffer id of their own rather than by their head descriptor.
+ */
+typedef struct Virtqueue {
+    uint16_t index;
+    uint16_t size;
+    bool packed;
+    VirtqDesc* desc;
+    VirtqAvail* avail;
+    VirtqUsed* used;
+    uint16_t free_head;         //packed: first free buffer id
+    uint16_t num_free;
+    uint16_t last_used;
+    uint16_t kicked;            //avail->idx at the last notification
+    void* tokens[VIRTQ_MAX_SIZE];
+    VirtqDesc* indirect[VIRTQ_MAX_SIZE];   //table a head descriptor points to, if any
+    VirtqDesc* indirect_pool[VIRTQ_INDIRECT_TABLES];
+    uint32_t indirect_free;     //bitmap over indirect_pool, 0 without indirect descriptors
+    volatile uint16_t* notify;  //modern
+    uint16_t notify_port;       //legacy
+    bool event_idx;
+
+    VirtqPackedDesc* ring;
+    VirtqEvent* driver_event;
+    VirtqEvent* device_event;
+    uint16_t next_avail;
+    uint16_t added;             //descriptors made available since the last notification
+    bool avail_wrap;
+    bool used_wrap;
+    uint16_t chain_len[VIRTQ_MAX_SIZE];    //ring slots each buffer id takes
+    uint16_t next_id[VIRTQ_MAX_SIZE];      //free buffer ids, chained from free_head
+} Virtqueue;
+
+typedef struct VirtioDevice {
+    const PciDevice* pci;
+    bool modern;
+    uint16_t io_base;
+    VirtioCommonCfg* common;
+    volatile uint8_t* notify_base;
+    uint32_t notify_multiplier;
+    volatile uint8_t* isr;
+    volatile uint8_t* config;
+    uint64_t features;
+} VirtioDevice;
+
+bool virtio_pci_init(VirtioDevice* dev, const PciDevice* pci);
+bool virtio_negotiate(VirtioDevice* dev, uint64_t wanted);
+bool virtio_queue_init(VirtioDevice* dev, Virtqueue* vq, uint16_t index);
+void virtio_driver_ok(VirtioDevice* dev);
+void virtio_fail(VirtioDevice* dev);
+uint8_t virtio_isr(VirtioDevice* dev);
+uint32_t virtio_config_read32(VirtioDevice* dev, uint32_t offset);
+uint64_t virtio_config_read64(VirtioDevice* dev, uint32_t offset);
+
+int virtq_add(Virtqueue* vq, const VirtqBuffer* bufs, int count, void* token);
+void virtq_kick(Virtqueue* vq);
+void* virtq_get_used(Virtqueue* vq);
+
+#endif
\ No newline at end of file
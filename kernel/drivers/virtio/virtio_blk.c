@@ -0,0 +1,144 @@
+#include "virtio_blk.h"
+
+static int virtio_blk_count = 0;
+
+static int virtio_blk_start(BlockDevice* dev, BlockRequest* cmd);
+
+static const BlockOps virtio_blk_ops = {
+    .start = virtio_blk_start,
+};
+
+//BlockOps.start: header, the command's buffers joined where they touch, then the status byte.
+//A flush has no buffers
+static int virtio_blk_start(BlockDevice* dev, BlockRequest* cmd) {
+    VirtioBlk* blk = (VirtioBlk*)dev->driver;
+
+    uint64_t flags = spin_lock_irqsave(&blk->lock);
+    if (!blk->free_cmds) {
+        spin_unlock_irqrestore(&blk->lock, flags);
+        return -1;
+    }
+    int slot = __builtin_ctz(blk->free_cmds);
+    VirtioBlkCmd* vcmd = &blk->cmds[slot];
+    vcmd->header.type = cmd->flush ? VIRTIO_BLK_T_FLUSH : cmd->io.write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    vcmd->header.reserved = 0;
+    vcmd->header.sector = cmd->flush ? 0 : cmd->io.lba;
+    vcmd->status = 0xFF;
+    vcmd->req = cmd;
+
+    int n = 0;
+    blk->bufs[n++] = (VirtqBuffer){(uint64_t)&vcmd->header, sizeof(VirtioBlkHeader), false};
+    for (BlockRequest* req = cmd->flush ? NULL : cmd; req; req = (BlockRequest*)req->io.merged) {
+        uint64_t addr = (uint64_t)req->buffer;
+        uint32_t bytes = (uint32_t)req->io.sectors * BLOCK_SECTOR_SIZE;
+        VirtqBuffer* last = &blk->bufs[n - 1];
+        if (n > 1 && last->addr + last->len == addr) {
+            last->len += bytes;
+        } else {
+            blk->bufs[n++] = (VirtqBuffer){addr, bytes, !cmd->io.write};
+        }
+    }
+    blk->bufs[n++] = (VirtqBuffer){(uint64_t)&vcmd->status, 1, true};
+
+    if (virtq_add(&blk->vq, blk->bufs, n, vcmd) != 0) {
+        spin_unlock_irqrestore(&blk->lock, flags);
+        return -1;
+    }
+    blk->free_cmds &= ~(1u << slot);
+    virtq_kick(&blk->vq);
+    spin_unlock_irqrestore(&blk->lock, flags);
+    return 0;
+}
+
+static void virtio_blk_interrupt(void* data) {
+    VirtioBlk* blk = (VirtioBlk*)data;
+    if (!virtio_isr(&blk->dev)) return;
+
+    BlockRequest* done[VIRTQ_INDIRECT_TABLES];
+    int status[VIRTQ_INDIRECT_TABLES];
+    int count = 0;
+
+    uint64_t flags = spin_lock_irqsave(&blk->lock);
+    VirtioBlkCmd* vcmd;
+    while ((vcmd = virtq_get_used(&blk->vq)) != NULL) {
+        done[count] = vcmd->req;
+        status[count] = vcmd->status == VIRTIO_BLK_S_OK ? 0 : -1;
+        count++;
+        blk->free_cmds |= 1u << (vcmd - blk->cmds);
+    }
+    spin_unlock_irqrestore(&blk->lock, flags);
+
+    for (int i = 0; i < count; i++) block_complete(done[i], status[i]);
+}
+
+static void virtio_blk_probe(const PciDevice* d) {
+    VirtioBlk* blk = kmalloc(sizeof(VirtioBlk));
+    if (!blk) return;
+    memset(blk, 0, sizeof(VirtioBlk));
+    blk->lock = SPINLOCK_INIT;
+
+    VirtioDevice* dev = &blk->dev;
+    uint64_t wanted = VIRTIO_F_INDIRECT_DESC | VIRTIO_F_EVENT_IDX | VIRTIO_F_RING_PACKED | VIRTIO_BLK_F_SIZE_MAX |
+                      VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH;
+    if (!virtio_pci_init(dev, d)) return;
+    if (!virtio_negotiate(dev, wanted) || !virtio_queue_init(dev, &blk->vq, 0)) {
+        kprint("virtio_blk_probe: device setup failed\n");
+        virtio_fail(dev);
+        return;
+    }
+
+    //Segments per request: an indirect table's worth, else what the ring holds at once
+    uint32_t segments = VIRTIO_BLK_MAX_SEGMENTS;
+    uint32_t depth = 0;
+    for (int i = 0; i < VIRTQ_INDIRECT_TABLES; i++) {
+        if (blk->vq.indirect_free & (1u << i)) depth++;
+    }
+    if (!depth) {
+        segments = blk->vq.size - 2;
+        if (segments > VIRTIO_BLK_MAX_SEGMENTS) segments = VIRTIO_BLK_MAX_SEGMENTS;
+        depth = 1;
+    }
+    uint32_t max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    if (dev->features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t seg_max = virtio_config_read32(dev, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < segments) segments = seg_max;
+    }
+    if (dev->features & VIRTIO_BLK_F_SIZE_MAX) {
+        //Joined buffers can make one segment of a whole command
+        uint32_t size_max = virtio_config_read32(dev, VIRTIO_BLK_CFG_SIZE_MAX) / BLOCK_SECTOR_SIZE;
+        if (size_max && size_max < max_sectors) max_sectors = size_max;
+    }
+    blk->free_cmds = depth == 32 ? 0xFFFFFFFF : (1u << depth) - 1;
+
+    if (pci_irq_register(d, virtio_blk_interrupt, blk) < 0) {
+        virtio_fail(dev);
+        return;
+    }
+    virtio_driver_ok(dev);
+
+    uint64_t capacity = virtio_config_read64(dev, VIRTIO_BLK_CFG_CAPACITY);
+    strcpy(blk->block.name, "vda");
+    blk->block.name[2] = 'a' + virtio_blk_count++;
+    blk->block.sectors = capacity > 0xFFFFFFFF ? 0xFFFFFFFF : capacity;
+    blk->block.max_sectors = max_sectors;
+    blk->block.max_segments = segments;
+    blk->block.queue_depth = depth;
+    blk->block.speed = 4;
+    blk->block.persistent = true;
+    blk->block.write_cache = (dev->features & VIRTIO_BLK_F_FLUSH) != 0;
+    blk->block.ops = &virtio_blk_ops;
+    blk->block.driver = blk;
+
+    kprintf("virtio-blk: %s transport, %s queue %d, depth %d%s\n", dev->modern ? "modern" : "legacy",
+            blk->vq.packed ? "packed" : "split", blk->vq.size, depth, blk->vq.event_idx ? ", event index" : "");
+    block_register(&blk->block);
+}
+
+//Transitional devices show up with the legacy id, modern only ones with 0x1042
+void virtio_blk_init() {
+    for (int i = 0; i < pci_get_device_count(); i++) {
+        const PciDevice* d = pci_get_device(i);
+        if (d->vendor_id != VIRTIO_VENDOR) continue;
+        if (d->device_id == VIRTIO_BLK_LEGACY_ID || d->device_id == VIRTIO_BLK_MODERN_ID) virtio_blk_probe(d);
+    }
+}
\ No newline at end of file
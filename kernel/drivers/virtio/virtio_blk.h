@@ -0,0 +1,58 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "../../../lib/definitions.h"
+#include "../../threading/src/spinlock.h"
+#include "../block/block.h"
+#include "virtio.h"
+
+#define VIRTIO_BLK_LEGACY_ID    0x1001
+#define VIRTIO_BLK_MODERN_ID    0x1042
+
+#define VIRTIO_BLK_F_SIZE_MAX   (1ULL << 1)
+#define VIRTIO_BLK_F_SEG_MAX    (1ULL << 2)
+#define VIRTIO_BLK_F_FLUSH      (1ULL << 9)     //the device caches writes until told to flush
+
+#define VIRTIO_BLK_CFG_CAPACITY 0       //512 byte sectors
+#define VIRTIO_BLK_CFG_SIZE_MAX 8
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_S_OK         0
+
+#define VIRTIO_BLK_MAX_SECTORS  1024
+#define VIRTIO_BLK_MAX_SEGMENTS (VIRTQ_INDIRECT_MAX - 2)     //header and status take the other two
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) VirtioBlkHeader;
+
+//What the device reads and writes besides the data, one per request in flight
+typedef struct {
+    VirtioBlkHeader header;
+    volatile uint8_t status;
+    BlockRequest* req;
+} VirtioBlkCmd;
+
+/*
+ * A virtio disk on one request queue. Requests go out as header, data and
+ * status buffers in a single indirect descriptor, so the block layer can keep
+ * as many in flight as there are indirect tables.
+ */
+typedef struct VirtioBlk {
+    BlockDevice block;
+    VirtioDevice dev;
+    Virtqueue vq;
+    spinlock_t lock;
+    VirtioBlkCmd cmds[VIRTQ_INDIRECT_TABLES];
+    uint32_t free_cmds;
+    VirtqBuffer bufs[VIRTQ_INDIRECT_MAX];
+} VirtioBlk;
+
+void virtio_blk_init();
+
+#endif
\ No newline at end of file
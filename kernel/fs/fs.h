@@ -7,6 +7,8 @@
 
 void fs_init();
 
+void fs_shutdown();
+
 Inode* get_current_dir();
 
 Inode* get_root();
@@ -4,21 +4,12 @@
 #include "../../drivers/vga/vga.h"
 #include "../../../lib/definitions.h"
 #include "../../cpu/interrupts.h"
-#include "../../drivers/IDE/ide.h"
 #include "../../cpu/src/pic.h"
-
-void sleep(uint32_t ms) {
-    uint64_t start = timer_get_ticks();
-    uint64_t end = start + ms;
-    
-    while (timer_get_ticks() < end) {
-        asm volatile ("nop");
-    }
-}
+#include "../../mm/pagecache.h"
 
 Inode* root_inode = NULL;
 Inode* current_directory = NULL;
-static uint16_t aligned_buffer[DISK_SECTOR_SIZE/2];
+static uint8_t journal_record[2 * DISK_SECTOR_SIZE];
 
 static int            diskfs_create_node(Inode* dir, const char* name, int mode);
 static int            diskfs_lookup(Inode* dir, const char* name, Inode** result);
@@ -42,12 +33,18 @@ static void            release_inode(InodeCacheEntry* ice);
 void            release_block(BlockCacheEntry* bce);
 static int             parse_path(const char* path, char** components, int max_components);
 static int             resolve_path(DiskfsInfo* dfs, const char* path, Inode** result);
-static int diskfs_write_sector(uint8_t drive, uint32_t lba, const void* buffer);
+static int diskfs_write_sector(int device, uint32_t lba, const void* buffer);
+static BlockCacheEntry* find_cached_block(DiskfsInfo* dfs, uint32_t block_num);
+static void update_cached_block(DiskfsInfo* dfs, uint32_t block_num, const void* data);
+static void prefetch_blocks(DiskfsInfo* dfs, uint32_t start_block, uint32_t count);
+static void finish_prefetch(DiskfsInfo* dfs);
 static int journal_start_transaction(DiskfsInfo* dfs);
 static int journal_log_block(DiskfsInfo* dfs, uint32_t block_num);
 static int journal_commit_transaction(DiskfsInfo* dfs);
+static int diskfs_commit(DiskfsInfo* dfs);
 static void flush_all_cache(DiskfsInfo* dfs);
 static int diskfs_truncate(Inode* inode, uint64_t size);
+static int diskfs_fsync(Inode* inode);
 
 static InodeOps g_diskfs_inode_ops = {
     .create = diskfs_create_node,
@@ -57,6 +54,7 @@ static InodeOps g_diskfs_inode_ops = {
     .delete = diskfs_delete,
     .mkdir  = diskfs_mkdir,
     .truncate = diskfs_truncate,
+    .fsync  = diskfs_fsync,
 };
 
 static Inode* create_vfs_inode(DiskfsInfo* dfs, InodeCacheEntry* ice) {
@@ -66,6 +64,7 @@ static Inode* create_vfs_inode(DiskfsInfo* dfs, InodeCacheEntry* ice) {
     if (!inode) return NULL;
     
     memset(inode, 0, sizeof(Inode));
+    inode->ino = ice->inode_num;
     inode->mode = ice->inode.mode;
     inode->size = ice->inode.size;
     inode->ops = &g_diskfs_inode_ops;
@@ -140,10 +139,10 @@ static int diskfs_create_node(Inode* dir, const char* name, int mode) {
     uint8_t sb_buf[DISK_SECTOR_SIZE];
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-    diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf);
+    diskfs_write_sector(dfs->device, dfs->start_block, sb_buf);
     
     release_inode(new_ice);
-    return 1;
+    return diskfs_commit(dfs);
 }
 
 static int diskfs_lookup(Inode* dir, const char* name, Inode** result) {
@@ -338,6 +337,24 @@ static int diskfs_read(Inode* inode, uint64_t offset, void* buffer, uint64_t siz
             bytes_to_read = size - bytes_read;
         }
         
+        //Whole uncached blocks that are contiguous on disk go straight into the caller's buffer
+        if (bytes_to_read == block_size && !find_cached_block(dfs, block_num)) {
+            uint32_t run = 1;
+            while (size - bytes_read >= (run + 1) * block_size) {
+                uint32_t next = get_block_for_offset(dfs, ice, offset + bytes_read + run * block_size, false);
+                if (next != block_num + run || find_cached_block(dfs, next)) break;
+                run++;
+            }
+            if (!diskfs_read_blocks(dfs->device, block_num, run, buf_ptr + bytes_read)) break;
+            bytes_read += run * block_size;
+            continue;
+        }
+        
+        if (!find_cached_block(dfs, block_num)) {
+            uint64_t left = ice->inode.size - (offset + bytes_read - offset_in_block);
+            prefetch_blocks(dfs, block_num, (left + block_size - 1) / block_size);
+        }
+        
         BlockCacheEntry* bce = get_block(dfs, block_num);
         if (!bce) break;
         
@@ -351,6 +368,15 @@ static int diskfs_read(Inode* inode, uint64_t offset, void* buffer, uint64_t siz
     ice->dirty = 1;
     flush_inode(dfs, ice);
     
+    //Start on what a sequential reader asks for next while it works on this
+    uint64_t next_offset = (offset + bytes_read + block_size - 1) / block_size * block_size;
+    if (bytes_read > 0 && next_offset < ice->inode.size) {
+        uint32_t next = get_block_for_offset(dfs, ice, next_offset, false);
+        if (next && !find_cached_block(dfs, next)) {
+            prefetch_blocks(dfs, next, (ice->inode.size - next_offset + block_size - 1) / block_size);
+        }
+    }
+    
     return bytes_read;
 }
 
@@ -383,6 +409,25 @@ static int diskfs_write(Inode* inode, uint64_t offset, const void* buffer, uint6
             bytes_to_write = size - bytes_written;
         }
         
+        //Whole blocks that are contiguous on disk are written in one go and bypass the cache
+        if (bytes_to_write == block_size) {
+            uint32_t run = 1;
+            while (size - bytes_written >= (run + 1) * block_size) {
+                uint32_t next = get_block_for_offset(dfs, ice, offset + bytes_written + run * block_size, true);
+                if (next != block_num + run) break;
+                if (dfs->super.journal_start != 0) {
+                    journal_log_block(dfs, next);
+                }
+                run++;
+            }
+            if (!diskfs_write_blocks(dfs->device, block_num, run, buf_ptr + bytes_written)) break;
+            for (uint32_t i = 0; i < run; i++) {
+                update_cached_block(dfs, block_num + i, buf_ptr + bytes_written + i * block_size);
+            }
+            bytes_written += run * block_size;
+            continue;
+        }
+        
         BlockCacheEntry* bce = get_block(dfs, block_num);
         if (!bce) break;
         
@@ -403,14 +448,17 @@ static int diskfs_write(Inode* inode, uint64_t offset, const void* buffer, uint6
     ice->dirty = 1;
     flush_inode(dfs, ice);
     
+    int committed;
     if (dfs->super.journal_start != 0) {
-        journal_commit_transaction(dfs);
+        committed = journal_commit_transaction(dfs);
+    } else {
+        committed = diskfs_commit(dfs);
     }
     
-    return bytes_written;
+    page_cache_update(inode, offset, buffer, bytes_written);
+    return committed ? bytes_written : 0;
 }
 
-//sleep to give time for the disk to finish writing
 static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
     if (!dir || !name || strlen(name) >= DISKFS_MAX_NAME) return 0;
     
@@ -438,8 +486,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     if (dfs->super.journal_start != 0) {
         journal_start_transaction(dfs);
     }
@@ -450,8 +496,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     if (!init_directory(dfs, dir_block, dir_ice->inode_num)) {
         kprintf("diskfs_mkdir: Failed to initialize directory block\n");
         free_block(dfs, dir_block);
@@ -488,8 +532,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     if (!add_dir_entry(dfs, dir_ice->inode_num, name, inode_num, INODE_DIRECTORY)) {
         kprintf("diskfs_mkdir: Failed to add directory entry\n");
         
@@ -504,8 +546,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     if (!add_dir_entry(dfs, inode_num, ".", inode_num, INODE_DIRECTORY)) {
         kprintf("diskfs_mkdir: Failed to add '.' entry\n");
         remove_dir_entry(dfs, dir_ice->inode_num, name);
@@ -520,8 +560,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     if (!add_dir_entry(dfs, inode_num, "..", dir_ice->inode_num, INODE_DIRECTORY)) {
         kprintf("diskfs_mkdir: Failed to add '..' entry\n");
         remove_dir_entry(dfs, dir_ice->inode_num, name);
@@ -537,8 +575,6 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
         return 0;
     }
     
-    sleep(5);
-    
     dir_ice->inode.links++;
     dir_ice->dirty = 1;
     flush_inode(dfs, dir_ice);
@@ -548,18 +584,17 @@ static int diskfs_mkdir(Inode* dir, const char* name, int mode) {
     uint8_t sb_buf[DISK_SECTOR_SIZE];
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
         kprintf("diskfs_mkdir: Failed to update superblock\n");
     }
     
     flush_all_cache(dfs);
+    release_inode(new_ice);
     
     if (dfs->super.journal_start != 0) {
-        journal_commit_transaction(dfs);
+        return journal_commit_transaction(dfs);
     }
-    
-    release_inode(new_ice);
-    return 1;
+    return diskfs_commit(dfs);
 }
 
 static int diskfs_delete(Inode* dir, const char* name) {
@@ -582,6 +617,9 @@ static int diskfs_delete(Inode* dir, const char* name) {
     InodeCacheEntry* target_ice = (InodeCacheEntry*)target->fs_specific;
     uint32_t target_inode_num = target_ice->inode_num;
     
+    // The inode number may be reused by the next file created
+    page_cache_invalidate(target);
+    
     if (target_ice->inode.flags & INODE_DIRECTORY) {
         BlockCacheEntry* bce = get_block(dfs, target_ice->inode.direct[0]);
         if (!bce) {
@@ -659,13 +697,20 @@ static int diskfs_delete(Inode* dir, const char* name) {
     uint8_t sb_buf[DISK_SECTOR_SIZE];
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-    diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf);
+    diskfs_write_sector(dfs->device, dfs->start_block, sb_buf);
     
     kfree(target);
-    return 1;
+    return diskfs_commit(dfs);
+}
+
+//Whether device holds a diskfs superblock at start_block, without mounting it
+bool diskfs_probe(int device, uint32_t start_block) {
+    uint8_t sb_buf[DISK_SECTOR_SIZE];
+    if (!diskfs_read_sector(device, start_block, sb_buf)) return false;
+    return ((DiskfsSuper*)sb_buf)->magic == DISKFS_MAGIC;
 }
 
-SuperBlock* diskfs_mount(uint8_t drive, uint32_t start_block, int auto_format) {
+SuperBlock* diskfs_mount(int device, uint32_t start_block, int auto_format, int durability) {
     DiskfsInfo* dfs = kmalloc(sizeof(DiskfsInfo));
     if (!dfs) {
         kprintf("diskfs_mount: Failed to allocate DiskfsInfo\n");
@@ -673,11 +718,12 @@ SuperBlock* diskfs_mount(uint8_t drive, uint32_t start_block, int auto_format) {
     }
     
     memset(dfs, 0, sizeof(DiskfsInfo));
-    dfs->drive = drive;
+    dfs->device = device;
+    dfs->durability = durability;
     dfs->start_block = start_block;
     
     uint8_t sb_buf[DISK_SECTOR_SIZE];
-    if (!diskfs_read_sector(drive, start_block, sb_buf)) {
+    if (!diskfs_read_sector(device, start_block, sb_buf)) {
         kprintf("diskfs_mount: Failed to read superblock\n");
         kfree(dfs);
         return NULL;
@@ -734,28 +780,93 @@ SuperBlock* diskfs_mount(uint8_t drive, uint32_t start_block, int auto_format) {
     root->sb = sb;
     sb->root = root;
     
-    root_inode = root;
-    current_directory = root;
+    //The first filesystem mounted is the root, later ones hang off it through vfs_mount
+    if (!root_inode) {
+        root_inode = root;
+        current_directory = root;
+    }
     
     kprintf("diskfs_mount: Filesystem mounted successfully\n");
     return sb;
 }
 
-int diskfs_read_sector(uint8_t drive, uint32_t lba, void* buffer) {
-    if (!buffer) return 0;
-    
-    int result = ide_read(drive, lba, 1, aligned_buffer);
-    if (result) {
-        memcpy(buffer, aligned_buffer, DISK_SECTOR_SIZE);
+//Without a journal, a strict mount has every operation that changed metadata wait here until
+//the device's write cache is on the medium. 1 on success
+static int diskfs_commit(DiskfsInfo* dfs) {
+    if (dfs->durability != DISKFS_STRICT || dfs->super.journal_start != 0) return 1;
+    if (!block_flush(dfs->device)) {
+        kprintf("diskfs_commit: Failed to flush device %d\n", dfs->device);
+        return 0;
+    }
+    return 1;
+}
+
+//Writes back everything cached, then has the device write back its own cache. 1 on success
+int diskfs_sync(SuperBlock* sb) {
+    DiskfsInfo* dfs = get_diskfs_info(sb);
+    flush_all_cache(dfs);
+    if (!block_flush(dfs->device)) {
+        kprintf("diskfs_sync: Failed to flush device %d\n", dfs->device);
+        return 0;
     }
+    return 1;
+}
+
+static int diskfs_fsync(Inode* inode) {
+    if (!inode) return 0;
+    return diskfs_sync(inode->sb);
+}
+
+//Leaves the filesystem on the medium and frees it; nothing of it may be in use
+int diskfs_unmount(SuperBlock* sb) {
+    if (!sb) return 0;
+    int result = diskfs_sync(sb);
+
+    if (root_inode == sb->root) root_inode = NULL;
+    if (current_directory == sb->root) current_directory = NULL;
+    kfree(sb->root);
+    kfree(sb->fs_specific);
+    kfree(sb);
     return result;
 }
 
-static int diskfs_write_sector(uint8_t drive, uint32_t lba, const void* buffer) {
+//The block layer splits, merges and bounces as the device needs
+int diskfs_read_blocks(int device, uint32_t start, uint32_t count, void* buffer) {
     if (!buffer) return 0;
-    
-    memcpy(aligned_buffer, buffer, DISK_SECTOR_SIZE);
-    return ide_write(drive, lba, 1, aligned_buffer);
+    return block_read(device, start, count, buffer);
+}
+
+int diskfs_write_blocks(int device, uint32_t start, uint32_t count, const void* buffer) {
+    if (!buffer) return 0;
+    return block_write(device, start, count, buffer);
+}
+
+int diskfs_read_sector(int device, uint32_t lba, void* buffer) {
+    return diskfs_read_blocks(device, lba, 1, buffer);
+}
+
+static int diskfs_write_sector(int device, uint32_t lba, const void* buffer) {
+    return diskfs_write_blocks(device, lba, 1, buffer);
+}
+
+static BlockCacheEntry* find_cached_block(DiskfsInfo* dfs, uint32_t block_num) {
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        if (dfs->block_cache[i].valid && dfs->block_cache[i].block_num == block_num) {
+            //A failed readahead drops the entry, so it is not cached after all
+            if (dfs->block_cache[i].io_pending) finish_prefetch(dfs);
+            return dfs->block_cache[i].valid ? &dfs->block_cache[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+//Keeps a cached copy in step with a block that was written around the cache
+static void update_cached_block(DiskfsInfo* dfs, uint32_t block_num, const void* data) {
+    BlockCacheEntry* bce = find_cached_block(dfs, block_num);
+    if (bce) {
+        memcpy(bce->data, data, DISK_SECTOR_SIZE);
+        bce->dirty = 0;
+    }
 }
 
 static inline void set_bitmap_bit(uint8_t* bitmap, uint32_t bit) {
@@ -787,7 +898,7 @@ static uint32_t allocate_block(DiskfsInfo* dfs) {
         uint32_t bit_in_sector = bit_offset % (DISK_SECTOR_SIZE * 8);
         
         uint8_t bitmap_sector[DISK_SECTOR_SIZE];
-        if (!diskfs_read_sector(dfs->drive, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
+        if (!diskfs_read_sector(dfs->device, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
             kprintf("allocate_block: Failed to read bitmap sector %d\n", bitmap_start_block + sector_offset);
             return 0;
         }
@@ -795,7 +906,7 @@ static uint32_t allocate_block(DiskfsInfo* dfs) {
         if (!test_bitmap_bit(bitmap_sector, bit_in_sector)) {
             set_bitmap_bit(bitmap_sector, bit_in_sector);
             
-            if (!diskfs_write_sector(dfs->drive, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
+            if (!diskfs_write_sector(dfs->device, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
                 kprintf("allocate_block: Failed to write bitmap sector %d\n", bitmap_start_block + sector_offset);
                 return 0;
             }
@@ -804,16 +915,14 @@ static uint32_t allocate_block(DiskfsInfo* dfs) {
             uint8_t sb_buf[DISK_SECTOR_SIZE];
             memset(sb_buf, 0, DISK_SECTOR_SIZE);
             memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-            if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+            if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
                 kprintf("allocate_block: Failed to update superblock\n");
                 return 0;
             }
             
-            sleep(5);
-            
             uint8_t zero_buf[DISK_SECTOR_SIZE];
             memset(zero_buf, 0, DISK_SECTOR_SIZE);
-            if (!diskfs_write_sector(dfs->drive, block, zero_buf)) {
+            if (!diskfs_write_sector(dfs->device, block, zero_buf)) {
                 kprintf("allocate_block: Failed to initialize block %d\n", block);
                 return 0;
             }
@@ -839,7 +948,7 @@ static void free_block(DiskfsInfo* dfs, uint32_t block) {
     uint32_t bit_in_sector = bit_offset % (DISK_SECTOR_SIZE * 8);
     
     uint8_t bitmap_sector[DISK_SECTOR_SIZE];
-    if (!diskfs_read_sector(dfs->drive, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
+    if (!diskfs_read_sector(dfs->device, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
         kprintf("free_block: Failed to read bitmap sector %d\n", bitmap_start_block + sector_offset);
         return;
     }
@@ -851,7 +960,7 @@ static void free_block(DiskfsInfo* dfs, uint32_t block) {
     
     clear_bitmap_bit(bitmap_sector, bit_in_sector);
     
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block + bitmap_start_block + sector_offset, bitmap_sector)) {
         kprintf("free_block: Failed to write bitmap sector %d\n", bitmap_start_block + sector_offset);
         return;
     }
@@ -860,13 +969,13 @@ static void free_block(DiskfsInfo* dfs, uint32_t block) {
     uint8_t sb_buf[DISK_SECTOR_SIZE];
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
         kprintf("free_block: Failed to update superblock\n");
         return;
     }
     
     
-    sleep(5);//kprintf("DEBUG: Freed block %d (bit %d in sector %d)\n", 
+    //kprintf("DEBUG: Freed block %d (bit %d in sector %d)\n", 
     //        block, bit_in_sector, bitmap_start_block + sector_offset);
 }
 
@@ -937,6 +1046,9 @@ BlockCacheEntry* get_block(DiskfsInfo* dfs, uint32_t block_num) {
         return NULL;
     }
     
+    //Entries being filled by readahead may be the one wanted or the one evicted
+    finish_prefetch(dfs);
+    
     for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
         if (dfs->block_cache[i].valid && dfs->block_cache[i].block_num == block_num) {
             dfs->block_cache[i].ref_count++;
@@ -969,7 +1081,7 @@ BlockCacheEntry* get_block(DiskfsInfo* dfs, uint32_t block_num) {
         return NULL;
     }
     
-    if (!diskfs_read_sector(dfs->drive, block_num, dfs->block_cache[free_index].data)) {
+    if (!diskfs_read_sector(dfs->device, block_num, dfs->block_cache[free_index].data)) {
         kprintf("get_block: Failed to read block %d\n", block_num);
         return NULL;
     }
@@ -1011,7 +1123,7 @@ static int flush_inode(DiskfsInfo* dfs, InodeCacheEntry* ice) {
 static int flush_block(DiskfsInfo* dfs, BlockCacheEntry* bce) {
     if (!bce->dirty) return 1;
     
-    if (!diskfs_write_sector(dfs->drive, bce->block_num, bce->data)) {
+    if (!diskfs_write_sector(dfs->device, bce->block_num, bce->data)) {
         kprintf("flush_block: Failed to write block %d\n", bce->block_num);
         return 0;
     }
@@ -1035,10 +1147,12 @@ void release_block(BlockCacheEntry* bce) {
 int init_filesystem(DiskfsInfo* dfs) {
     if (!dfs) return 0;
     
-    kprintf("Initializing filesystem on drive %d, start block %d\n", 
-            dfs->drive, dfs->start_block);
+    kprintf("Initializing filesystem on block device %d, start block %d\n", 
+            dfs->device, dfs->start_block);
 
     uint32_t total_blocks = 8192;
+    BlockDevice* dev = block_get(dfs->device);
+    if (dev && dev->sectors - dfs->start_block < total_blocks) total_blocks = dev->sectors - dfs->start_block;
     uint32_t inode_table_start = 3;
     uint32_t inode_table_blocks = 16;
     uint32_t data_blocks_start = inode_table_start + inode_table_blocks;
@@ -1062,7 +1176,7 @@ int init_filesystem(DiskfsInfo* dfs) {
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
     
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
         kprintf("init_filesystem: Failed to write superblock\n");
         return 0;
     }
@@ -1071,7 +1185,7 @@ int init_filesystem(DiskfsInfo* dfs) {
     memset(bitmap_buf, 0, DISK_SECTOR_SIZE);
     bitmap_buf[0] = 0x01;
     
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block + 1, bitmap_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block + 1, bitmap_buf)) {
         kprintf("init_filesystem: Failed to write inode bitmap\n");
         return 0;
     }
@@ -1084,7 +1198,7 @@ int init_filesystem(DiskfsInfo* dfs) {
     
     bitmap_buf[data_blocks_start / 8] |= (1 << (data_blocks_start % 8));
     
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block + 2, bitmap_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block + 2, bitmap_buf)) {
         kprintf("init_filesystem: Failed to write block bitmap\n");
         return 0;
     }
@@ -1092,7 +1206,7 @@ int init_filesystem(DiskfsInfo* dfs) {
     memset(bitmap_buf, 0, DISK_SECTOR_SIZE);
     
     for (uint32_t i = 0; i < inode_table_blocks; i++) {
-        if (!diskfs_write_sector(dfs->drive, dfs->start_block + inode_table_start + i, bitmap_buf)) {
+        if (!diskfs_write_sector(dfs->device, dfs->start_block + inode_table_start + i, bitmap_buf)) {
             kprintf("init_filesystem: Failed to clear inode table block %d\n", i);
             return 0;
         }
@@ -1112,7 +1226,7 @@ int init_filesystem(DiskfsInfo* dfs) {
     memset(bitmap_buf, 0, DISK_SECTOR_SIZE);
     memcpy(bitmap_buf, &root_inode, sizeof(DiskfsInode));
     
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block + inode_table_start, bitmap_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block + inode_table_start, bitmap_buf)) {
         kprintf("init_filesystem: Failed to write root inode\n");
         return 0;
     }
@@ -1150,12 +1264,10 @@ static int init_directory(DiskfsInfo* dfs, uint32_t dir_block, uint32_t parent_i
     dir->parent_inode = parent_inode;
     dir->next_block = 0;
     
-    if (!diskfs_write_sector(dfs->drive, dir_block, dir_buf)) {
+    if (!diskfs_write_sector(dfs->device, dir_block, dir_buf)) {
         kprintf("init_directory: Failed to write directory block %d\n", dir_block);
         return 0;
     }
-    
-    sleep(5);
     return 1;
 }
 
@@ -1521,7 +1633,7 @@ static int init_journal(DiskfsInfo* dfs, uint32_t journal_size) {
     uint8_t sb_buf[DISK_SECTOR_SIZE];
     memset(sb_buf, 0, DISK_SECTOR_SIZE);
     memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-    if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+    if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
         kprintf("init_journal: Failed to update superblock\n");
         return 0;
     }
@@ -1531,6 +1643,15 @@ static int init_journal(DiskfsInfo* dfs, uint32_t journal_size) {
     return 1;
 }
 
+//Journal block after block, wrapping past the end back to the first one after the header
+static uint32_t journal_next_block(DiskfsInfo* dfs, uint32_t block) {
+    uint32_t next = block + 1;
+    if (next >= dfs->super.journal_start + dfs->super.journal_blocks) {
+        next = dfs->super.journal_start + 1;
+    }
+    return next;
+}
+
 static int journal_start_transaction(DiskfsInfo* dfs) {
     if (!dfs || dfs->super.journal_start == 0) {
         kprintf("journal_start_transaction: No journal configured\n");
@@ -1556,13 +1677,7 @@ static int journal_start_transaction(DiskfsInfo* dfs) {
     header_bce->dirty = 1;
     flush_block(dfs, header_bce);
     
-    uint32_t next_block = (jh->head == dfs->super.journal_start) ? 
-                          dfs->super.journal_start + 1 : 
-                          jh->head + 1;
-    
-    if (next_block >= dfs->super.journal_start + dfs->super.journal_blocks) {
-        next_block = dfs->super.journal_start + 1;
-    }
+    uint32_t next_block = journal_next_block(dfs, jh->head);
     
     BlockCacheEntry* tx_bce = get_block(dfs, next_block);
     if (!tx_bce) {
@@ -1610,13 +1725,7 @@ static int journal_commit_transaction(DiskfsInfo* dfs) {
         return 0;
     }
     
-    uint32_t next_block = (jh->head == dfs->super.journal_start) ? 
-                          dfs->super.journal_start + 1 : 
-                          jh->head + 1;
-    
-    if (next_block >= dfs->super.journal_start + dfs->super.journal_blocks) {
-        next_block = dfs->super.journal_start + 1;
-    }
+    uint32_t next_block = journal_next_block(dfs, jh->head);
     
     BlockCacheEntry* tx_bce = get_block(dfs, next_block);
     if (!tx_bce) {
@@ -1625,6 +1734,18 @@ static int journal_commit_transaction(DiskfsInfo* dfs) {
         return 0;
     }
     
+    //Strict: the logged blocks are on the medium before the record that makes them count. If they
+    //cannot be, the transaction is dropped rather than committed
+    if (dfs->durability == DISKFS_STRICT && !block_flush(dfs->device)) {
+        kprintf("journal_commit_transaction: Failed to flush logged blocks\n");
+        release_block(tx_bce);
+        jh->state = 0;
+        header_bce->dirty = 1;
+        flush_block(dfs, header_bce);
+        release_block(header_bce);
+        return 0;
+    }
+    
     DiskfsJournalTransaction* tx = (DiskfsJournalTransaction*)tx_bce->data;
     tx->type = JT_COMMIT;
     tx->flags = 0;
@@ -1642,6 +1763,10 @@ static int journal_commit_transaction(DiskfsInfo* dfs) {
     flush_block(dfs, header_bce);
     release_block(header_bce);
     
+    if (dfs->durability == DISKFS_STRICT && !block_flush(dfs->device)) {
+        kprintf("journal_commit_transaction: Failed to flush commit record\n");
+        return 0;
+    }
     return 1;
 }
 
@@ -1671,40 +1796,40 @@ static int journal_log_block(DiskfsInfo* dfs, uint32_t block_num) {
         return 0;
     }
     
-    uint32_t next_block = (jh->head == dfs->super.journal_start) ? 
-                         dfs->super.journal_start + 1 : 
-                         jh->head + 1;
-    
-    if (next_block >= dfs->super.journal_start + dfs->super.journal_blocks) {
-        next_block = dfs->super.journal_start + 1;
-    }
+    //The record does not fit in one block: a descriptor block is followed by the data block,
+    //and unless the journal wraps in between both go out in a single write
+    uint32_t desc_block = journal_next_block(dfs, jh->head);
+    uint32_t data_block = journal_next_block(dfs, desc_block);
     
-    BlockCacheEntry* tx_bce = get_block(dfs, next_block);
-    if (!tx_bce) {
-        kprintf("journal_log_block: Failed to get transaction block\n");
-        release_block(header_bce);
-        release_block(src_bce);
-        return 0;
-    }
-    
-    DiskfsJournalTransaction* tx = (DiskfsJournalTransaction*)tx_bce->data;
+    memset(journal_record, 0, sizeof(journal_record));
+    DiskfsJournalTransaction* tx = (DiskfsJournalTransaction*)journal_record;
     tx->type = JT_BLOCK;
     tx->flags = 0;
     tx->size = sizeof(DiskfsJournalTransaction) + sizeof(uint32_t) + DISK_SECTOR_SIZE;
     tx->sequence = jh->sequence;
     
-    uint32_t* block_ptr = (uint32_t*)(tx_bce->data + sizeof(DiskfsJournalTransaction));
+    uint32_t* block_ptr = (uint32_t*)(journal_record + sizeof(DiskfsJournalTransaction));
     *block_ptr = block_num;
     
-    memcpy(tx_bce->data + sizeof(DiskfsJournalTransaction) + sizeof(uint32_t), 
-           src_bce->data, DISK_SECTOR_SIZE);
-    
-    tx_bce->dirty = 1;
-    flush_block(dfs, tx_bce);
-    release_block(tx_bce);
+    memcpy(journal_record + DISK_SECTOR_SIZE, src_bce->data, DISK_SECTOR_SIZE);
     release_block(src_bce);
     
-    jh->head = next_block;
+    int written;
+    if (data_block == desc_block + 1) {
+        written = diskfs_write_blocks(dfs->device, desc_block, 2, journal_record);
+    } else {
+        written = diskfs_write_sector(dfs->device, desc_block, journal_record) &&
+                  diskfs_write_sector(dfs->device, data_block, journal_record + DISK_SECTOR_SIZE);
+    }
+    if (!written) {
+        kprintf("journal_log_block: Failed to write record for block %d\n", block_num);
+        release_block(header_bce);
+        return 0;
+    }
+    update_cached_block(dfs, desc_block, journal_record);
+    update_cached_block(dfs, data_block, journal_record + DISK_SECTOR_SIZE);
+    
+    jh->head = data_block;
     header_bce->dirty = 1;
     flush_block(dfs, header_bce);
     release_block(header_bce);
@@ -1737,7 +1862,7 @@ static uint32_t allocate_extent(DiskfsInfo* dfs, uint32_t count, uint32_t* alloc
     for (uint32_t bitmap_block = 0; bitmap_block < bitmap_blocks; bitmap_block++) {
         uint32_t sector = bitmap_start + bitmap_block;
         
-        if (!diskfs_read_sector(dfs->drive, sector, bitmap_sector)) {
+        if (!diskfs_read_sector(dfs->device, sector, bitmap_sector)) {
             kprintf("allocate_extent: Failed to read bitmap sector %d\n", sector);
             *allocated = 0;
             return 0;
@@ -1780,7 +1905,7 @@ static uint32_t allocate_extent(DiskfsInfo* dfs, uint32_t count, uint32_t* alloc
             uint32_t bit_in_block = block % BLOCKS_PER_BITMAP_SECTOR;
             uint32_t sector = bitmap_start + bitmap_block;
             
-            if (!diskfs_read_sector(dfs->drive, sector, bitmap_sector)) {
+            if (!diskfs_read_sector(dfs->device, sector, bitmap_sector)) {
                 kprintf("allocate_extent: Failed to read bitmap sector %d\n", sector);
                 // This is bad - already allocated some blocks
                 // Should initiate recovery here
@@ -1789,14 +1914,14 @@ static uint32_t allocate_extent(DiskfsInfo* dfs, uint32_t count, uint32_t* alloc
             
             set_bitmap_bit(bitmap_sector, bit_in_block);
             
-            if (!diskfs_write_sector(dfs->drive, sector, bitmap_sector)) {
+            if (!diskfs_write_sector(dfs->device, sector, bitmap_sector)) {
                 kprintf("allocate_extent: Failed to write bitmap sector %d\n", sector);
                 return 0;
             }
             
             uint8_t zero_buf[DISK_SECTOR_SIZE];
             memset(zero_buf, 0, DISK_SECTOR_SIZE);
-            if (!diskfs_write_sector(dfs->drive, block, zero_buf)) {
+            if (!diskfs_write_sector(dfs->device, block, zero_buf)) {
                 kprintf("allocate_extent: Failed to initialize block %d\n", block);
                 return 0;
             }
@@ -1806,7 +1931,7 @@ static uint32_t allocate_extent(DiskfsInfo* dfs, uint32_t count, uint32_t* alloc
         uint8_t sb_buf[DISK_SECTOR_SIZE];
         memset(sb_buf, 0, DISK_SECTOR_SIZE);
         memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-        if (!diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf)) {
+        if (!diskfs_write_sector(dfs->device, dfs->start_block, sb_buf)) {
             kprintf("allocate_extent: Failed to update superblock\n");
             return 0;
         }
@@ -1831,6 +1956,8 @@ static void free_extent(DiskfsInfo* dfs, uint32_t start_block, uint32_t count) {
 static void flush_all_cache(DiskfsInfo* dfs) {
     if (!dfs) return;
     
+    finish_prefetch(dfs);
+    
     for (int i = 0; i < INODE_CACHE_SIZE; i++) {
         if (dfs->inode_cache[i].valid && dfs->inode_cache[i].dirty) {
             flush_inode(dfs, &dfs->inode_cache[i]);
@@ -1844,45 +1971,67 @@ static void flush_all_cache(DiskfsInfo* dfs) {
     }
 }
 
+//Waits for readahead in flight and hands its blocks to the entries reserved for them
+static void finish_prefetch(DiskfsInfo* dfs) {
+    if (dfs->prefetch_count == 0) return;
+    
+    bool ok = block_wait(&dfs->prefetch) == 0;
+    for (uint32_t i = 0; i < dfs->prefetch_count; i++) {
+        BlockCacheEntry* bce = &dfs->block_cache[dfs->prefetch_index[i]];
+        if (ok) memcpy(bce->data, dfs->prefetch_buffer + i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE);
+        else bce->valid = 0;
+        bce->io_pending = 0;
+    }
+    dfs->prefetch_count = 0;
+}
+
+//Starts reading the blocks into free cache entries and returns without waiting for them
 static void prefetch_blocks(DiskfsInfo* dfs, uint32_t start_block, uint32_t count) {
     if (!dfs || start_block == 0 || count == 0) {
         return;
     }
     
-    if (count > 8) count = 8;
+    finish_prefetch(dfs);
     
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t block = start_block + i;
-        
-        bool in_cache = false;
-        for (int j = 0; j < BLOCK_CACHE_SIZE; j++) {
-            if (dfs->block_cache[j].valid && 
-                dfs->block_cache[j].block_num == block) {
-                in_cache = true;
-                break;
-            }
-        }
-        
-        if (!in_cache) {
-            int free_index = -1;
-            for (int j = 0; j < BLOCK_CACHE_SIZE; j++) {
-                if (!dfs->block_cache[j].valid) {
-                    free_index = j;
-                    break;
-                }
-            }
-            
-            if (free_index >= 0) {
-                if (diskfs_read_sector(dfs->drive, block, 
-                                       dfs->block_cache[free_index].data)) {
-                    dfs->block_cache[free_index].block_num = block;
-                    dfs->block_cache[free_index].ref_count = 0;
-                    dfs->block_cache[free_index].dirty = 0;
-                    dfs->block_cache[free_index].valid = 1;
-                }
-            }
+    if (count > PREFETCH_BLOCKS) count = PREFETCH_BLOCKS;
+    if (start_block >= dfs->super.total_blocks) return;
+    if (count > dfs->super.total_blocks - start_block) count = dfs->super.total_blocks - start_block;
+    
+    while (count > 0 && find_cached_block(dfs, start_block)) {
+        start_block++;
+        count--;
+    }
+    
+    int free_index[PREFETCH_BLOCKS];
+    uint32_t free_count = 0;
+    for (int j = 0; j < BLOCK_CACHE_SIZE && free_count < count; j++) {
+        if (!dfs->block_cache[j].valid) {
+            free_index[free_count++] = j;
         }
     }
+    
+    //The uncached run that fits in free entries is read with a single command
+    uint32_t run = 0;
+    while (run < free_count && !find_cached_block(dfs, start_block + run)) run++;
+    if (run == 0) return;
+    
+    for (uint32_t i = 0; i < run; i++) {
+        BlockCacheEntry* bce = &dfs->block_cache[free_index[i]];
+        bce->block_num = start_block + i;
+        bce->ref_count = 0;
+        bce->dirty = 0;
+        bce->valid = 1;
+        bce->io_pending = 1;
+        dfs->prefetch_index[i] = free_index[i];
+    }
+    dfs->prefetch_count = run;
+    
+    memset(&dfs->prefetch, 0, sizeof(BlockRequest));
+    dfs->prefetch.dev = block_get(dfs->device);
+    dfs->prefetch.io.lba = start_block;
+    dfs->prefetch.io.sectors = run;
+    dfs->prefetch.buffer = dfs->prefetch_buffer;
+    block_submit(&dfs->prefetch);
 }
 
 static uint32_t calculate_checksum(const void* data, uint32_t size) {
@@ -1925,7 +2074,7 @@ static int verify_bitmap(DiskfsInfo* dfs) {
     for (uint32_t bitmap_block = 0; bitmap_block < bitmap_blocks; bitmap_block++) {
         uint32_t sector = bitmap_start + bitmap_block;
         
-        if (!diskfs_read_sector(dfs->drive, sector, bitmap_sector)) {
+        if (!diskfs_read_sector(dfs->device, sector, bitmap_sector)) {
             kprintf("verify_bitmap: Failed to read bitmap sector %d\n", sector);
             return 0;
         }
@@ -1948,7 +2097,7 @@ static int verify_bitmap(DiskfsInfo* dfs) {
         uint8_t sb_buf[DISK_SECTOR_SIZE];
         memset(sb_buf, 0, DISK_SECTOR_SIZE);
         memcpy(sb_buf, &dfs->super, sizeof(DiskfsSuper));
-        diskfs_write_sector(dfs->drive, dfs->start_block, sb_buf);
+        diskfs_write_sector(dfs->device, dfs->start_block, sb_buf);
         return 0;
     }
     
@@ -2025,5 +2174,6 @@ static int diskfs_truncate(Inode* inode, uint64_t size) {
     ice->dirty = 1;
     flush_inode(dfs, ice);
     
-    return 1;
+    page_cache_invalidate(inode);
+    return diskfs_commit(dfs);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define DISKFS_H
 
 #include "vfs.h"
+#include "../../drivers/block/block.h"
 #include "../../../lib/definitions.h"
 
 #define DISK_SECTOR_SIZE     512
@@ -15,6 +16,9 @@
 #define JT_COMMIT     2
 #define JT_BLOCK      3 
 
+#define DISKFS_STRICT  0        //every metadata change waits for the device's write cache
+#define DISKFS_RELAXED 1        //only fsync and unmount do
+
 typedef struct {
     uint32_t mode;
     uint32_t uid;
@@ -79,26 +83,38 @@ typedef struct {
     uint32_t ref_count;
     uint8_t dirty;
     uint8_t valid;
+    uint8_t io_pending;         //readahead still on its way in
 } BlockCacheEntry;
 
 #define INODE_CACHE_SIZE 16
 #define BLOCK_CACHE_SIZE 32
 #define DIRECT_BLOCKS    10
 #define BLOCKS_PER_BITMAP_SECTOR (DISK_SECTOR_SIZE * 8)
+#define PREFETCH_BLOCKS  8
 
 extern Inode* root_inode;
 extern Inode* current_directory;
 
 typedef struct {
-    uint8_t drive;
+    int device;                 //block device id
+    int durability;             //DISKFS_STRICT or DISKFS_RELAXED
     uint32_t start_block;
     DiskfsSuper super;
     InodeCacheEntry inode_cache[INODE_CACHE_SIZE];
     BlockCacheEntry block_cache[BLOCK_CACHE_SIZE];
+    BlockRequest prefetch;
+    int prefetch_index[PREFETCH_BLOCKS];
+    uint32_t prefetch_count;    //entries the request in flight fills, 0 when idle
+    uint8_t prefetch_buffer[PREFETCH_BLOCKS * DISK_SECTOR_SIZE] __attribute__((aligned(16)));
 } DiskfsInfo;
 
-SuperBlock* diskfs_mount(uint8_t drive, uint32_t start_block, int auto_format);
-int diskfs_read_sector(uint8_t drive, uint32_t lba, void* buffer);
+bool diskfs_probe(int device, uint32_t start_block);
+SuperBlock* diskfs_mount(int device, uint32_t start_block, int auto_format, int durability);
+int diskfs_sync(SuperBlock* sb);
+int diskfs_unmount(SuperBlock* sb);
+int diskfs_read_sector(int device, uint32_t lba, void* buffer);
+int diskfs_read_blocks(int device, uint32_t start, uint32_t count, void* buffer);
+int diskfs_write_blocks(int device, uint32_t start, uint32_t count, const void* buffer);
 BlockCacheEntry* get_block(DiskfsInfo* dfs, uint32_t block_num);
 void release_block(BlockCacheEntry* bce);
 
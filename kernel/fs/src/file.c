@@ -1,36 +1,216 @@
 #include "file.h"
 #include "vfs.h"
 #include "diskfs.h"
+#include "pipe.h"
 #include "../../mm/heap.h"
+#include "../../mm/shm.h"
+#include "../../threading/threading.h"
 
-static FileDescriptor file_table[MAX_OPEN_FILES];
+FileDescriptor* file_alloc(FileType type, uint32_t flags) {
+    FileDescriptor* file = kmalloc(sizeof(FileDescriptor));
+    if (!file) return NULL;
 
-void file_init() {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        file_table[i].inode = NULL;
-        file_table[i].position = 0;
-        file_table[i].flags = 0;
-        file_table[i].refcount = 0;
+    memset(file, 0, sizeof(FileDescriptor));
+    file->type = type;
+    file->flags = flags;
+    file->refcount = 1;
+    return file;
+}
+
+void file_get(FileDescriptor* file) {
+    __sync_fetch_and_add(&file->refcount, 1);
+}
+
+//Drops a reference, the last one closes the file or pipe end
+void file_put(FileDescriptor* file) {
+    if (__sync_sub_and_fetch(&file->refcount, 1) > 0) return;
+
+    if (file->type == FILE_INODE && file->inode) {
+        kfree(file->inode);
+    } else if (file->type == FILE_PIPE && file->pipe) {
+        pipe_release(file->pipe, file->flags & O_WRONLY);
+    } else if (file->type == FILE_SHM && file->shm) {
+        shm_put(file->shm);
     }
+    kfree(file);
 }
 
-static int get_free_fd() {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (file_table[i].refcount == 0) {
-            return i;
-        }
+static FdTable* alloc_table(int capacity) {
+    FdTable* table = kmalloc(sizeof(FdTable));
+    FileDescriptor** files = kmalloc(capacity * sizeof(FileDescriptor*));
+    uint64_t* used = kmalloc(capacity / 64 * sizeof(uint64_t));
+    if (!table || !files || !used) {
+        if (table) kfree(table);
+        if (files) kfree(files);
+        if (used) kfree(used);
+        return NULL;
     }
-    return -1;
+
+    memset(files, 0, capacity * sizeof(FileDescriptor*));
+    memset(used, 0, capacity / 64 * sizeof(uint64_t));
+    table->capacity = capacity;
+    table->files = files;
+    table->used = used;
+    return table;
+}
+
+static void set_fd(FdTable* table, int fd, FileDescriptor* file) {
+    table->files[fd] = file;
+    if (file) table->used[fd / 64] |= 1ULL << (fd % 64);
+    else table->used[fd / 64] &= ~(1ULL << (fd % 64));
+}
+
+//Doubles the table until fd fits, false once that would pass FD_TABLE_MAX
+static bool grow_table(FdTable* table, int fd) {
+    int capacity = table->capacity;
+    while (capacity <= fd) capacity *= 2;
+    if (capacity > FD_TABLE_MAX) return false;
+    if (capacity == table->capacity) return true;
+
+    FileDescriptor** files = kmalloc(capacity * sizeof(FileDescriptor*));
+    uint64_t* used = kmalloc(capacity / 64 * sizeof(uint64_t));
+    if (!files || !used) {
+        if (files) kfree(files);
+        if (used) kfree(used);
+        return false;
+    }
+
+    memset(files, 0, capacity * sizeof(FileDescriptor*));
+    memset(used, 0, capacity / 64 * sizeof(uint64_t));
+    memcpy(files, table->files, table->capacity * sizeof(FileDescriptor*));
+    memcpy(used, table->used, table->capacity / 64 * sizeof(uint64_t));
+    kfree(table->files);
+    kfree(table->used);
+    table->files = files;
+    table->used = used;
+    table->capacity = capacity;
+    return true;
+}
+
+//Lowest free fd that is at least min, one word of the bitmap covers 64 fds
+static int lowest_free_fd(FdTable* table, int min) {
+    for (int word = min / 64; word < table->capacity / 64; word++) {
+        uint64_t free = ~table->used[word];
+        if (word == min / 64) free &= ~0ULL << (min % 64);
+        if (free) return word * 64 + __builtin_ctzll(free);
+    }
+    return table->capacity > min ? table->capacity : min;
+}
+
+//Fresh table with the console on fds 0, 1 and 2
+FdTable* fd_table_create() {
+    FdTable* table = alloc_table(FD_TABLE_INITIAL);
+    if (!table) return NULL;
+
+    FileDescriptor* in = file_alloc(FILE_CONSOLE, O_RDONLY);
+    FileDescriptor* out = file_alloc(FILE_CONSOLE, O_WRONLY);
+    if (!in || !out) {
+        if (in) kfree(in);
+        if (out) kfree(out);
+        fd_table_destroy(table);
+        return NULL;
+    }
+
+    file_get(out);
+    set_fd(table, 0, in);
+    set_fd(table, 1, out);
+    set_fd(table, 2, out);
+    return table;
+}
+
+//Same fds sharing the same open-file descriptions, for fork and spawn
+FdTable* fd_table_clone(FdTable* table) {
+    if (!table) return fd_table_create();
+
+    FdTable* copy = alloc_table(table->capacity);
+    if (!copy) return NULL;
+
+    for (int fd = 0; fd < table->capacity; fd++) {
+        if (!table->files[fd]) continue;
+        file_get(table->files[fd]);
+        set_fd(copy, fd, table->files[fd]);
+    }
+    return copy;
+}
+
+void fd_table_destroy(FdTable* table) {
+    if (!table) return;
+
+    for (int fd = 0; fd < table->capacity; fd++) {
+        if (table->files[fd]) file_put(table->files[fd]);
+    }
+    kfree(table->files);
+    kfree(table->used);
+    kfree(table);
+}
+
+//Kernel threads get a table the first time they use an fd
+static FdTable* current_table() {
+    Process* current = get_current_process();
+    if (!current) return NULL;
+    if (!current->files) current->files = fd_table_create();
+    return current->files;
+}
+
+FileDescriptor* fd_get(int fd) {
+    FdTable* table = current_table();
+    if (!table || fd < 0 || fd >= table->capacity) return NULL;
+    return table->files[fd];
+}
+
+static int install_from(FdTable* table, FileDescriptor* file, int min) {
+    int fd = lowest_free_fd(table, min);
+    if (fd >= table->capacity && !grow_table(table, fd)) return -1;
+
+    set_fd(table, fd, file);
+    return fd;
+}
+
+//Takes over the caller's reference to file, returns the lowest free fd
+int fd_install(FileDescriptor* file) {
+    FdTable* table = current_table();
+    if (!table || !file) return -1;
+    return install_from(table, file, 0);
+}
+
+int fd_close(int fd) {
+    FdTable* table = current_table();
+    if (!table || fd < 0 || fd >= table->capacity || !table->files[fd]) return -1;
+
+    FileDescriptor* file = table->files[fd];
+    set_fd(table, fd, NULL);
+    file_put(file);
+    return 0;
+}
+
+int fd_dup(int fd) {
+    FileDescriptor* file = fd_get(fd);
+    if (!file) return -1;
+
+    file_get(file);
+    int new_fd = install_from(current_table(), file, 0);
+    if (new_fd < 0) file_put(file);
+    return new_fd;
+}
+
+//Makes new_fd refer to the same description as fd, closing whatever new_fd was first
+int fd_dup2(int fd, int new_fd) {
+    FdTable* table = current_table();
+    FileDescriptor* file = fd_get(fd);
+    if (!file || new_fd < 0) return -1;
+    if (fd == new_fd) return new_fd;
+    if (new_fd >= table->capacity && !grow_table(table, new_fd)) return -1;
+
+    FileDescriptor* old = table->files[new_fd];
+    file_get(file);
+    set_fd(table, new_fd, file);
+    if (old) file_put(old);
+    return new_fd;
 }
 
 int file_open(const char* path, int flags, int mode) {
     if (!path) return -1;
     
-    int fd = get_free_fd();
-    if (fd < 0) {
-        return -1;
-    }
-    
     Inode* start_dir = NULL;
     if (path[0] == '/') {
         start_dir = root_inode;
@@ -96,84 +276,95 @@ int file_open(const char* path, int flags, int mode) {
         return -1;
     }
     
-    file_table[fd].inode = found_inode;
-    file_table[fd].position = 0;
-    file_table[fd].flags = flags;
-    file_table[fd].refcount = 1;
+    //vfs_lookup hands back the root or the start directory itself for "/" and ".", and the
+    //description frees its inode on the last close, so it always gets a copy of its own
+    if (found_inode == start_dir || found_inode == root_inode || found_inode == current_directory) {
+        Inode* copy = kmalloc(sizeof(Inode));
+        if (!copy) return -1;
+        memcpy(copy, found_inode, sizeof(Inode));
+        found_inode = copy;
+    }
+    
+    FileDescriptor* file = file_alloc(FILE_INODE, flags);
+    if (!file) {
+        kfree(found_inode);
+        return -1;
+    }
+    file->inode = found_inode;
     
     if (flags & O_APPEND) {
-        file_table[fd].position = found_inode->size;
+        file->position = found_inode->size;
     }
     
     if (flags & O_TRUNC) {
-        if (file_table[fd].inode->ops->truncate) {
-            if (!file_table[fd].inode->ops->truncate(file_table[fd].inode, 0)) {
-                file_table[fd].inode = NULL;
-                file_table[fd].refcount = 0;
+        if (file->inode->ops->truncate) {
+            if (!file->inode->ops->truncate(file->inode, 0)) {
+                file_put(file);
                 return -1;
             }
         } else {
-            file_table[fd].inode->size = 0;
+            file->inode->size = 0;
         }
     }
     
+    int fd = fd_install(file);
+    if (fd < 0) {
+        file_put(file);
+        return -1;
+    }
     return fd;
 }
 
 int file_close(int fd) {
-    if (fd < 0 || fd >= MAX_OPEN_FILES || file_table[fd].refcount == 0) {
-        return -1;
-    }
-    
-    file_table[fd].refcount--;
-    
-    if (file_table[fd].refcount == 0) {
-        file_table[fd].inode = NULL;
-        file_table[fd].position = 0;
-        file_table[fd].flags = 0;
-    }
-    
-    return 0;
+    return fd_close(fd);
+}
+
+static FileDescriptor* get_inode_file(int fd) {
+    FileDescriptor* file = fd_get(fd);
+    if (!file || file->type != FILE_INODE) return NULL;
+    return file;
 }
 
 int file_read(int fd, void* buffer, uint64_t count) {
-    if (fd < 0 || fd >= MAX_OPEN_FILES || file_table[fd].refcount == 0 || !buffer) {
+    FileDescriptor* file = get_inode_file(fd);
+    if (!file || !buffer) {
         return -1;
     }
     
-    if (!(file_table[fd].flags & (O_RDONLY | O_RDWR))) {
+    if (!(file->flags & (O_RDONLY | O_RDWR))) {
         return -1;
     }
     
-    Inode* inode = file_table[fd].inode;
-    uint64_t position = file_table[fd].position;
+    Inode* inode = file->inode;
+    uint64_t position = file->position;
     
     int bytes_read = inode->ops->read(inode, position, buffer, count);
     if (bytes_read > 0) {
-        file_table[fd].position += bytes_read;
+        file->position += bytes_read;
     }
     
     return bytes_read;
 }
 
 int file_write(int fd, const void* buffer, uint64_t count) {
-    if (fd < 0 || fd >= MAX_OPEN_FILES || file_table[fd].refcount == 0 || !buffer) {
+    FileDescriptor* file = get_inode_file(fd);
+    if (!file || !buffer) {
         return -1;
     }
     
-    if (!(file_table[fd].flags & (O_WRONLY | O_RDWR))) {
+    if (!(file->flags & (O_WRONLY | O_RDWR))) {
         return -1;
     }
     
-    Inode* inode = file_table[fd].inode;
-    uint64_t position = file_table[fd].position;
+    Inode* inode = file->inode;
+    uint64_t position = file->position;
     
     int bytes_written = inode->ops->write(inode, position, buffer, count);
     if (bytes_written > 0) {
-        file_table[fd].position += bytes_written;
+        file->position += bytes_written;
         
-        if (file_table[fd].position > inode->size) {
-            inode->size = file_table[fd].position;
+        if (file->position > inode->size) {
+            inode->size = file->position;
         }
     }
     
@@ -181,7 +372,8 @@ int file_write(int fd, const void* buffer, uint64_t count) {
 }
 
 int file_seek(int fd, uint64_t offset, int whence) {
-    if (fd < 0 || fd >= MAX_OPEN_FILES || file_table[fd].refcount == 0) {
+    FileDescriptor* file = get_inode_file(fd);
+    if (!file) {
         return -1;
     }
     
@@ -192,10 +384,10 @@ int file_seek(int fd, uint64_t offset, int whence) {
             new_pos = offset;
             break;
         case SEEK_CUR:
-            new_pos = file_table[fd].position + offset;
+            new_pos = file->position + offset;
             break;
         case SEEK_END:
-            new_pos = file_table[fd].inode->size + offset;
+            new_pos = file->inode->size + offset;
             break;
         default:
             return -1;
@@ -205,7 +397,7 @@ int file_seek(int fd, uint64_t offset, int whence) {
         return -1;
     }
     
-    file_table[fd].position = new_pos;
+    file->position = new_pos;
     return new_pos;
 }
 
@@ -295,12 +487,23 @@ int file_unlink(const char* path) {
     }
 }
 
+//0 once what was written through fd is on the medium, as far as its filesystem can tell
+int file_fsync(int fd) {
+    FileDescriptor* file = get_inode_file(fd);
+    if (!file) return -1;
+
+    Inode* inode = file->inode;
+    if (!inode->ops || !inode->ops->fsync) return 0;
+    return inode->ops->fsync(inode) ? 0 : -1;
+}
+
 int file_fstat(int fd, struct stat* buf) {
-    if (fd < 0 || fd >= MAX_OPEN_FILES || file_table[fd].refcount == 0 || !buf) {
+    FileDescriptor* file = get_inode_file(fd);
+    if (!file || !buf) {
         return -1;
     }
     
-    Inode* inode = file_table[fd].inode;
+    Inode* inode = file->inode;
     
     buf->st_mode = inode->mode;
     buf->st_size = inode->size;
@@ -4,15 +4,34 @@
 #include "../../../lib/definitions.h"
 #include "vfs.h"
 
-#define MAX_OPEN_FILES 16
+#define FD_TABLE_INITIAL 64
+#define FD_TABLE_MAX 1024
 
+typedef enum {
+    FILE_INODE,
+    FILE_PIPE,
+    FILE_CONSOLE,
+    FILE_SHM
+} FileType;
+
+//Open-file description, shared by every fd that was dup'ed or inherited from the same open
 typedef struct {
+    FileType type;
     Inode* inode;
+    struct Pipe* pipe;
+    struct ShmObject* shm;
     uint64_t position;
     uint32_t flags;
     int refcount;
 } FileDescriptor;
 
+//Per-process fd numbers, a set bit in used means the fd is taken. Only its own process touches it
+typedef struct FdTable {
+    int capacity;
+    FileDescriptor** files;
+    uint64_t* used;
+} FdTable;
+
 #define O_RDONLY    0x0001
 #define O_WRONLY    0x0002
 #define O_RDWR      0x0003
@@ -34,6 +53,19 @@ struct stat {
     uint64_t st_ctime;
 };
 
+FileDescriptor* file_alloc(FileType type, uint32_t flags);
+void file_get(FileDescriptor* file);
+void file_put(FileDescriptor* file);
+
+FdTable* fd_table_create();
+FdTable* fd_table_clone(FdTable* table);
+void fd_table_destroy(FdTable* table);
+FileDescriptor* fd_get(int fd);
+int fd_install(FileDescriptor* file);
+int fd_close(int fd);
+int fd_dup(int fd);
+int fd_dup2(int fd, int new_fd);
+
 int file_open(const char* path, int flags, int mode);
 int file_close(int fd);
 int file_read(int fd, void* buffer, uint64_t count);
@@ -43,5 +75,6 @@ int file_stat(const char* path, struct stat* buf);
 int file_create(const char* path, int mode);
 int file_unlink(const char* path);
 int file_fstat(int fd, struct stat* buf);
+int file_fsync(int fd);
 
 #endif
\ No newline at end of file
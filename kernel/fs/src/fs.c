@@ -1,12 +1,54 @@
 #include "../fs.h"
 #include "vfs.h"
 #include "diskfs.h"
+#include "../../drivers/ramdisk/ramdisk.h"
 
 Inode* global_root = NULL;
+static SuperBlock* root_sb = NULL;
+static SuperBlock* tmp_sb = NULL;
 static char current_path[256] = "/";
 
+//A fresh filesystem on the boot ramdisk. Nothing in /tmp outlives a reboot, so it never waits
+//for a flush until it is unmounted
+static void mount_tmp() {
+    BlockDevice* ram = block_find("ram0");
+    if (!ram) return;
+
+    SuperBlock* sb = diskfs_mount(ram->id, 0, 1, DISKFS_RELAXED);
+    if (!sb || vfs_mount("/tmp", sb) != 0) {
+        kprintf("Failed to mount /tmp\n");
+        return;
+    }
+    tmp_sb = sb;
+    kprintf("Mounted %s on /tmp\n", ram->name);
+}
+
+//The fastest disk that keeps its contents and already holds a filesystem. Only when none
+//does is the fastest one formatted, so attaching a faster disk never moves or wipes the root
+static int find_root_device() {
+    int best = -1;
+    for (int id = 0; id < block_count(); id++) {
+        BlockDevice* dev = block_get(id);
+        if (!dev->persistent || !diskfs_probe(id, 0)) continue;
+        if (best < 0 || dev->speed > block_get(best)->speed) best = id;
+    }
+    if (best < 0) {
+        best = block_fastest(true);
+        if (best >= 0) kprintf("No filesystem found, %s will be formatted\n", block_get(best)->name);
+    }
+    return best;
+}
+
 void fs_init() {
-    SuperBlock* root_sb = diskfs_mount(0, 0, 1);  // Primary drive, first sector, auto-format
+    //From the disk's first sector, auto-format. Strict: every call that changes metadata returns
+    //only once the change is on the medium
+    int device = find_root_device();
+    if (device < 0) {
+        kprintf("No disk to mount the root filesystem from\n");
+        return;
+    }
+
+    root_sb = diskfs_mount(device, 0, 1, DISKFS_STRICT);
     if (!root_sb) {
         kprintf("Failed to mount root filesystem\n");
         return;
@@ -14,6 +56,7 @@ void fs_init() {
     
     global_root = root_sb->root;
     current_directory = global_root;
+    vfs_mount("/", root_sb);
 
     Inode* current = get_current_dir();
     if (current->ops->mkdir(current, "home", 0755)) {
@@ -32,11 +75,31 @@ void fs_init() {
     } else {
         kprintf("Failed to create lib directory\n");
     }
+
+    //Already there after the first boot
+    current->ops->mkdir(current, "tmp", 0777);
+    mount_tmp();
     
     kprintf("Filesystem initialized with root at inode %d\n", 
             ((InodeCacheEntry*)global_root->fs_specific)->inode_num);
 }
 
+//Leaves every filesystem on its medium, /tmp before the root it hangs off. Nothing may use
+//them afterwards
+void fs_shutdown() {
+    if (tmp_sb) {
+        vfs_unmount(tmp_sb);
+        if (!diskfs_unmount(tmp_sb)) kprintf("Failed to unmount /tmp\n");
+        tmp_sb = NULL;
+    }
+    if (root_sb) {
+        vfs_unmount(root_sb);
+        if (!diskfs_unmount(root_sb)) kprintf("Failed to unmount root filesystem\n");
+        root_sb = NULL;
+        global_root = NULL;
+    }
+}
+
 Inode* get_current_dir() {
     return current_directory;
 }
@@ -62,7 +125,7 @@ int change_dir(const char* path) {
         }
         
         Inode* parent = NULL;
-        if (current_directory->ops->lookup(current_directory, "..", &parent)) {
+        if (vfs_lookup(current_directory, "..", &parent)) {
             current_directory = parent;
             
             char* last_slash = strrchr(current_path, '/');
@@ -84,7 +147,7 @@ int change_dir(const char* path) {
     }
     
     Inode* target = NULL;
-    if (!current_directory->ops->lookup(current_directory, path, &target)) {
+    if (!vfs_lookup(current_directory, path, &target)) {
         return -1;
     }
     
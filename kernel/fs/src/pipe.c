@@ -0,0 +1,201 @@
+#include "pipe.h"
+#include "../../mm/heap.h"
+#include "../../mm/paging.h"
+#include "../../mm/frame.h"
+
+static spinlock_t pipe_ends_lock = SPINLOCK_INIT;
+
+//Held across the copies, which can fault and sleep on the disk, so it cannot be a spinlock
+static void pipe_lock(Pipe* pipe) {
+    wait_event(&pipe->busy_wait, __sync_lock_test_and_set(&pipe->busy, 1) == 0);
+}
+
+static void pipe_unlock(Pipe* pipe) {
+    __sync_lock_release(&pipe->busy);
+    wake_up(&pipe->busy_wait);
+}
+
+//One reader and one writer to start with, the caller wraps them in open-file descriptions
+Pipe* pipe_create() {
+    Pipe* pipe = kmalloc(sizeof(Pipe));
+    uint8_t* buffer = kmalloc(PIPE_BUFFER_SIZE);
+    if (!pipe || !buffer) {
+        if (pipe) kfree(pipe);
+        if (buffer) kfree(buffer);
+        return NULL;
+    }
+
+    memset(pipe, 0, sizeof(Pipe));
+    pipe->buffer = buffer;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    wait_queue_init(&pipe->busy_wait);
+    wait_queue_init(&pipe->read_wait);
+    wait_queue_init(&pipe->write_wait);
+    return pipe;
+}
+
+static void drop_first_page(Pipe* pipe) {
+    PipePage* page = &pipe->pages[pipe->page_head];
+    if (page->frame) frame_free(page->frame);
+    page->frame = 0;
+    pipe->page_head = (pipe->page_head + 1) % PIPE_MAX_PAGES;
+    pipe->page_count--;
+}
+
+//Returns what is there, blocking only while the pipe is empty. 0 once every writer is gone
+int pipe_read(Pipe* pipe, void* buffer, uint64_t count) {
+    if (!pipe || !buffer) return -1;
+    if (count == 0) return 0;
+
+    Process* current = get_current_process();
+    uint64_t cr3 = current ? current->cr3 : 0;
+    uint8_t* to = (uint8_t*)buffer;
+    uint64_t done = 0;
+
+    for (;;) {
+        wait_event(&pipe->read_wait, pipe->count || pipe->page_count || !pipe->writers);
+
+        pipe_lock(pipe);
+        if (pipe->count || pipe->page_count) break;
+        pipe_unlock(pipe);
+        if (!pipe->writers) return 0;
+    }
+
+    while (done < count && pipe->count) {
+        uint64_t chunk = count - done;
+        if (chunk > pipe->count) chunk = pipe->count;
+        if (chunk > PIPE_BUFFER_SIZE - pipe->head) chunk = PIPE_BUFFER_SIZE - pipe->head;
+
+        memcpy(to + done, pipe->buffer + pipe->head, chunk);
+        pipe->head = (pipe->head + chunk) % PIPE_BUFFER_SIZE;
+        pipe->count -= chunk;
+        done += chunk;
+    }
+
+    while (done < count && pipe->page_count) {
+        PipePage* page = &pipe->pages[pipe->page_head];
+        uint64_t chunk = count - done;
+        if (chunk > page->length) chunk = page->length;
+
+        //A whole page landing on a page boundary of a user buffer is mapped there instead of copied
+        uint64_t vaddr = (uint64_t)(to + done);
+        if (cr3 && chunk == PAGE_SIZE && !(vaddr & (PAGE_SIZE - 1)) &&
+            address_space_replace(cr3, vaddr, page->frame)) {
+            page->frame = 0;
+            pipe->pages_moved++;
+        } else {
+            memcpy(to + done, (void*)(page->frame + page->offset), chunk);
+            pipe->bytes_copied += chunk;
+        }
+
+        page->offset += chunk;
+        page->length -= chunk;
+        done += chunk;
+        if (page->length == 0) drop_first_page(pipe);
+    }
+
+    pipe_unlock(pipe);
+    wake_up_all(&pipe->write_wait);
+    return (int)done;
+}
+
+//Queues whole pages from the writer's buffer, copying only pages that cannot be shared
+static uint64_t write_pages(Pipe* pipe, uint64_t cr3, const uint8_t* from, uint64_t count) {
+    uint64_t done = 0;
+
+    while (count - done >= PAGE_SIZE && pipe->page_count < PIPE_MAX_PAGES) {
+        uint64_t frame = address_space_share(cr3, (uint64_t)(from + done));
+        if (!frame) {
+            frame = frame_alloc();
+            if (!frame) break;
+            memcpy((void*)frame, from + done, PAGE_SIZE);
+            pipe->bytes_copied += PAGE_SIZE;
+        }
+
+        PipePage* page = &pipe->pages[(pipe->page_head + pipe->page_count) % PIPE_MAX_PAGES];
+        page->frame = frame;
+        page->offset = 0;
+        page->length = PAGE_SIZE;
+        pipe->page_count++;
+        done += PAGE_SIZE;
+    }
+    return done;
+}
+
+static uint64_t write_ring(Pipe* pipe, const uint8_t* from, uint64_t count) {
+    uint64_t done = 0;
+
+    while (done < count && pipe->count < PIPE_BUFFER_SIZE) {
+        uint32_t tail = (pipe->head + pipe->count) % PIPE_BUFFER_SIZE;
+        uint64_t chunk = count - done;
+        if (chunk > PIPE_BUFFER_SIZE - pipe->count) chunk = PIPE_BUFFER_SIZE - pipe->count;
+        if (chunk > PIPE_BUFFER_SIZE - tail) chunk = PIPE_BUFFER_SIZE - tail;
+
+        memcpy(pipe->buffer + tail, from + done, chunk);
+        pipe->count += chunk;
+        done += chunk;
+    }
+    pipe->bytes_copied += done;
+    return done;
+}
+
+//Blocks until everything is written, returns less only if the last reader goes away
+int pipe_write(Pipe* pipe, const void* buffer, uint64_t count) {
+    if (!pipe || !buffer) return -1;
+
+    Process* current = get_current_process();
+    uint64_t cr3 = current ? current->cr3 : 0;
+    const uint8_t* from = (const uint8_t*)buffer;
+    uint64_t done = 0;
+
+    while (done < count) {
+        uint64_t left = count - done;
+        bool whole_pages = cr3 && left >= PAGE_SIZE && !((uint64_t)(from + done) & (PAGE_SIZE - 1));
+
+        if (whole_pages) {
+            wait_event(&pipe->write_wait, !pipe->readers || (!pipe->count && pipe->page_count < PIPE_MAX_PAGES));
+        } else {
+            wait_event(&pipe->write_wait, !pipe->readers || (!pipe->page_count && pipe->count < PIPE_BUFFER_SIZE));
+        }
+        if (!pipe->readers) return done ? (int)done : -1;
+
+        pipe_lock(pipe);
+        uint64_t written = 0;
+        if (whole_pages && !pipe->count) {
+            written = write_pages(pipe, cr3, from + done, left);
+            if (!written && !pipe->page_count) {
+                pipe_unlock(pipe);
+                kprintf("pipe_write: out of memory\n");
+                return done ? (int)done : -1;
+            }
+        } else if (!whole_pages && !pipe->page_count) {
+            written = write_ring(pipe, from + done, left);
+        }
+        pipe_unlock(pipe);
+
+        done += written;
+        if (written) wake_up_all(&pipe->read_wait);
+    }
+    return (int)done;
+}
+
+//Called when the last description of one end goes away, the pipe is freed with the last end
+void pipe_release(Pipe* pipe, bool writer) {
+    uint64_t flags = spin_lock_irqsave(&pipe_ends_lock);
+    if (writer) pipe->writers--;
+    else pipe->readers--;
+    bool last = pipe->readers == 0 && pipe->writers == 0;
+    if (!last) {
+        //Blocked readers see end of file, blocked writers an error. Still under the lock, so the
+        //other end cannot free the pipe before both queues are woken
+        wake_up_all(&pipe->read_wait);
+        wake_up_all(&pipe->write_wait);
+    }
+    spin_unlock_irqrestore(&pipe_ends_lock, flags);
+    if (!last) return;
+
+    while (pipe->page_count) drop_first_page(pipe);
+    kfree(pipe->buffer);
+    kfree(pipe);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "../../../lib/definitions.h"
+#include "../../threading/threading.h"
+#include "file.h"
+
+#define PIPE_BUFFER_SIZE 4096
+#define PIPE_MAX_PAGES 16
+
+//A page handed over by a writer, offset and length say what is still unread
+typedef struct PipePage {
+    uint64_t frame;
+    uint32_t offset;
+    uint32_t length;
+} PipePage;
+
+/*
+ * Small writes are copied through the ring buffer. Page-aligned writes of
+ * whole pages from a user address space queue the writer's frames instead,
+ * copy-on-write, and a page-aligned reader gets them mapped in place. The
+ * pipe holds either ring data or pages, never both, so bytes stay in order.
+ */
+typedef struct Pipe {
+    volatile uint32_t busy;
+    WaitQueue busy_wait;
+    uint8_t* buffer;
+    uint32_t head;
+    uint32_t count;
+    PipePage pages[PIPE_MAX_PAGES];
+    uint32_t page_head;
+    uint32_t page_count;
+    int readers;                //open-file descriptions for each end
+    int writers;
+    WaitQueue read_wait;
+    WaitQueue write_wait;
+    uint64_t bytes_copied;
+    uint64_t pages_moved;
+} Pipe;
+
+Pipe* pipe_create();
+int pipe_read(Pipe* pipe, void* buffer, uint64_t count);
+int pipe_write(Pipe* pipe, const void* buffer, uint64_t count);
+void pipe_release(Pipe* pipe, bool writer);
+
+#endif
\ No newline at end of file
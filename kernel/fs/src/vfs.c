@@ -5,7 +5,17 @@
 #include "../../drivers/vga/vga.h"
 #include "../../../lib/definitions.h"
 
+#define VFS_MAX_MOUNTS 8
+
+//A filesystem mounted over a directory of another one, lookups step across it
+typedef struct VfsMount {
+    Inode* covered;             //the directory it hides, ".." from its root goes on from there
+    SuperBlock* sb;
+} VfsMount;
+
 static SuperBlock* g_root_sb = NULL;
+static VfsMount g_mounts[VFS_MAX_MOUNTS];
+static int g_mount_count = 0;
 
 static Inode* find_inode_by_path(const char* path) {
     if (!g_root_sb) return NULL;
@@ -27,12 +37,73 @@ static Inode* find_inode_by_path(const char* path) {
     return NULL;
 }
 
+//"/" sets the root filesystem, anything else must be an existing directory of it. 0 on success
 int vfs_mount(const char* mountpoint, SuperBlock* sb) {
-    (void)mountpoint;
-    g_root_sb = sb;
+    if (!mountpoint || !sb || !sb->root) return -1;
+    if (strcmp(mountpoint, "/") == 0) {
+        g_root_sb = sb;
+        return 0;
+    }
+    if (g_mount_count == VFS_MAX_MOUNTS) {
+        kprintf("vfs_mount: no room to mount on %s\n", mountpoint);
+        return -1;
+    }
+
+    Inode* dir = NULL;
+    if (!root_inode || !vfs_lookup(root_inode, mountpoint, &dir) || !dir || dir == root_inode) {
+        kprintf("vfs_mount: %s is not a directory to mount on\n", mountpoint);
+        return -1;
+    }
+    g_mounts[g_mount_count].covered = dir;
+    g_mounts[g_mount_count].sb = sb;
+    g_mount_count++;
     return 0;
 }
 
+//Forgets where sb was mounted, the filesystem itself is left to its driver. 0 on success
+int vfs_unmount(SuperBlock* sb) {
+    if (!sb) return -1;
+    if (sb == g_root_sb) {
+        g_root_sb = NULL;
+        return 0;
+    }
+    for (int i = 0; i < g_mount_count; i++) {
+        if (g_mounts[i].sb != sb) continue;
+        kfree(g_mounts[i].covered);
+        g_mounts[i] = g_mounts[--g_mount_count];
+        return 0;
+    }
+    return -1;
+}
+
+//Inodes are copies that lookups free, so they are matched by filesystem and number
+static VfsMount* mount_covering(Inode* inode) {
+    for (int i = 0; i < g_mount_count; i++) {
+        Inode* covered = g_mounts[i].covered;
+        if (covered->sb == inode->sb && covered->ino == inode->ino) return &g_mounts[i];
+    }
+    return NULL;
+}
+
+static VfsMount* mount_rooted_at(Inode* inode) {
+    for (int i = 0; i < g_mount_count; i++) {
+        if (g_mounts[i].sb == inode->sb && g_mounts[i].sb->root->ino == inode->ino) return &g_mounts[i];
+    }
+    return NULL;
+}
+
+//A mounted-on directory turns into a copy of the mounted root, the caller may free either
+static Inode* mount_cross(Inode* inode) {
+    VfsMount* mount = mount_covering(inode);
+    if (!mount) return inode;
+
+    Inode* root = kmalloc(sizeof(Inode));
+    if (!root) return inode;
+    memcpy(root, mount->sb->root, sizeof(Inode));
+    kfree(inode);
+    return root;
+}
+
 File* vfs_open(const char* path, int flags) {
     Inode* inode = find_inode_by_path(path);
     if (!inode && (flags & O_CREAT)) {
@@ -138,10 +209,14 @@ int vfs_lookup(Inode* start_dir, const char* path, Inode** result) {
         }
         else if (strcmp(component, "..") == 0) {
             if (current != root_inode) {
+                //Out of a mounted filesystem's root, into the parent of the directory it hides
+                VfsMount* mount = mount_rooted_at(current);
+                Inode* from = mount ? mount->covered : current;
                 Inode* parent = NULL;
-                if (!current->ops->lookup(current, "..", &parent)) {
+                if (!from->ops->lookup(from, "..", &parent)) {
                     return 0;
                 }
+                parent = mount_cross(parent);
                 
                 if (current != start_dir) {
                     kfree(current);
@@ -155,6 +230,7 @@ int vfs_lookup(Inode* start_dir, const char* path, Inode** result) {
             if (!current->ops->lookup(current, component, &next)) {
                 return 0;
             }
+            next = mount_cross(next);
             
             if (current != start_dir) {
                 kfree(current);
@@ -21,9 +21,11 @@ typedef struct InodeOps {
     int (*delete)(struct Inode* dir, const char* name);
     int (*mkdir)(struct Inode* dir, const char* name, int mode);
     int (*truncate)(struct inode* inode, uint64_t size);
+    int (*fsync)(struct Inode* inode);          //optional, 1 once the file is on the medium
 } InodeOps;
 
 typedef struct Inode {
+    uint32_t ino;               //filesystem-wide inode number, identifies the file together with sb
     uint32_t mode;
     uint32_t size;
     struct SuperBlock* sb;
@@ -37,6 +39,7 @@ typedef struct SuperBlock {
 } SuperBlock;
 
 int   vfs_mount(const char* mountpoint, SuperBlock* sb);
+int   vfs_unmount(SuperBlock* sb);
 File* vfs_open(const char* path, int flags);
 int   vfs_read(File* file, void* buffer, uint64_t size);
 int   vfs_write(File* file, const void* buffer, uint64_t size);
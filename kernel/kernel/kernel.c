@@ -4,6 +4,12 @@
 #include "../fs/fs.h"
 #include "../../shell/shell.h"
 #include "../drivers/PCI/pci.h"
+#include "../drivers/AHCI/ahci.h"
+#include "../drivers/virtio/virtio_blk.h"
+#include "../drivers/NVME/nvme.h"
+#include "../drivers/ramdisk/ramdisk.h"
+#include "../threading/threading.h"
+#include "../mm/paging.h"
 
 extern int fpu_init();
 
@@ -12,14 +18,20 @@ void kernel_main() {
     kprint("Vga initialized\n");
     heap_init();
     kprint("Heap initialized\n");
+    paging_init();
+    scheduler_init();
     idt_init();
     kprint("Interrupts enabled\n");
     keyboard_init();
     kprint("Keyboard initialized\n");
+    pci_init();
     ide_init();
+    ahci_init();
+    virtio_blk_init();
+    nvme_init();
+    ramdisk_init();
     int a = fpu_init();
     if (a == 0) kprint("Floating Point Unit initialized\n");
-    pci_init();
     fs_init();
     Inode* root = get_root();
     shell_loop();
@@ -0,0 +1,17 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "../../lib/definitions.h"
+#include "paging.h"
+
+//Everything below this is kernel image, heap and the filesystem region
+#define FRAME_POOL_START 0x1400000
+
+void frame_init();
+uint64_t frame_alloc();
+void frame_ref(uint64_t paddr);
+void frame_free(uint64_t paddr);
+uint32_t frame_refcount(uint64_t paddr);
+uint32_t frame_free_count();
+
+#endif
\ No newline at end of file
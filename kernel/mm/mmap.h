@@ -0,0 +1,32 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include "../../lib/definitions.h"
+#include "paging.h"
+#include "vma.h"
+
+#define PROT_NONE   0x0
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+#define MAP_FIXED       0x10
+#define MAP_ANONYMOUS   0x20
+
+#define MAP_FAILED ((void*)-1)
+
+//Mappings without a fixed address go between the image and the stack, a guard page below the stack
+#define MMAP_BASE (USER_SPACE_START + 0x4000000000ULL)
+#define MMAP_END  (USER_STACK_TOP - USER_STACK_SIZE - PAGE_SIZE)
+
+#define MS_ASYNC        0x1
+#define MS_SYNC         0x4
+
+uint64_t vm_mmap(uint64_t cr3, VmArea** list, uint64_t addr, uint64_t length, int prot, int flags,
+                 VmFile* file, uint64_t offset);
+int vm_munmap(uint64_t cr3, VmArea** list, uint64_t addr, uint64_t length);
+int vm_msync(uint64_t cr3, VmArea* list, uint64_t addr, uint64_t length);
+
+#endif
\ No newline at end of file
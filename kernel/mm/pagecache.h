@@ -0,0 +1,23 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "../../lib/definitions.h"
+#include "../fs/src/vfs.h"
+
+#define PAGE_CACHE_BUCKETS 256
+#define PAGE_CACHE_MAX_PAGES 1024
+
+typedef struct CachedPage {
+    SuperBlock* sb;
+    uint32_t ino;
+    uint64_t index;             //page number within the file
+    uint64_t frame;
+    struct CachedPage* next;
+} CachedPage;
+
+uint64_t page_cache_get(Inode* inode, uint64_t index);
+int page_cache_read(Inode* inode, uint64_t offset, void* buffer, uint64_t size);
+void page_cache_update(Inode* inode, uint64_t offset, const void* buffer, uint64_t size);
+void page_cache_invalidate(Inode* inode);
+
+#endif
\ No newline at end of file
@@ -14,12 +14,26 @@
 #define PAGE_DIRTY      (1ULL << 6)
 #define PAGE_HUGE       (1ULL << 7)
 #define PAGE_GLOBAL     (1ULL << 8)
+#define PAGE_COW        (1ULL << 9)     // available bit: read-only only because it is shared
+#define PAGE_SHARED     (1ULL << 10)    // available bit: MAP_SHARED, fork shares it writable instead of copying
 #define PAGE_NX         (1ULL << 63)
 
-#define MEMORY_SIZE     (256 * 1024 * 128) // 8MB of memory
+#define PAGE_ADDR_MASK  0x000FFFFFFFFFF000ULL
+#define PAGE_FLAGS_MASK (~PAGE_ADDR_MASK)
+#define HUGE_PAGE_SIZE  0x200000
+
+#define MEMORY_SIZE     (256 * 1024 * 128) // 32MB of memory
 #define PAGE_COUNT      (MEMORY_SIZE / PAGE_SIZE)
 #define BITMAP_SIZE     (PAGE_COUNT / 8)
 
+// Every address space shares the kernel mappings, user mappings live in PML4 slot 1
+#define USER_PML4_INDEX 1
+#define USER_SPACE_START 0x0000008000000000ULL
+#define USER_SPACE_END   0x0000010000000000ULL
+#define USER_IMAGE_BASE  USER_SPACE_START
+#define USER_STACK_SIZE  (16 * PAGE_SIZE)
+#define USER_STACK_TOP   USER_SPACE_END
+
 typedef uint64_t page_entry_t;
 
 void paging_init(void);
@@ -33,4 +47,27 @@ void unmap_page(uint64_t vaddr);
 // Get the physical address for a virtual address
 uint64_t get_physical_address(uint64_t vaddr);
 
+// Identity maps device registers uncached, NULL if the tables cannot be built
+void* map_mmio(uint64_t paddr, uint64_t size);
+
+uint64_t paging_kernel_cr3();
+uint64_t paging_zero_frame();
+
+// Per-process address spaces, identified by the physical address of their PML4
+uint64_t address_space_create();
+uint64_t address_space_clone(uint64_t cr3);
+void address_space_destroy(uint64_t cr3);
+bool address_space_map(uint64_t cr3, uint64_t vaddr, uint64_t paddr, uint64_t flags);
+bool address_space_alloc(uint64_t cr3, uint64_t vaddr, uint64_t size, uint64_t flags);
+bool address_space_write(uint64_t cr3, uint64_t vaddr, const void* src, uint64_t size);
+void address_space_unmap(uint64_t cr3, uint64_t vaddr, uint64_t size);
+
+// Moving whole pages between address spaces without copying them
+uint64_t address_space_share(uint64_t cr3, uint64_t vaddr);
+bool address_space_replace(uint64_t cr3, uint64_t vaddr, uint64_t paddr);
+uint64_t address_space_clean(uint64_t cr3, uint64_t vaddr);
+
+// Resolves copy-on-write faults, false means the fault is a real error
+bool paging_handle_fault(uint64_t vaddr, uint64_t error_code);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "../../lib/definitions.h"
+
+#define SHM_NAME_LEN 32
+#define SHM_MAX_SIZE (16 * 1024 * 1024)
+
+/*
+ * Named shared memory. The object owns one reference on each of its frames,
+ * every page mapped into a process another, so frames are freed once the
+ * object is gone and the last mapping of them is unmapped.
+ */
+typedef struct ShmObject {
+    char name[SHM_NAME_LEN];
+    uint64_t size;              //page aligned
+    uint64_t* frames;           //0 until the page is first touched
+    int refs;                   //open fds and mapped areas
+    bool linked;                //still reachable by name
+    struct ShmObject* next;
+} ShmObject;
+
+ShmObject* shm_open_object(const char* name, bool create, uint64_t size);
+int shm_unlink_object(const char* name);
+void shm_get(ShmObject* shm);
+void shm_put(ShmObject* shm);
+uint64_t shm_get_frame(ShmObject* shm, uint64_t index);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,31 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "../../lib/definitions.h"
+#include "../threading/src/spinlock.h"
+
+//One frame per slab, the header sits at its start and the objects follow
+typedef struct Slab {
+    struct Slab* next;
+    struct Slab* prev;
+    void* free;                 //first free object, each free object points at the next
+    uint32_t in_use;
+} Slab;
+
+typedef struct SlabCache {
+    const char* name;
+    uint32_t object_size;
+    uint32_t per_slab;
+    spinlock_t lock;
+    Slab* partial;              //slabs with both used and free objects
+    Slab* full;
+    Slab* empty;                //at most one is kept around, the rest go back to the frame allocator
+    uint32_t slabs;
+    uint32_t objects;
+} SlabCache;
+
+SlabCache* slab_cache_create(const char* name, uint32_t object_size);
+void* slab_alloc(SlabCache* cache);
+void slab_free(SlabCache* cache, void* object);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "../frame.h"
+#include "../../threading/src/spinlock.h"
+
+/*
+ * Physical page frames for page tables and process memory. A frame can be
+ * mapped by several address spaces at once (copy-on-write, shared text),
+ * so each one carries a reference count and goes back to the pool when
+ * the last mapping drops it.
+ */
+static uint8_t frame_bitmap[BITMAP_SIZE];
+static uint16_t frame_refs[PAGE_COUNT];
+static uint32_t frame_next = 0;
+static uint32_t frames_free = 0;
+static spinlock_t frame_lock = SPINLOCK_INIT;
+
+static inline bool frame_used(uint32_t index) {
+    return frame_bitmap[index / 8] & (1 << (index % 8));
+}
+
+static inline void frame_set(uint32_t index) {
+    frame_bitmap[index / 8] |= (1 << (index % 8));
+}
+
+static inline void frame_clear(uint32_t index) {
+    frame_bitmap[index / 8] &= ~(1 << (index % 8));
+}
+
+void frame_init() {
+    memset(frame_bitmap, 0, BITMAP_SIZE);
+    memset(frame_refs, 0, sizeof(frame_refs));
+
+    uint32_t first = FRAME_POOL_START / PAGE_SIZE;
+    for (uint32_t i = 0; i < first; i++) frame_set(i);
+
+    frame_next = first;
+    frames_free = PAGE_COUNT - first;
+    kprintf("Frame allocator: %d free frames\n", frames_free);
+}
+
+//Returns a zeroed frame with one reference, or 0 when memory is exhausted
+uint64_t frame_alloc() {
+    uint64_t flags = spin_lock_irqsave(&frame_lock);
+
+    uint32_t first = FRAME_POOL_START / PAGE_SIZE;
+    uint32_t index = frame_next;
+    bool found = false;
+    for (uint32_t scanned = first; scanned < PAGE_COUNT; scanned++) {
+        if (index >= PAGE_COUNT) index = first;
+        if (!frame_used(index)) {
+            found = true;
+            break;
+        }
+        index++;
+    }
+    if (!found) {
+        spin_unlock_irqrestore(&frame_lock, flags);
+        kprintf("frame_alloc: out of physical memory\n");
+        return 0;
+    }
+
+    frame_set(index);
+    frame_refs[index] = 1;
+    frames_free--;
+    frame_next = index + 1;
+    spin_unlock_irqrestore(&frame_lock, flags);
+
+    uint64_t paddr = (uint64_t)index * PAGE_SIZE;
+    memset((void*)paddr, 0, PAGE_SIZE);
+    return paddr;
+}
+
+void frame_ref(uint64_t paddr) {
+    uint32_t index = paddr / PAGE_SIZE;
+    if (index >= PAGE_COUNT) return;
+
+    uint64_t flags = spin_lock_irqsave(&frame_lock);
+    if (frame_used(index)) frame_refs[index]++;
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+//Drops one reference, the frame is reused once nobody maps it
+void frame_free(uint64_t paddr) {
+    uint32_t index = paddr / PAGE_SIZE;
+    if (index < FRAME_POOL_START / PAGE_SIZE || index >= PAGE_COUNT) return;
+
+    uint64_t flags = spin_lock_irqsave(&frame_lock);
+    if (frame_used(index) && --frame_refs[index] == 0) {
+        frame_clear(index);
+        frames_free++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+uint32_t frame_refcount(uint64_t paddr) {
+    uint32_t index = paddr / PAGE_SIZE;
+    if (index >= PAGE_COUNT) return 0;
+    return frame_refs[index];
+}
+
+uint32_t frame_free_count() {
+    return frames_free;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "../mmap.h"
+
+/*
+ * A mapping is only an area on the list: no frame is allocated until a
+ * page is touched and vma_handle_fault() fills it in. Anonymous reads get
+ * the shared zero page and writes a fresh frame; file pages come from the
+ * page cache, privately copied on write unless the mapping is MAP_SHARED.
+ * Shared memory objects hand out their own frames.
+ */
+static inline uint64_t page_round_up(uint64_t size) {
+    return (size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+static uint64_t prot_to_flags(int prot, int flags) {
+    uint64_t page_flags = PAGE_USER;
+    if (prot & PROT_WRITE) page_flags |= PAGE_WRITABLE;
+    if (flags & MAP_SHARED) page_flags |= PAGE_SHARED;
+    return page_flags;
+}
+
+//Start of the new mapping, 0 on failure. addr is a hint unless MAP_FIXED is set.
+//Without MAP_ANONYMOUS the file is mapped from offset on, and on success the area takes over
+//the caller's reference to it
+uint64_t vm_mmap(uint64_t cr3, VmArea** list, uint64_t addr, uint64_t length, int prot, int flags,
+                 VmFile* file, uint64_t offset) {
+    if (!cr3 || length == 0) return 0;
+    if (!(flags & MAP_ANONYMOUS) && (!file || (offset & (PAGE_SIZE - 1)))) return 0;
+    if ((flags & MAP_ANONYMOUS) && (flags & MAP_SHARED)) {
+        kprintf("vm_mmap: use a shared memory object for shared anonymous memory\n");
+        return 0;
+    }
+    if (file && file->shm && !(flags & MAP_SHARED)) return 0;
+
+    length = page_round_up(length);
+    if (length > MMAP_END - USER_SPACE_START) return 0;
+
+    uint64_t start;
+    if (flags & MAP_FIXED) {
+        if ((addr & (PAGE_SIZE - 1)) || addr < USER_SPACE_START || addr + length > MMAP_END) return 0;
+        //Whatever was mapped there is replaced
+        if (!vma_unmap_range(list, cr3, addr, addr + length)) return 0;
+        start = addr;
+    } else {
+        start = 0;
+        addr &= ~(uint64_t)(PAGE_SIZE - 1);
+        if (addr >= USER_SPACE_START && addr < MMAP_END) start = vma_find_gap(*list, length, addr, MMAP_END);
+        if (!start) start = vma_find_gap(*list, length, MMAP_BASE, MMAP_END);
+        if (!start) start = vma_find_gap(*list, length, USER_SPACE_START, MMAP_END);
+        if (!start) return 0;
+    }
+
+    uint64_t file_size = 0;
+    if (flags & MAP_ANONYMOUS) {
+        file = NULL;
+        offset = 0;
+    } else if (offset < vm_file_size(file)) {
+        file_size = vm_file_size(file) - offset;
+        if (file_size > length) file_size = length;
+    }
+
+    VmArea* vma = vma_create(start, start + length, prot_to_flags(prot, flags), file, offset, file_size);
+    if (!vma) return 0;
+    if (!vma_insert(list, vma)) {
+        kfree(vma);
+        return 0;
+    }
+    return start;
+}
+
+int vm_msync(uint64_t cr3, VmArea* list, uint64_t addr, uint64_t length) {
+    if (!cr3 || (addr & (PAGE_SIZE - 1))) return -1;
+
+    return vma_sync(cr3, list, addr, addr + page_round_up(length)) < 0 ? -1 : 0;
+}
+
+int vm_munmap(uint64_t cr3, VmArea** list, uint64_t addr, uint64_t length) {
+    if (!cr3 || (addr & (PAGE_SIZE - 1)) || length == 0) return -1;
+    if (addr < USER_SPACE_START || addr + length > USER_SPACE_END) return -1;
+
+    return vma_unmap_range(list, cr3, addr, addr + page_round_up(length)) ? 0 : -1;
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "../pagecache.h"
+#include "../paging.h"
+#include "../frame.h"
+#include "../heap.h"
+#include "../../threading/src/spinlock.h"
+
+/*
+ * File pages by (superblock, inode number, page index). The cache holds one
+ * reference on each frame; every process mapping it holds another, so a
+ * page with a refcount of 1 is only cached and can be dropped.
+ */
+static CachedPage* page_cache[PAGE_CACHE_BUCKETS];
+static uint32_t cached_pages = 0;
+static uint32_t evict_hand = 0;
+static spinlock_t page_cache_lock = SPINLOCK_INIT;
+
+static inline uint32_t page_hash(SuperBlock* sb, uint32_t ino, uint64_t index) {
+    uint64_t key = ((uint64_t)sb >> 4) ^ ((uint64_t)ino * 2654435761u) ^ (index * 40503);
+    return (uint32_t)(key ^ (key >> 16)) % PAGE_CACHE_BUCKETS;
+}
+
+static CachedPage* lookup(SuperBlock* sb, uint32_t ino, uint64_t index) {
+    CachedPage* page = page_cache[page_hash(sb, ino, index)];
+    while (page && !(page->sb == sb && page->ino == ino && page->index == index)) page = page->next;
+    return page;
+}
+
+//Drops pages nobody maps until the cache is back under its limit, lock held
+static void evict_unused() {
+    for (uint32_t scanned = 0; scanned < PAGE_CACHE_BUCKETS && cached_pages > PAGE_CACHE_MAX_PAGES; scanned++) {
+        CachedPage** link = &page_cache[evict_hand];
+        evict_hand = (evict_hand + 1) % PAGE_CACHE_BUCKETS;
+
+        while (*link) {
+            CachedPage* page = *link;
+            if (frame_refcount(page->frame) > 1) {
+                link = &page->next;
+                continue;
+            }
+            *link = page->next;
+            frame_free(page->frame);
+            kfree(page);
+            cached_pages--;
+        }
+    }
+}
+
+//Returns the frame holding that page of the file with a reference for the caller, 0 on failure
+uint64_t page_cache_get(Inode* inode, uint64_t index) {
+    uint64_t flags = spin_lock_irqsave(&page_cache_lock);
+    CachedPage* page = lookup(inode->sb, inode->ino, index);
+    if (page) {
+        frame_ref(page->frame);
+        uint64_t frame = page->frame;
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        return frame;
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+
+    //Miss: read without the lock held, the disk may sleep
+    uint64_t frame = frame_alloc();
+    if (!frame) return 0;
+
+    uint64_t offset = index * PAGE_SIZE;
+    if (offset < inode->size) {
+        uint64_t size = inode->size - offset;
+        if (size > PAGE_SIZE) size = PAGE_SIZE;
+        if (inode->ops->read(inode, offset, (void*)frame, size) != (int)size) {
+            frame_free(frame);
+            return 0;
+        }
+    }
+
+    CachedPage* entry = kmalloc(sizeof(CachedPage));
+    if (!entry) return frame;   //still usable, just not cached
+
+    flags = spin_lock_irqsave(&page_cache_lock);
+    page = lookup(inode->sb, inode->ino, index);
+    if (page) {
+        //Someone else read it meanwhile, use theirs
+        frame_ref(page->frame);
+        uint64_t cached = page->frame;
+        spin_unlock_irqrestore(&page_cache_lock, flags);
+        frame_free(frame);
+        kfree(entry);
+        return cached;
+    }
+
+    entry->sb = inode->sb;
+    entry->ino = inode->ino;
+    entry->index = index;
+    entry->frame = frame;
+    uint32_t bucket = page_hash(inode->sb, inode->ino, index);
+    entry->next = page_cache[bucket];
+    page_cache[bucket] = entry;
+    cached_pages++;
+
+    frame_ref(frame);
+    evict_unused();
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+    return frame;
+}
+
+//Like inode->ops->read, but served from cached pages
+int page_cache_read(Inode* inode, uint64_t offset, void* buffer, uint64_t size) {
+    if (offset >= inode->size) return 0;
+    if (offset + size > inode->size) size = inode->size - offset;
+
+    uint8_t* to = (uint8_t*)buffer;
+    uint64_t done = 0;
+    while (done < size) {
+        uint64_t in_page = (offset + done) & (PAGE_SIZE - 1);
+        uint64_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) chunk = size - done;
+
+        uint64_t frame = page_cache_get(inode, (offset + done) / PAGE_SIZE);
+        if (!frame) return done ? (int)done : -1;
+        memcpy(to + done, (void*)(frame + in_page), chunk);
+        frame_free(frame);
+
+        done += chunk;
+    }
+    return (int)done;
+}
+
+//Copies data just written to the file into the pages already cached, so shared mappings see it.
+//Writeback of a mapped page passes the cached frame itself as the buffer
+void page_cache_update(Inode* inode, uint64_t offset, const void* buffer, uint64_t size) {
+    if (!inode || size == 0) return;
+
+    const uint8_t* from = (const uint8_t*)buffer;
+    uint64_t flags = spin_lock_irqsave(&page_cache_lock);
+    for (uint64_t index = offset / PAGE_SIZE; index * PAGE_SIZE < offset + size; index++) {
+        CachedPage* page = lookup(inode->sb, inode->ino, index);
+        if (!page) continue;
+
+        uint64_t start = index * PAGE_SIZE > offset ? index * PAGE_SIZE : offset;
+        uint64_t end = (index + 1) * PAGE_SIZE < offset + size ? (index + 1) * PAGE_SIZE : offset + size;
+        uint8_t* to = (uint8_t*)page->frame + (start - index * PAGE_SIZE);
+        if (to != from + (start - offset)) memcpy(to, from + (start - offset), end - start);
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
+
+//The file was cut short or deleted: later lookups read it again, existing mappings keep their old frames
+void page_cache_invalidate(Inode* inode) {
+    if (!inode) return;
+
+    uint64_t flags = spin_lock_irqsave(&page_cache_lock);
+    for (uint32_t bucket = 0; bucket < PAGE_CACHE_BUCKETS; bucket++) {
+        CachedPage** link = &page_cache[bucket];
+        while (*link) {
+            CachedPage* page = *link;
+            if (page->sb != inode->sb || page->ino != inode->ino) {
+                link = &page->next;
+                continue;
+            }
+            *link = page->next;
+            frame_free(page->frame);
+            kfree(page);
+            cached_pages--;
+        }
+    }
+    spin_unlock_irqrestore(&page_cache_lock, flags);
+}
\ No newline at end of file
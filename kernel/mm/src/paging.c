@@ -1,4 +1,8 @@
 #include "../paging.h"
+#include "../frame.h"
+
+static uint64_t kernel_cr3 = 0;
+static uint64_t zero_frame = 0;
 
 static uint64_t get_cr3() {
     uint64_t cr3;
@@ -25,129 +29,370 @@ static void get_page_indices(uint64_t vaddr,
     *pt_index = (vaddr >> 12) & 0x1FF;
 }
 
-bool map_page(uint64_t vaddr, uint64_t paddr, uint64_t flags) {
-    uint16_t pml4_index, pdpt_index, pd_index, pt_index;
-    get_page_indices(vaddr, &pml4_index, &pdpt_index, &pd_index, &pt_index);
-    
-    uint64_t cr3 = get_cr3() & ~0xFFF;
-    page_entry_t* pml4_table = (page_entry_t*)cr3;
-    
-    if (!(pml4_table[pml4_index] & PAGE_PRESENT)) {
-        void* pdpt_addr = kmalloc(4096);
-        uint64_t pdpt_paddr = (uint64_t)pdpt_addr;
-        memset(pdpt_addr, 0, 4096);
-        
-        pml4_table[pml4_index] = pdpt_paddr | PAGE_PRESENT | PAGE_WRITABLE | flags;
-    }
-    
-    page_entry_t* pdpt_table = (page_entry_t*)((pml4_table[pml4_index] & ~0xFFF));
-    
-    if (!(pdpt_table[pdpt_index] & PAGE_PRESENT)) {
-        void* pd_addr = kmalloc(4096);
-        uint64_t pd_paddr = (uint64_t)pd_addr;
-        memset(pd_addr, 0, 4096);
-        
-        pdpt_table[pdpt_index] = pd_paddr | PAGE_PRESENT | PAGE_WRITABLE | flags;
-    }
-    
-    page_entry_t* pd_table = (page_entry_t*)((pdpt_table[pdpt_index] & ~0xFFF));
-    
-    if (!(pd_table[pd_index] & PAGE_PRESENT)) {
-        void* pt_addr = kmalloc(4096);
-        uint64_t pt_paddr = (uint64_t)pt_addr;
-        memset(pt_addr, 0, 4096);
-        
-        pd_table[pd_index] = pt_paddr | PAGE_PRESENT | PAGE_WRITABLE | flags;
+static inline bool is_current(uint64_t cr3) {
+    return (get_cr3() & PAGE_ADDR_MASK) == (cr3 & PAGE_ADDR_MASK);
+}
+
+// Returns the page table entry for vaddr, building missing tables when create is set
+static page_entry_t* walk(uint64_t cr3, uint64_t vaddr, bool create, uint64_t flags) {
+    uint16_t index[4];
+    get_page_indices(vaddr, &index[0], &index[1], &index[2], &index[3]);
+
+    page_entry_t* table = (page_entry_t*)(cr3 & PAGE_ADDR_MASK);
+    for (int level = 0; level < 3; level++) {
+        page_entry_t* entry = &table[index[level]];
+
+        if (!(*entry & PAGE_PRESENT)) {
+            if (!create) return NULL;
+            uint64_t frame = frame_alloc();
+            if (!frame) return NULL;
+            *entry = frame | PAGE_PRESENT | PAGE_WRITABLE;
+        } else if (*entry & PAGE_HUGE) {
+            return NULL;
+        }
+        *entry |= flags & PAGE_USER;
+        table = (page_entry_t*)(*entry & PAGE_ADDR_MASK);
     }
-    
-    page_entry_t* pt_table = (page_entry_t*)((pd_table[pd_index] & ~0xFFF));
-    
-    pt_table[pt_index] = (paddr & ~0xFFF) | flags;
+    return &table[index[3]];
+}
+
+bool map_page(uint64_t vaddr, uint64_t paddr, uint64_t flags) {
+    page_entry_t* entry = walk(get_cr3(), vaddr, true, flags);
+    if (!entry) return false;
+
+    *entry = (paddr & PAGE_ADDR_MASK) | flags;
     
     invlpg((void*)vaddr);    
     return true;
 }
 
 void unmap_page(uint64_t vaddr) {
-    uint16_t pml4_index, pdpt_index, pd_index, pt_index;
-    get_page_indices(vaddr, &pml4_index, &pdpt_index, &pd_index, &pt_index);
-    
-    uint64_t cr3 = get_cr3() & ~0xFFF;
-    page_entry_t* pml4_table = (page_entry_t*)cr3;
-    
-    if (!(pml4_table[pml4_index] & PAGE_PRESENT)) {
-        return;
-    }
-    
-    page_entry_t* pdpt_table = (page_entry_t*)((pml4_table[pml4_index] & ~0xFFF));
-    
-    if (!(pdpt_table[pdpt_index] & PAGE_PRESENT)) {
-        return;
-    }
-    
-    page_entry_t* pd_table = (page_entry_t*)((pdpt_table[pdpt_index] & ~0xFFF));
-    
-    if (!(pd_table[pd_index] & PAGE_PRESENT)) {
-        return;
-    }
-    
-    page_entry_t* pt_table = (page_entry_t*)((pd_table[pd_index] & ~0xFFF));
-    
-    pt_table[pt_index] = 0;
+    page_entry_t* entry = walk(get_cr3(), vaddr, false, 0);
+    if (!entry) return;
+
+    *entry = 0;
     
     invlpg((void*)vaddr);
 }
 
+// Kernel mappings are shared by every address space, so this is visible everywhere
+void* map_mmio(uint64_t paddr, uint64_t size) {
+    if (paddr + size <= MEMORY_SIZE) return (void*)paddr;
+
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_CACHE_DISABLE | PAGE_WRITETHROUGH;
+    for (uint64_t page = paddr & PAGE_ADDR_MASK; page < paddr + size; page += PAGE_SIZE) {
+        if (!map_page(page, page, flags)) return NULL;
+    }
+    return (void*)paddr;
+}
+
 uint64_t get_physical_address(uint64_t vaddr) {
     uint16_t pml4_index, pdpt_index, pd_index, pt_index;
     get_page_indices(vaddr, &pml4_index, &pdpt_index, &pd_index, &pt_index);
     
-    uint64_t cr3 = get_cr3() & ~0xFFF;
+    uint64_t cr3 = get_cr3() & PAGE_ADDR_MASK;
     page_entry_t* pml4_table = (page_entry_t*)cr3;
     
     if (!(pml4_table[pml4_index] & PAGE_PRESENT)) {
         return 0;
     }
     
-    page_entry_t* pdpt_table = (page_entry_t*)((pml4_table[pml4_index] & ~0xFFF));
+    page_entry_t* pdpt_table = (page_entry_t*)((pml4_table[pml4_index] & PAGE_ADDR_MASK));
     
     if (!(pdpt_table[pdpt_index] & PAGE_PRESENT)) {
         return 0;
     }
     
-    page_entry_t* pd_table = (page_entry_t*)((pdpt_table[pdpt_index] & ~0xFFF));
+    page_entry_t* pd_table = (page_entry_t*)((pdpt_table[pdpt_index] & PAGE_ADDR_MASK));
     
     if (!(pd_table[pd_index] & PAGE_PRESENT)) {
         return 0;
     }
     
     if (pd_table[pd_index] & PAGE_HUGE) {
-        return (pd_table[pd_index] & ~0x1FFFFF) + (vaddr & 0x1FFFFF);
+        return (pd_table[pd_index] & ~0x1FFFFFULL & PAGE_ADDR_MASK) + (vaddr & 0x1FFFFF);
     }
     
-    page_entry_t* pt_table = (page_entry_t*)((pd_table[pd_index] & ~0xFFF));
+    page_entry_t* pt_table = (page_entry_t*)((pd_table[pd_index] & PAGE_ADDR_MASK));
     
     if (!(pt_table[pt_index] & PAGE_PRESENT)) {
         return 0;
     }
     
-    return (pt_table[pt_index] & ~0xFFF) + (vaddr & 0xFFF);
+    return (pt_table[pt_index] & PAGE_ADDR_MASK) + (vaddr & 0xFFF);
+}
+
+uint64_t paging_kernel_cr3() {
+    return kernel_cr3;
+}
+
+// Shared read-only page of zeros, it keeps its own reference so it is never freed
+uint64_t paging_zero_frame() {
+    return zero_frame;
+}
+
+// New address space with the kernel mappings and an empty user half
+uint64_t address_space_create() {
+    uint64_t cr3 = frame_alloc();
+    if (!cr3) return 0;
+
+    page_entry_t* pml4 = (page_entry_t*)cr3;
+    page_entry_t* kernel_pml4 = (page_entry_t*)kernel_cr3;
+    for (int i = 0; i < 512; i++) {
+        if (i != USER_PML4_INDEX) pml4[i] = kernel_pml4[i];
+    }
+    return cr3;
+}
+
+static inline bool in_user_stack(uint64_t vaddr) {
+    return vaddr >= USER_STACK_TOP - USER_STACK_SIZE && vaddr < USER_STACK_TOP;
+}
+
+// level 3 = PDPT, 2 = PD, 1 = PT
+static bool clone_table(page_entry_t* src, page_entry_t* dst, int level, uint64_t base) {
+    uint64_t span = 1ULL << (12 + 9 * (level - 1));
+
+    for (int i = 0; i < 512; i++) {
+        page_entry_t entry = src[i];
+        if (!(entry & PAGE_PRESENT)) continue;
+        uint64_t vaddr = base + i * span;
+
+        if (level > 1) {
+            uint64_t table = frame_alloc();
+            if (!table) return false;
+            dst[i] = table | (entry & PAGE_FLAGS_MASK);
+            if (!clone_table((page_entry_t*)(entry & PAGE_ADDR_MASK), (page_entry_t*)table, level - 1, vaddr)) {
+                return false;
+            }
+            continue;
+        }
+
+        uint64_t paddr = entry & PAGE_ADDR_MASK;
+        if (in_user_stack(vaddr)) {
+            // Faults are delivered on this stack, so it can never be read-only: copy it now
+            uint64_t copy = frame_alloc();
+            if (!copy) return false;
+            memcpy((void*)copy, (void*)paddr, PAGE_SIZE);
+            dst[i] = copy | (entry & PAGE_FLAGS_MASK);
+            continue;
+        }
+
+        if ((entry & (PAGE_WRITABLE | PAGE_COW)) && !(entry & PAGE_SHARED)) {
+            entry = (entry & ~PAGE_WRITABLE) | PAGE_COW;
+            src[i] = entry;
+        }
+        frame_ref(paddr);
+        dst[i] = entry;
+    }
+    return true;
+}
+
+// Copy-on-write duplicate: page tables are copied, the pages themselves are shared read-only
+uint64_t address_space_clone(uint64_t cr3) {
+    page_entry_t* src = (page_entry_t*)(cr3 & PAGE_ADDR_MASK);
+    uint64_t child = address_space_create();
+    if (!child) return 0;
+
+    page_entry_t entry = src[USER_PML4_INDEX];
+    if (!(entry & PAGE_PRESENT)) return child;
+
+    uint64_t table = frame_alloc();
+    if (!table) {
+        address_space_destroy(child);
+        return 0;
+    }
+    ((page_entry_t*)child)[USER_PML4_INDEX] = table | (entry & PAGE_FLAGS_MASK);
+
+    bool ok = clone_table((page_entry_t*)(entry & PAGE_ADDR_MASK), (page_entry_t*)table, 3, USER_SPACE_START);
+
+    // Writable parent pages just became read-only
+    if (is_current(cr3)) set_cr3(get_cr3());
+
+    if (!ok) {
+        address_space_destroy(child);
+        return 0;
+    }
+    return child;
+}
+
+static void free_table(page_entry_t* table, int level) {
+    for (int i = 0; i < 512; i++) {
+        page_entry_t entry = table[i];
+        if (!(entry & PAGE_PRESENT)) continue;
+
+        if (level > 1) free_table((page_entry_t*)(entry & PAGE_ADDR_MASK), level - 1);
+        frame_free(entry & PAGE_ADDR_MASK);
+    }
+}
+
+void address_space_destroy(uint64_t cr3) {
+    cr3 &= PAGE_ADDR_MASK;
+    if (!cr3 || cr3 == kernel_cr3) return;
+
+    if (is_current(cr3)) set_cr3(kernel_cr3);
+
+    page_entry_t entry = ((page_entry_t*)cr3)[USER_PML4_INDEX];
+    if (entry & PAGE_PRESENT) {
+        free_table((page_entry_t*)(entry & PAGE_ADDR_MASK), 3);
+        frame_free(entry & PAGE_ADDR_MASK);
+    }
+    frame_free(cr3);
+}
+
+bool address_space_map(uint64_t cr3, uint64_t vaddr, uint64_t paddr, uint64_t flags) {
+    page_entry_t* entry = walk(cr3, vaddr, true, flags);
+    if (!entry) return false;
+
+    *entry = (paddr & PAGE_ADDR_MASK) | flags;
+    if (is_current(cr3)) invlpg((void*)vaddr);
+    return true;
+}
+
+// Backs [vaddr, vaddr + size) with fresh zeroed frames, pages already mapped are kept
+bool address_space_alloc(uint64_t cr3, uint64_t vaddr, uint64_t size, uint64_t flags) {
+    uint64_t end = (vaddr + size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    for (uint64_t page = vaddr & ~(uint64_t)(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        page_entry_t* entry = walk(cr3, page, true, flags);
+        if (!entry) return false;
+        if (*entry & PAGE_PRESENT) continue;
+
+        uint64_t frame = frame_alloc();
+        if (!frame) return false;
+        *entry = frame | flags | PAGE_PRESENT;
+        if (is_current(cr3)) invlpg((void*)page);
+    }
+    return true;
+}
+
+// Copies into another address space through the identity mapping of its frames
+bool address_space_write(uint64_t cr3, uint64_t vaddr, const void* src, uint64_t size) {
+    const uint8_t* from = (const uint8_t*)src;
+
+    while (size > 0) {
+        page_entry_t* entry = walk(cr3, vaddr, false, 0);
+        if (!entry || !(*entry & PAGE_PRESENT)) return false;
+
+        uint64_t offset = vaddr & (PAGE_SIZE - 1);
+        uint64_t chunk = PAGE_SIZE - offset;
+        if (chunk > size) chunk = size;
+
+        memcpy((void*)((*entry & PAGE_ADDR_MASK) + offset), from, chunk);
+        from += chunk;
+        vaddr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Drops every page in [vaddr, vaddr + size), the page tables themselves stay
+void address_space_unmap(uint64_t cr3, uint64_t vaddr, uint64_t size) {
+    uint64_t end = vaddr + size;
+
+    for (uint64_t page = vaddr & ~(uint64_t)(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        page_entry_t* entry = walk(cr3, page, false, 0);
+        if (!entry || !(*entry & PAGE_PRESENT)) continue;
+
+        frame_free(*entry & PAGE_ADDR_MASK);
+        *entry = 0;
+        if (is_current(cr3)) invlpg((void*)page);
+    }
+}
+
+// Takes a reference on the frame behind a user page and makes it copy-on-write,
+// so the caller sees the contents as of now whatever the owner writes later. 0 if unmapped or MAP_SHARED
+uint64_t address_space_share(uint64_t cr3, uint64_t vaddr) {
+    if (vaddr < USER_SPACE_START || vaddr >= USER_SPACE_END || in_user_stack(vaddr)) return 0;
+
+    page_entry_t* entry = walk(cr3, vaddr, false, 0);
+    if (!entry || !(*entry & PAGE_PRESENT) || (*entry & PAGE_SHARED)) return 0;
+
+    if (*entry & PAGE_WRITABLE) {
+        *entry = (*entry & ~PAGE_WRITABLE) | PAGE_COW;
+        if (is_current(cr3)) invlpg((void*)vaddr);
+    }
+
+    uint64_t paddr = *entry & PAGE_ADDR_MASK;
+    frame_ref(paddr);
+    return paddr;
+}
+
+// Puts a frame from address_space_share() at vaddr in place of whatever was there.
+// The mapping takes over the caller's reference
+bool address_space_replace(uint64_t cr3, uint64_t vaddr, uint64_t paddr) {
+    if (vaddr < USER_SPACE_START || vaddr >= USER_SPACE_END || in_user_stack(vaddr)) return false;
+
+    page_entry_t* entry = walk(cr3, vaddr, false, 0);
+    if (!entry || !(*entry & PAGE_PRESENT) || !(*entry & (PAGE_WRITABLE | PAGE_COW))) return false;
+    if (*entry & PAGE_SHARED) return false;
+
+    uint64_t old = *entry & PAGE_ADDR_MASK;
+    uint64_t flags = (*entry & PAGE_FLAGS_MASK) & ~(PAGE_WRITABLE | PAGE_COW);
+    flags |= frame_refcount(paddr) > 1 ? PAGE_COW : PAGE_WRITABLE;
+
+    *entry = paddr | flags;
+    if (is_current(cr3)) invlpg((void*)vaddr);
+    frame_free(old);
+    return true;
+}
+
+// Frame behind vaddr if it was written since the last call, clearing the dirty bit; 0 otherwise
+uint64_t address_space_clean(uint64_t cr3, uint64_t vaddr) {
+    page_entry_t* entry = walk(cr3, vaddr, false, 0);
+    if (!entry || (*entry & (PAGE_PRESENT | PAGE_DIRTY)) != (PAGE_PRESENT | PAGE_DIRTY)) return 0;
+
+    *entry &= ~PAGE_DIRTY;
+    if (is_current(cr3)) invlpg((void*)vaddr);
+    return *entry & PAGE_ADDR_MASK;
+}
+
+bool paging_handle_fault(uint64_t vaddr, uint64_t error_code) {
+    // Only writes to present pages can be copy-on-write
+    if ((error_code & 3) != 3) return false;
+
+    page_entry_t* entry = walk(get_cr3(), vaddr, false, 0);
+    if (!entry || !(*entry & PAGE_COW)) return false;
+
+    uint64_t paddr = *entry & PAGE_ADDR_MASK;
+    uint64_t flags = ((*entry & PAGE_FLAGS_MASK) & ~PAGE_COW) | PAGE_WRITABLE;
+
+    if (frame_refcount(paddr) > 1) {
+        uint64_t copy = frame_alloc();
+        if (!copy) return false;
+        memcpy((void*)copy, (void*)paddr, PAGE_SIZE);
+        *entry = copy | flags;
+        frame_free(paddr);
+    } else {
+        // Every other sharer has already taken its own copy
+        *entry = paddr | flags;
+    }
+
+    invlpg((void*)vaddr);
+    return true;
 }
 
 void paging_init() {
     kprintf("Initializing paging...\n");
     
-    uint64_t cr3 = get_cr3();
-    kprintf("CR3 = %x\n", cr3);
+    kernel_cr3 = get_cr3() & PAGE_ADDR_MASK;
+    kprintf("CR3 = %x\n", kernel_cr3);
     
-    for (uint64_t addr = HEAP_START; addr < HEAP_START + HEAP_SIZE; addr += 4096) {
-        map_page(addr, addr, PAGE_PRESENT | PAGE_WRITABLE);
+    // The loader only maps the first 2MB, identity map the rest of memory with 2MB pages
+    page_entry_t* pml4_table = (page_entry_t*)kernel_cr3;
+    page_entry_t* pdpt_table = (page_entry_t*)(pml4_table[0] & PAGE_ADDR_MASK);
+    page_entry_t* pd_table = (page_entry_t*)(pdpt_table[0] & PAGE_ADDR_MASK);
+    for (uint64_t addr = HUGE_PAGE_SIZE; addr < MEMORY_SIZE; addr += HUGE_PAGE_SIZE) {
+        pd_table[addr / HUGE_PAGE_SIZE] = addr | PAGE_PRESENT | PAGE_WRITABLE | PAGE_HUGE;
     }
+    set_cr3(kernel_cr3);
     
-    uint64_t fs_memory_start = 0x1000000; // 16 MB
-    for (uint64_t addr = fs_memory_start; addr < fs_memory_start + 0x400000; addr += 4096) {
-        map_page(addr, addr, PAGE_PRESENT | PAGE_WRITABLE);
-    }
+    // Enforce read-only pages in ring 0 as well, copy-on-write relies on it
+    uint64_t cr0;
+    __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+    __asm__ volatile("mov %0, %%cr0" : : "r" (cr0 | (1ULL << 16)));
+    
+    frame_init();
+    zero_frame = frame_alloc();
     
-    kprintf("Paging initialized with filesystem memory region mapped\n");
+    kprintf("Paging initialized with %d MB identity mapped\n", MEMORY_SIZE / 0x100000);
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "../shm.h"
+#include "../frame.h"
+#include "../heap.h"
+#include "../../threading/src/spinlock.h"
+
+static ShmObject* shm_objects = NULL;
+static spinlock_t shm_lock = SPINLOCK_INIT;
+
+static ShmObject* find_object(const char* name) {
+    for (ShmObject* shm = shm_objects; shm; shm = shm->next) {
+        if (strcmp(shm->name, name) == 0) return shm;
+    }
+    return NULL;
+}
+
+static void unlink_object(ShmObject* shm) {
+    ShmObject** link = &shm_objects;
+    while (*link && *link != shm) link = &(*link)->next;
+    if (*link) *link = shm->next;
+    shm->linked = false;
+}
+
+static ShmObject* create_object(const char* name, uint64_t size) {
+    uint64_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    ShmObject* shm = kmalloc(sizeof(ShmObject));
+    uint64_t* frames = kmalloc(pages * sizeof(uint64_t));
+    if (!shm || !frames) {
+        if (shm) kfree(shm);
+        if (frames) kfree(frames);
+        return NULL;
+    }
+
+    memset(shm, 0, sizeof(ShmObject));
+    memset(frames, 0, pages * sizeof(uint64_t));
+    strncpy(shm->name, name, SHM_NAME_LEN - 1);
+    shm->size = pages * PAGE_SIZE;
+    shm->frames = frames;
+    shm->refs = 2;              //the name and the caller
+    shm->linked = true;
+    return shm;
+}
+
+//Opens the object with that name, creating it with size bytes if create is set. Returns a reference
+ShmObject* shm_open_object(const char* name, bool create, uint64_t size) {
+    if (!name || !name[0] || strlen(name) >= SHM_NAME_LEN) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&shm_lock);
+    ShmObject* shm = find_object(name);
+    if (shm) {
+        shm->refs++;
+        spin_unlock_irqrestore(&shm_lock, flags);
+        return shm;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    if (!create || size == 0 || size > SHM_MAX_SIZE) return NULL;
+
+    ShmObject* created = create_object(name, size);
+    if (!created) return NULL;
+
+    flags = spin_lock_irqsave(&shm_lock);
+    shm = find_object(name);
+    if (shm) {
+        //Created by someone else in the meantime
+        shm->refs++;
+    } else {
+        created->next = shm_objects;
+        shm_objects = created;
+    }
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    if (shm) {
+        kfree(created->frames);
+        kfree(created);
+        return shm;
+    }
+    return created;
+}
+
+//Drops the name; processes that have the object open or mapped keep it
+int shm_unlink_object(const char* name) {
+    if (!name) return -1;
+
+    uint64_t flags = spin_lock_irqsave(&shm_lock);
+    ShmObject* shm = find_object(name);
+    if (shm) unlink_object(shm);
+    spin_unlock_irqrestore(&shm_lock, flags);
+
+    if (!shm) return -1;
+    shm_put(shm);
+    return 0;
+}
+
+void shm_get(ShmObject* shm) {
+    uint64_t flags = spin_lock_irqsave(&shm_lock);
+    shm->refs++;
+    spin_unlock_irqrestore(&shm_lock, flags);
+}
+
+//The name holds a reference too, so an object is only freed once it is unlinked
+void shm_put(ShmObject* shm) {
+    if (!shm) return;
+
+    uint64_t flags = spin_lock_irqsave(&shm_lock);
+    bool last = --shm->refs == 0;
+    spin_unlock_irqrestore(&shm_lock, flags);
+    if (!last) return;
+
+    for (uint64_t i = 0; i < shm->size / PAGE_SIZE; i++) {
+        if (shm->frames[i]) frame_free(shm->frames[i]);
+    }
+    kfree(shm->frames);
+    kfree(shm);
+}
+
+//Frame for page index with a reference for the caller, allocated zeroed on first use. 0 past the end
+uint64_t shm_get_frame(ShmObject* shm, uint64_t index) {
+    if (index >= shm->size / PAGE_SIZE) return 0;
+
+    uint64_t flags = spin_lock_irqsave(&shm_lock);
+    uint64_t frame = shm->frames[index];
+    if (!frame) {
+        frame = frame_alloc();
+        if (frame) memset((void*)frame, 0, PAGE_SIZE);
+        shm->frames[index] = frame;
+    }
+    if (frame) frame_ref(frame);
+    spin_unlock_irqrestore(&shm_lock, flags);
+    return frame;
+}
\ No newline at end of file
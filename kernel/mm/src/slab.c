@@ -0,0 +1,118 @@
+#include "../slab.h"
+#include "../frame.h"
+#include "../heap.h"
+
+/*
+ * Fixed-size objects carved out of whole frames. Freed objects go back on
+ * their slab's free list, so the next allocation of the same type reuses
+ * the slot without touching the heap.
+ */
+SlabCache* slab_cache_create(const char* name, uint32_t object_size) {
+    object_size = ALIGN(object_size < sizeof(void*) ? sizeof(void*) : object_size);
+    uint32_t header = ALIGN(sizeof(Slab));
+    if (object_size > PAGE_SIZE - header) {
+        kprintf("slab_cache_create: %s objects do not fit in a page\n", name);
+        return NULL;
+    }
+
+    SlabCache* cache = kmalloc(sizeof(SlabCache));
+    if (!cache) return NULL;
+
+    memset(cache, 0, sizeof(SlabCache));
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->per_slab = (PAGE_SIZE - header) / object_size;
+    cache->lock = SPINLOCK_INIT;
+    return cache;
+}
+
+static void list_remove(Slab** list, Slab* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void list_push(Slab** list, Slab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static Slab* new_slab(SlabCache* cache) {
+    uint64_t frame = frame_alloc();
+    if (!frame) return NULL;
+
+    Slab* slab = (Slab*)frame;
+    uint8_t* object = (uint8_t*)frame + ALIGN(sizeof(Slab));
+    slab->free = NULL;
+    for (int i = cache->per_slab - 1; i >= 0; i--) {
+        void** entry = (void**)(object + i * cache->object_size);
+        *entry = slab->free;
+        slab->free = entry;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+//Zeroed object, NULL when out of memory
+void* slab_alloc(SlabCache* cache) {
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    Slab* slab = cache->partial;
+    if (!slab && cache->empty) {
+        slab = cache->empty;
+        cache->empty = NULL;
+        list_push(&cache->partial, slab);
+    }
+    if (!slab) {
+        //frame_alloc never sleeps, so this is fine under the lock
+        slab = new_slab(cache);
+        if (!slab) {
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return NULL;
+        }
+        list_push(&cache->partial, slab);
+    }
+
+    void** object = (void**)slab->free;
+    slab->free = *object;
+    slab->in_use++;
+    cache->objects++;
+    if (!slab->free) {
+        list_remove(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    memset(object, 0, cache->object_size);
+    return object;
+}
+
+void slab_free(SlabCache* cache, void* object) {
+    if (!object) return;
+
+    Slab* slab = (Slab*)((uint64_t)object & ~(uint64_t)(PAGE_SIZE - 1));
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (!slab->free) {
+        list_remove(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+    *(void**)object = slab->free;
+    slab->free = object;
+    slab->in_use--;
+    cache->objects--;
+
+    if (slab->in_use == 0) {
+        list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            frame_free((uint64_t)slab);
+            cache->slabs--;
+        } else {
+            cache->empty = slab;
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
\ No newline at end of file
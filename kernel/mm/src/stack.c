@@ -1,2 +1,12 @@
 #include "../stack.h"
+#include "../heap.h"
 
+void* stack_alloc() {
+    void* stack = kmalloc(S_STACK_SIZE);
+    if (stack) memset(stack, 0, S_STACK_SIZE);
+    return stack;
+}
+
+void stack_free(void* stack) {
+    kfree(stack);
+}
@@ -0,0 +1,296 @@
+#include "../vma.h"
+#include "../paging.h"
+#include "../frame.h"
+#include "../heap.h"
+#include "../pagecache.h"
+#include "../shm.h"
+
+VmFile* vm_file_create(Inode* inode) {
+    VmFile* file = kmalloc(sizeof(VmFile));
+    if (!file) return NULL;
+
+    file->inode = inode;
+    file->shm = NULL;
+    file->refs = 1;
+    return file;
+}
+
+//Takes over the caller's reference to shm
+VmFile* vm_file_create_shm(ShmObject* shm) {
+    VmFile* file = vm_file_create(NULL);
+    if (file) file->shm = shm;
+    return file;
+}
+
+uint64_t vm_file_size(VmFile* file) {
+    return file->shm ? file->shm->size : file->inode->size;
+}
+
+void vm_file_get(VmFile* file) {
+    if (file) file->refs++;
+}
+
+void vm_file_put(VmFile* file) {
+    if (!file || --file->refs > 0) return;
+    if (file->inode) kfree(file->inode);
+    if (file->shm) shm_put(file->shm);
+    kfree(file);
+}
+
+//Takes over the caller's reference to file
+VmArea* vma_create(uint64_t start, uint64_t end, uint64_t page_flags,
+                   VmFile* file, uint64_t file_offset, uint64_t file_size) {
+    VmArea* vma = kmalloc(sizeof(VmArea));
+    if (!vma) return NULL;
+
+    vma->start = start;
+    vma->end = end;
+    vma->page_flags = page_flags;
+    vma->file = file;
+    vma->file_offset = file_offset;
+    vma->file_size = file_size;
+    vma->next = NULL;
+    return vma;
+}
+
+//Keeps the list sorted by address, fails if the area overlaps an existing one
+bool vma_insert(VmArea** list, VmArea* vma) {
+    VmArea* prev = NULL;
+    VmArea* next = *list;
+    while (next && next->start < vma->start) {
+        prev = next;
+        next = next->next;
+    }
+
+    if (prev && prev->end > vma->start) return false;
+    if (next && next->start < vma->end) return false;
+
+    vma->next = next;
+    if (prev) prev->next = vma;
+    else *list = vma;
+    return true;
+}
+
+VmArea* vma_find(VmArea* list, uint64_t vaddr) {
+    for (VmArea* vma = list; vma && vma->start <= vaddr; vma = vma->next) {
+        if (vaddr < vma->end) return vma;
+    }
+    return NULL;
+}
+
+//Lowest address in [from, to) with size free bytes after it, 0 if there is none
+uint64_t vma_find_gap(VmArea* list, uint64_t size, uint64_t from, uint64_t to) {
+    uint64_t addr = from;
+    for (VmArea* vma = list; vma; vma = vma->next) {
+        if (vma->end <= addr) continue;
+        if (vma->start >= addr + size) break;
+        addr = vma->end;
+    }
+    return addr + size <= to ? addr : 0;
+}
+
+//Bytes of the file behind the part of vma that starts at addr
+static uint64_t file_bytes_from(VmArea* vma, uint64_t addr) {
+    uint64_t skip = addr - vma->start;
+    return vma->file_size > skip ? vma->file_size - skip : 0;
+}
+
+//Writes pages of a shared file mapping that were stored to since the last sync back to the file
+static int writeback(uint64_t cr3, VmArea* vma, uint64_t from, uint64_t to) {
+    if (!vma->file || !vma->file->inode || !(vma->page_flags & PAGE_SHARED)) return 0;
+
+    Inode* inode = vma->file->inode;
+    int written = 0;
+    for (uint64_t page = from; page < to; page += PAGE_SIZE) {
+        uint64_t frame = address_space_clean(cr3, page);
+        if (!frame) continue;
+
+        //Only what lies inside the file goes back, a mapping cannot extend it
+        uint64_t offset = vma->file_offset + (page - vma->start);
+        if (offset >= inode->size) continue;
+        uint64_t size = inode->size - offset;
+        if (size > PAGE_SIZE) size = PAGE_SIZE;
+
+        if (inode->ops->write(inode, offset, (void*)frame, size) != (int)size) {
+            kprintf("vma_sync: write back failed at offset %d\n", (uint32_t)offset);
+            return -1;
+        }
+        written++;
+    }
+    return written;
+}
+
+//msync: flushes dirty shared file pages in [start, end), returns how many pages were written or -1
+int vma_sync(uint64_t cr3, VmArea* list, uint64_t start, uint64_t end) {
+    int total = 0;
+    for (VmArea* vma = list; vma && vma->start < end; vma = vma->next) {
+        if (vma->end <= start) continue;
+
+        uint64_t from = vma->start > start ? vma->start : start;
+        uint64_t to = vma->end < end ? vma->end : end;
+        int written = writeback(cr3, vma, from, to);
+        if (written < 0) return -1;
+        total += written;
+    }
+    return total;
+}
+
+//Takes [start, end) out of every area it touches and frees the pages behind it,
+//writing dirty shared file pages back first. An area that straddles the range is split in two
+bool vma_unmap_range(VmArea** list, uint64_t cr3, uint64_t start, uint64_t end) {
+    VmArea** link = list;
+
+    while (*link && (*link)->start < end) {
+        VmArea* vma = *link;
+        if (vma->end <= start) {
+            link = &vma->next;
+            continue;
+        }
+
+        uint64_t from = vma->start > start ? vma->start : start;
+        uint64_t to = vma->end < end ? vma->end : end;
+
+        if (from > vma->start && to < vma->end) {
+            VmArea* tail = vma_create(to, vma->end, vma->page_flags, vma->file,
+                                      vma->file_offset + (to - vma->start), file_bytes_from(vma, to));
+            if (!tail) return false;
+            vm_file_get(vma->file);
+
+            writeback(cr3, vma, from, to);
+            address_space_unmap(cr3, from, to - from);
+            vma->end = from;
+            if (vma->file_size > from - vma->start) vma->file_size = from - vma->start;
+            tail->next = vma->next;
+            vma->next = tail;
+            return true;
+        }
+
+        writeback(cr3, vma, from, to);
+        address_space_unmap(cr3, from, to - from);
+        if (from > vma->start) {
+            vma->end = from;
+            if (vma->file_size > from - vma->start) vma->file_size = from - vma->start;
+            link = &vma->next;
+        } else if (to < vma->end) {
+            vma->file_size = file_bytes_from(vma, to);
+            vma->file_offset += to - vma->start;
+            vma->start = to;
+            link = &vma->next;
+        } else {
+            *link = vma->next;
+            vm_file_put(vma->file);
+            kfree(vma);
+        }
+    }
+    return true;
+}
+
+VmArea* vma_clone_list(VmArea* list) {
+    VmArea* head = NULL;
+    VmArea** tail = &head;
+
+    for (VmArea* vma = list; vma; vma = vma->next) {
+        VmArea* copy = vma_create(vma->start, vma->end, vma->page_flags,
+                                  vma->file, vma->file_offset, vma->file_size);
+        if (!copy) {
+            vma_free_list(head);
+            return NULL;
+        }
+        vm_file_get(vma->file);
+        *tail = copy;
+        tail = &copy->next;
+    }
+    return head;
+}
+
+void vma_free_list(VmArea* list) {
+    while (list) {
+        VmArea* next = list->next;
+        vm_file_put(list->file);
+        kfree(list);
+        list = next;
+    }
+}
+
+//Demand paging: fills a not-present page that lies inside an area.
+//File pages come from the page cache, so only the first run of a program reads the disk
+bool vma_handle_fault(uint64_t cr3, VmArea* list, uint64_t vaddr, uint64_t error_code) {
+    if (error_code & 1) return false;
+
+    VmArea* vma = vma_find(list, vaddr);
+    if (!vma) return false;
+
+    bool write = error_code & 2;
+    if (write && !(vma->page_flags & PAGE_WRITABLE)) return false;
+
+    uint64_t page = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t offset = page - vma->start;
+
+    if (vma->file && vma->file->shm) {
+        //Shared memory pages past the end of the object do not exist
+        uint64_t frame = shm_get_frame(vma->file->shm, (vma->file_offset + offset) / PAGE_SIZE);
+        if (!frame) return false;
+        if (!address_space_map(cr3, page, frame, vma->page_flags | PAGE_PRESENT)) {
+            frame_free(frame);
+            return false;
+        }
+        return true;
+    }
+
+    if (vma->file && (vma->page_flags & PAGE_SHARED)) {
+        //MAP_SHARED: every mapping of the file uses the cached page itself and stores go to it
+        uint64_t cached = page_cache_get(vma->file->inode, (vma->file_offset + offset) / PAGE_SIZE);
+        if (!cached) return false;
+        if (!address_space_map(cr3, page, cached, vma->page_flags | PAGE_PRESENT)) {
+            frame_free(cached);
+            return false;
+        }
+        return true;
+    }
+
+    if (offset >= vma->file_size && !write) {
+        //Reads of untouched zero-fill memory share one page, the first write copies it
+        uint64_t zero = paging_zero_frame();
+        uint64_t flags = vma->page_flags | PAGE_PRESENT;
+        if (flags & PAGE_WRITABLE) flags = (flags & ~PAGE_WRITABLE) | PAGE_COW;
+
+        frame_ref(zero);
+        if (!address_space_map(cr3, page, zero, flags)) {
+            frame_free(zero);
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t frame;
+    if (offset < vma->file_size) {
+        uint64_t cached = page_cache_get(vma->file->inode, (vma->file_offset + offset) / PAGE_SIZE);
+        if (!cached) {
+            kprintf("vma_handle_fault: cannot read page at offset %d\n", (uint32_t)(vma->file_offset + offset));
+            return false;
+        }
+
+        //Read-only pages that are all file data map the cached frame itself, shared by every process
+        bool whole = offset + PAGE_SIZE <= vma->file_size || vma->start + vma->file_size >= vma->end;
+        if (!(vma->page_flags & PAGE_WRITABLE) && whole) {
+            frame = cached;
+        } else {
+            uint64_t size = vma->file_size - offset;
+            if (size > PAGE_SIZE) size = PAGE_SIZE;
+
+            frame = frame_alloc();
+            if (frame) memcpy((void*)frame, (void*)cached, size);
+            frame_free(cached);
+            if (!frame) return false;
+        }
+    } else {
+        frame = frame_alloc();
+        if (!frame) return false;
+    }
+
+    if (!address_space_map(cr3, page, frame, vma->page_flags | PAGE_PRESENT)) {
+        frame_free(frame);
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
@@ -5,4 +5,11 @@
 
 #define S_STACK_SIZE 8192
 
+void* stack_alloc();
+void stack_free(void* stack);
+
+static inline uint64_t stack_top(void* stack) {
+    return ((uint64_t)stack + S_STACK_SIZE) & ~0xFULL;
+}
+
 #endif
\ No newline at end of file
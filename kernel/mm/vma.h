@@ -0,0 +1,43 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "../../lib/definitions.h"
+#include "../fs/src/vfs.h"
+
+//File or shared memory object behind one or more areas, shared by every mapping of it
+typedef struct VmFile {
+    Inode* inode;
+    struct ShmObject* shm;
+    uint32_t refs;
+} VmFile;
+
+//A range of a user address space that is filled in on first touch
+typedef struct VmArea {
+    uint64_t start;             //page aligned
+    uint64_t end;               //page aligned, exclusive
+    uint64_t page_flags;        //PTE flags for pages faulted in, PAGE_SHARED for MAP_SHARED
+    VmFile* file;               //NULL for anonymous memory
+    uint64_t file_offset;       //file offset that start maps to
+    uint64_t file_size;         //bytes from start backed by the file, the rest reads as zero
+    struct VmArea* next;
+} VmArea;
+
+VmFile* vm_file_create(Inode* inode);
+VmFile* vm_file_create_shm(struct ShmObject* shm);
+uint64_t vm_file_size(VmFile* file);
+void vm_file_get(VmFile* file);
+void vm_file_put(VmFile* file);
+
+VmArea* vma_create(uint64_t start, uint64_t end, uint64_t page_flags,
+                   VmFile* file, uint64_t file_offset, uint64_t file_size);
+bool vma_insert(VmArea** list, VmArea* vma);
+VmArea* vma_find(VmArea* list, uint64_t vaddr);
+uint64_t vma_find_gap(VmArea* list, uint64_t size, uint64_t from, uint64_t to);
+bool vma_unmap_range(VmArea** list, uint64_t cr3, uint64_t start, uint64_t end);
+int vma_sync(uint64_t cr3, VmArea* list, uint64_t start, uint64_t end);
+VmArea* vma_clone_list(VmArea* list);
+void vma_free_list(VmArea* list);
+
+bool vma_handle_fault(uint64_t cr3, VmArea* list, uint64_t vaddr, uint64_t error_code);
+
+#endif
\ No newline at end of file
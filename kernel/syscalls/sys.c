@@ -7,5 +7,17 @@ syscall_t syscall_table[] = {
     {3, &close},
     {4, &stat},
     {5, &fstat},
-    {6, &sleep}
+    {6, &sleep},
+    {7, &fork},
+    {8, &pipe},
+    {9, &futex},
+    {10, &dup},
+    {11, &dup2},
+    {12, &waitpid},
+    {13, &mmap},
+    {14, &munmap},
+    {15, &msync},
+    {16, &shm_open},
+    {17, &shm_unlink},
+    {18, &fsync}
 };
\ No newline at end of file
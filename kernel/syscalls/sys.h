@@ -7,6 +7,14 @@
 #include "sys_close/close.h"
 #include "sys_stat/stat.h"
 #include "sys_sleep/sleep.h"
+#include "sys_fork/fork.h"
+#include "sys_pipe/pipe.h"
+#include "sys_futex/futex.h"
+#include "sys_dup/dup.h"
+#include "sys_wait/wait.h"
+#include "sys_mmap/mmap.h"
+#include "sys_shm/shm.h"
+#include "sys_fsync/fsync.h"
 
 typedef struct syscall_t {
     int syscall_no;
@@ -0,0 +1,11 @@
+#include "dup.h"
+#include "../../fs/src/file.h"
+
+//The new fd shares the open-file description, and with it the position, with fd
+int dup(int fd) {
+    return fd_dup(fd);
+}
+
+int dup2(int fd, int new_fd) {
+    return fd_dup2(fd, new_fd);
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef DUP_H
+#define DUP_H
+
+#include "../../../lib/definitions.h"
+
+int dup(int fd);
+int dup2(int fd, int new_fd);
+
+#endif
\ No newline at end of file
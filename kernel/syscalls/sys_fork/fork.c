@@ -0,0 +1,7 @@
+#include "fork.h"
+#include "../../threading/threading.h"
+
+//frame is the register block the syscall entry saved, the child resumes from a copy of it
+int fork(void* frame) {
+    return process_fork(frame);
+}
\ No newline at end of file
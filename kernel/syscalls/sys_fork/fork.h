@@ -0,0 +1,8 @@
+#ifndef FORK_H
+#define FORK_H
+
+#include "../../../lib/definitions.h"
+
+int fork(void* frame);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "fsync.h"
+#include "../../fs/src/file.h"
+
+//Returns once what was written through fd has left the device's write cache too
+int fsync(int fd) {
+    return file_fsync(fd);
+}
\ No newline at end of file
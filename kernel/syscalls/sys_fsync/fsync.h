@@ -0,0 +1,8 @@
+#ifndef FSYNC_H
+#define FSYNC_H
+
+#include "../../../lib/definitions.h"
+
+int fsync(int fd);
+
+#endif
\ No newline at end of file
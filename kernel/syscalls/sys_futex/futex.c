@@ -0,0 +1,14 @@
+#include "futex.h"
+#include "../../threading/src/futex.h"
+
+//FUTEX_WAIT sleeps while *uaddr == val, FUTEX_WAKE wakes up to val waiters
+int futex(uint32_t* uaddr, int op, uint32_t val) {
+    switch (op) {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, val);
+        case FUTEX_WAKE:
+            return futex_wake(uaddr, (int)val);
+        default:
+            return -1;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef SYS_FUTEX_H
+#define SYS_FUTEX_H
+
+#include "../../../lib/definitions.h"
+
+int futex(uint32_t* uaddr, int op, uint32_t val);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "mmap.h"
+#include "../../mm/mmap.h"
+#include "../../mm/shm.h"
+#include "../../fs/src/file.h"
+#include "../../threading/threading.h"
+
+//The mapping keeps its own copy of the inode, the fd can be closed right after
+static VmFile* map_file(int fd, int prot, int flags) {
+    FileDescriptor* file = fd_get(fd);
+    if (file && file->type == FILE_SHM) {
+        if (!(flags & MAP_SHARED)) return NULL;
+        shm_get(file->shm);
+        VmFile* vm_file = vm_file_create_shm(file->shm);
+        if (!vm_file) shm_put(file->shm);
+        return vm_file;
+    }
+    if (!file || file->type != FILE_INODE || !(file->flags & O_RDONLY)) return NULL;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(file->flags & O_WRONLY)) return NULL;
+
+    Inode* inode = kmalloc(sizeof(Inode));
+    if (!inode) return NULL;
+    memcpy(inode, file->inode, sizeof(Inode));
+
+    VmFile* vm_file = vm_file_create(inode);
+    if (!vm_file) kfree(inode);
+    return vm_file;
+}
+
+//Maps into the calling process, MAP_FAILED on error
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, uint64_t offset) {
+    Process* current = get_current_process();
+    if (!current || !current->cr3) return MAP_FAILED;
+
+    VmFile* file = NULL;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file = map_file(fd, prot, flags);
+        if (!file) return MAP_FAILED;
+    }
+
+    uint64_t start = vm_mmap(current->cr3, &current->vmas, (uint64_t)addr, length, prot, flags, file, offset);
+    if (!start) {
+        vm_file_put(file);
+        return MAP_FAILED;
+    }
+    return (void*)start;
+}
+
+int munmap(void* addr, size_t length) {
+    Process* current = get_current_process();
+    if (!current || !current->cr3) return -1;
+
+    return vm_munmap(current->cr3, &current->vmas, (uint64_t)addr, length);
+}
+
+//Writes dirty MAP_SHARED pages back to their files; the write is always synchronous
+int msync(void* addr, size_t length, int flags) {
+    Process* current = get_current_process();
+    if (!current || !current->cr3) return -1;
+
+    return vm_msync(current->cr3, current->vmas, (uint64_t)addr, length);
+}
\ No newline at end of file
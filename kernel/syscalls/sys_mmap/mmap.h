@@ -0,0 +1,10 @@
+#ifndef SYS_MMAP_H
+#define SYS_MMAP_H
+
+#include "../../../lib/definitions.h"
+
+void* mmap(void* addr, size_t length, int prot, int flags, int fd, uint64_t offset);
+int munmap(void* addr, size_t length);
+int msync(void* addr, size_t length, int flags);
+
+#endif
\ No newline at end of file
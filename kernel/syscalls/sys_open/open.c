@@ -6,12 +6,11 @@ int open(const char* pathname, int flags, mode_t mode) {
         return -1;
     }
 
-    int fs_fd = file_open(pathname, flags, mode);
+    int fd = file_open(pathname, flags, mode);
 
-    if (fs_fd < 0) {
+    if (fd < 0) {
         return -1;
     }
 
-    int fd = fs_fd + 3;
     return fd;
 }
\ No newline at end of file
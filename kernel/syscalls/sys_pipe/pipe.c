@@ -0,0 +1,41 @@
+#include "pipe.h"
+#include "../../fs/src/file.h"
+#include "../../fs/src/pipe.h"
+#include "../../mm/heap.h"
+
+//fds[0] is the read end, fds[1] the write end
+int pipe(int fds[2]) {
+    if (!fds) return -1;
+
+    Pipe* channel = pipe_create();
+    if (!channel) return -1;
+
+    FileDescriptor* in = file_alloc(FILE_PIPE, O_RDONLY);
+    FileDescriptor* out = file_alloc(FILE_PIPE, O_WRONLY);
+    if (!in || !out) {
+        if (in) kfree(in);
+        if (out) kfree(out);
+        pipe_release(channel, false);
+        pipe_release(channel, true);
+        return -1;
+    }
+    in->pipe = channel;
+    out->pipe = channel;
+
+    int read_fd = fd_install(in);
+    if (read_fd < 0) {
+        file_put(in);
+        file_put(out);
+        return -1;
+    }
+    int write_fd = fd_install(out);
+    if (write_fd < 0) {
+        fd_close(read_fd);
+        file_put(out);
+        return -1;
+    }
+
+    fds[0] = read_fd;
+    fds[1] = write_fd;
+    return 0;
+}
\ No newline at end of file
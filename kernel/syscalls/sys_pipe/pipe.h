@@ -0,0 +1,8 @@
+#ifndef SYS_PIPE_H
+#define SYS_PIPE_H
+
+#include "../../../lib/definitions.h"
+
+int pipe(int fds[2]);
+
+#endif
\ No newline at end of file
@@ -1,10 +1,16 @@
 #include "read.h"
 #include "../../drivers/keyboard/keyboard.h"
 #include "../../fs/src/file.h"
+#include "../../fs/src/pipe.h"
 #include "../io.h"
 
 ssize_t read(int fd, void* buf, size_t nbyte) {
-    if (fd == stdin) {
+    FileDescriptor* file = fd_get(fd);
+    if (!file || !buf || !(file->flags & O_RDONLY)) {
+        return -1;
+    }
+
+    if (file->type == FILE_CONSOLE) {
         char* line = keyboard_read_line();
         if (line == NULL) return 0;
         
@@ -13,12 +19,11 @@ ssize_t read(int fd, void* buf, size_t nbyte) {
         memcpy(buf, line, to_copy);
         return to_copy;
     }
-    else if (fd == stdout || fd == stderr) {
-        return -1;
+    else if (file->type == FILE_PIPE) {
+        return pipe_read(file->pipe, buf, nbyte);
     }
-    else if (fd >= 3 < MAX_OPEN_FILES + 3) {
-        int fs_fd = fd - 3;
-        return file_read(fs_fd, buf, nbyte);
+    else if (file->type == FILE_SHM) {
+        return -1;
     }
-    return -1;
+    return file_read(fd, buf, nbyte);
 }
\ No newline at end of file
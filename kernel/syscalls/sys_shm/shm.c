@@ -0,0 +1,24 @@
+#include "shm.h"
+#include "../../fs/src/file.h"
+#include "../../mm/shm.h"
+
+//Opens the named object, creating it with size bytes under O_CREAT. The fd is only good for mmap
+int shm_open(const char* name, int flags, size_t size) {
+    ShmObject* shm = shm_open_object(name, flags & O_CREAT, size);
+    if (!shm) return -1;
+
+    FileDescriptor* file = file_alloc(FILE_SHM, O_RDWR);
+    if (!file) {
+        shm_put(shm);
+        return -1;
+    }
+    file->shm = shm;
+
+    int fd = fd_install(file);
+    if (fd < 0) file_put(file);
+    return fd;
+}
+
+int shm_unlink(const char* name) {
+    return shm_unlink_object(name);
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#ifndef SYS_SHM_H
+#define SYS_SHM_H
+
+#include "../../../lib/definitions.h"
+
+int shm_open(const char* name, int flags, size_t size);
+int shm_unlink(const char* name);
+
+#endif
\ No newline at end of file
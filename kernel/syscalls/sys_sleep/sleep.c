@@ -1,10 +1,6 @@
 #include "sleep.h"
+#include "../../threading/threading.h"
 
-inline void sleep(uint32_t ms) {
-    uint64_t start = timer_get_ticks();
-    uint64_t end = start + ms;
-    
-    while (timer_get_ticks() < end) {
-        asm volatile ("nop");
-    }
+void sleep(uint32_t ms) {
+    sleep_until(timer_get_ticks() + ms);
 }
\ No newline at end of file
@@ -4,6 +4,6 @@
 #include "../../../lib/definitions.h"
 #include "../../cpu/src/pic.h"
 
-inline void sleep(uint32_t ms);
+void sleep(uint32_t ms);
 
 #endif
\ No newline at end of file
@@ -16,8 +16,13 @@ int fstat(int fd, struct stat* statbuf) {
         return -1;
     }
 
-    if (fd < 3) {
-        statbuf->st_mode = 0100644;
+    FileDescriptor* file = fd_get(fd);
+    if (!file) {
+        return -1;
+    }
+
+    if (file->type != FILE_INODE) {
+        statbuf->st_mode = file->type == FILE_PIPE ? 0010600 : 0100644;
         statbuf->st_size = 0;
         statbuf->st_atime = 0;
         statbuf->st_mtime = 0;
@@ -27,7 +32,5 @@ int fstat(int fd, struct stat* statbuf) {
         return 0;
     }
 
-    int fs_fd = fd - 3;
-
-    return file_fstat(fs_fd, statbuf);
+    return file_fstat(fd, statbuf);
 }
\ No newline at end of file
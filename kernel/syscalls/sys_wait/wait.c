@@ -0,0 +1,7 @@
+#include "wait.h"
+#include "../../threading/threading.h"
+
+//Exit code of a child of the caller, -1 if pid is not one
+int waitpid(int pid) {
+    return process_wait(find_process(pid));
+}
\ No newline at end of file
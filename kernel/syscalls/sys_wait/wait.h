@@ -0,0 +1,8 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "../../../lib/definitions.h"
+
+int waitpid(int pid);
+
+#endif
\ No newline at end of file
@@ -1,24 +1,25 @@
 #include "write.h"
 #include "../../drivers/vga/vga.h"
 #include "../../fs/src/file.h"
+#include "../../fs/src/pipe.h"
 
 ssize_t write(int fd, const void* buf, size_t nbyte) {
-    if (fd == stdout) {
-        for (int i = 0; i < nbyte; i++) {
-            vga_putc(((char*)buf)[i]);
-        }
-        return nbyte;
+    FileDescriptor* file = fd_get(fd);
+    if (!file || !buf || !(file->flags & O_WRONLY)) {
+        return -1;
     }
-    else if (fd == stderr) {
+
+    if (file->type == FILE_CONSOLE) {
         for (int i = 0; i < nbyte; i++) {
             vga_putc(((char*)buf)[i]);
         }
         return nbyte;
     }
-    else if (fd == stdin) return -1;
-    else if (fd >= 3 && fd < MAX_OPEN_FILES + 3) {
-        int fs_fd = fd - 3;
-        return file_write(fs_fd, buf, nbyte);
+    else if (file->type == FILE_PIPE) {
+        return pipe_write(file->pipe, buf, nbyte);
+    }
+    else if (file->type == FILE_SHM) {
+        return -1;
     }
-    return -1;
+    return file_write(fd, buf, nbyte);
 }
\ No newline at end of file
@@ -1,40 +1,69 @@
 #include "../../../lib/definitions.h"
 #include "binary.h"
 #include "../../mm/heap.h"
+#include "../../mm/paging.h"
 #include "../../fs/fs.h"
-#include "../../syscalls/sys.h"
+#include "../../mm/pagecache.h"
 
-int load_binary(const char* path, uint64_t* entry_point) {
-    int fd = open(path, 0, 0644);
-    if (fd < 0) return -1;
+/*
+ * Flat images put code and data straight after the header, so file offsets
+ * and load addresses never agree within a page and the file's pages cannot
+ * be mapped the way ELF segments are. The image is copied into private
+ * frames instead, but read through the page cache, so running it again does
+ * not touch the disk.
+ */
+
+//Loads the image into the user half of the address space cr3
+int load_binary(const char* path, uint64_t cr3, uint64_t* entry_point) {
+    Inode* start_dir = (path[0] == '/') ? get_root() : get_current_dir();
+    Inode* inode = NULL;
+    if (!start_dir || !vfs_lookup(start_dir, path, &inode) || !inode) return -1;
     
     binary_header_t header;
-    if (read(fd, &header, sizeof(header)) != sizeof(header)) {
-        close(fd);
+    if (page_cache_read(inode, 0, &header, sizeof(header)) != sizeof(header)) {
+        kfree(inode);
         return -2;
     }
     
     if (header.magic != BINARY_MAGIC) {
-        close(fd);
+        kfree(inode);
         return -3;
     }
     
-    void* program_memory = kmalloc(header.code_size + header.data_size + header.bss_size);
-    if (!program_memory) {
-        close(fd);
+    uint64_t image_size = header.code_size + header.data_size + header.bss_size;
+    uint64_t base = header.load_address & ~(uint64_t)(PAGE_SIZE - 1);
+    if (base < USER_SPACE_START || base + image_size > USER_STACK_TOP - USER_STACK_SIZE) {
+        base = USER_IMAGE_BASE;
+    }
+    
+    //Fresh frames are zeroed, which takes care of the bss
+    if (!address_space_alloc(cr3, base, image_size, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER)) {
+        kfree(inode);
         return -4;
     }
     
-    if (read(fd, program_memory, header.code_size + header.data_size) != 
-            (header.code_size + header.data_size)) {
-        kfree(program_memory);
-        close(fd);
-        return -5;
+    uint8_t* buffer = kmalloc(PAGE_SIZE);
+    if (!buffer) {
+        kfree(inode);
+        return -4;
     }
     
-    memset((uint8_t*)program_memory + header.code_size + header.data_size, 0, header.bss_size);
+    uint64_t remaining = header.code_size + header.data_size;
+    uint64_t offset = 0;
+    while (remaining > 0) {
+        int chunk = remaining < PAGE_SIZE ? (int)remaining : PAGE_SIZE;
+        if (page_cache_read(inode, sizeof(header) + offset, buffer, chunk) != chunk ||
+            !address_space_write(cr3, base + offset, buffer, chunk)) {
+            kfree(buffer);
+            kfree(inode);
+            return -5;
+        }
+        offset += chunk;
+        remaining -= chunk;
+    }
     
-    *entry_point = (uint64_t)program_memory + header.entry_point;
-    close(fd);
+    kfree(buffer);
+    kfree(inode);
+    *entry_point = base + header.entry_point;
     return 0;
 }
\ No newline at end of file
@@ -16,6 +16,6 @@ typedef struct {
 
 #define BINARY_MAGIC 0x4F53783E
 
-int load_binary(const char* path, uint64_t* entry_point);
+int load_binary(const char* path, uint64_t cr3, uint64_t* entry_point);
 
 #endif
\ No newline at end of file
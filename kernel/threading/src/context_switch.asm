@@ -2,21 +2,95 @@ global context_switch
 section .text
 
 ;AMD64 calling convention:
-;1st in rdi = old_task
-;2nd in rsi = new_task
+;1st in rdi = CpuState of the old task (0 when there is nothing to save)
+;2nd in rsi = CpuState of the new task
+;3rd in rdx = cr3 of the new task (0 keeps the current address space)
+
+;Offsets into the packed CpuState in process.h
+%define CS_RBX      8
+%define CS_RBP      48
+%define CS_R12      88
+%define CS_R13      96
+%define CS_R14      104
+%define CS_R15      112
+%define CS_RIP      120
+%define CS_RFLAGS   136
+%define CS_RSP      144
 
 context_switch:
-    cmp rdi, 0
-    je .skip_old
+    test rdi, rdi
+    jz .load_new
 
-.skip_old:
-    cmp rsi, 0
-    je .finish
+    mov [rdi + CS_RBX], rbx
+    mov [rdi + CS_RBP], rbp
+    mov [rdi + CS_R12], r12
+    mov [rdi + CS_R13], r13
+    mov [rdi + CS_R14], r14
+    mov [rdi + CS_R15], r15
+    pushfq
+    pop qword [rdi + CS_RFLAGS]
+    mov rax, [rsp]
+    mov [rdi + CS_RIP], rax
+    lea rax, [rsp + 8]
+    mov [rdi + CS_RSP], rax
 
-    mov rax, [rsi + 8*5]
-    test rax, rax
+.load_new:
+    test rdx, rdx
     jz .no_cr3
-    mov cr3, rax
+    mov rax, cr3
+    cmp rax, rdx
+    je .no_cr3
+    mov cr3, rdx
 
 .no_cr3:
-    lea rax, [rsi + <offset]
\ No newline at end of file
+    mov rbx, [rsi + CS_RBX]
+    mov rbp, [rsi + CS_RBP]
+    mov r12, [rsi + CS_R12]
+    mov r13, [rsi + CS_R13]
+    mov r14, [rsi + CS_R14]
+    mov r15, [rsi + CS_R15]
+    mov rsp, [rsi + CS_RSP]
+    push qword [rsi + CS_RFLAGS]
+    popfq
+    jmp [rsi + CS_RIP]
+
+;First run of a forked child: rsp points at the syscall frame the parent entered with,
+;which is at the same address in the child's copy of the stack
+global fork_return
+extern finish_context_switch
+%define FRAME_RAX   104
+
+fork_return:
+    mov rbx, rsp
+    and rsp, ~0xF
+    call finish_context_switch
+    mov rsp, rbx
+    mov qword [rsp + FRAME_RAX], 0
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    iretq
+
+;First run of a kernel thread: r12 = entry, r13 = argument
+global kthread_start
+extern kthread_exit
+
+kthread_start:
+    call finish_context_switch
+    sti
+    mov rdi, r13
+    call r12
+    mov edi, eax
+    call kthread_exit
+    jmp $
\ No newline at end of file
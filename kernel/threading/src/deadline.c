@@ -0,0 +1,251 @@
+#include "deadline.h"
+#include "../threading.h"
+#include "../../cpu/src/pic.h"
+#include "../../cpu/src/pit.h"
+#include "../../mm/heap.h"
+
+/*
+ * Partitioned EDF: admission pins each deadline task to one cpu and charges
+ * it runtime/deadline. While the sum stays <= 1 every job meets its deadline;
+ * SCHED_DL_MAX_BANDWIDTH keeps a share back for the normal classes.
+ * Budget is enforced per job, a task that uses up its runtime is throttled
+ * until its next release. All times are in timer ticks.
+ */
+
+static spinlock_t dl_admission_lock = SPINLOCK_INIT;
+
+static void insert_sorted(ProcessQueue* queue, Process* process, bool by_release) {
+    uint64_t key = by_release ? process->dl.next_release : process->dl.abs_deadline;
+
+    //Walk back from the tail, equal keys keep FIFO order
+    Process* after = queue->tail;
+    while (after) {
+        uint64_t after_key = by_release ? after->dl.next_release : after->dl.abs_deadline;
+        if (after_key <= key) break;
+        after = after->prev;
+    }
+
+    process->prev = after;
+    process->next = after ? after->next : queue->head;
+    if (process->next) process->next->prev = process;
+    else queue->tail = process;
+    if (after) after->next = process;
+    else queue->head = process;
+}
+
+void dl_queue_insert(ProcessQueue* queue, Process* process) {
+    insert_sorted(queue, process, false);
+}
+
+static Process* pop_head(ProcessQueue* queue) {
+    Process* process = queue->head;
+    if (!process) return NULL;
+
+    queue->head = process->next;
+    if (queue->head) queue->head->prev = NULL;
+    else queue->tail = NULL;
+    process->next = process->prev = NULL;
+    return process;
+}
+
+static void dl_start_job(Process* process, uint64_t now) {
+    DeadlineParams* dl = &process->dl;
+
+    //Overran whole periods: skip them instead of releasing a burst of stale jobs
+    if (now >= dl->next_release + dl->period) {
+        dl->next_release += (now - dl->next_release) / dl->period * dl->period;
+    }
+
+    dl->release = dl->next_release;
+    dl->abs_deadline = dl->release + dl->deadline;
+    dl->runtime_left = dl->runtime;
+    dl->next_release = dl->release + dl->period;
+    dl->job_active = 1;
+    dl->job_missed = 0;
+    dl->job_dispatched = 0;
+    dl->activations++;
+}
+
+static void dl_check_miss(Process* process, uint64_t now) {
+    DeadlineParams* dl = &process->dl;
+    if (dl->job_active && !dl->job_missed && now > dl->abs_deadline) {
+        dl->job_missed = 1;
+        dl->misses++;
+    }
+}
+
+//Park the current task until its next release, interrupts must be off
+static void dl_park(Process* process) {
+    RunQueue* rq = &run_queues[process->dl.cpu];
+
+    spin_lock(&rq->lock);
+    process->state = WAITING;
+    insert_sorted(&rq->dl_waiting, process, true);
+    spin_unlock(&rq->lock);
+}
+
+//Turns the calling task into a periodic deadline task, returns -1 if admission fails
+int sched_setdeadline(uint64_t runtime, uint64_t deadline, uint64_t period) {
+    if (runtime == 0 || runtime > deadline || deadline > period) {
+        kprintf("sched_setdeadline: need 0 < runtime <= deadline <= period\n");
+        return -1;
+    }
+
+    Process* current = get_current_process();
+    if (!current) return -1;
+
+    uint32_t bandwidth = (uint32_t)(runtime * DL_BW_UNIT / deadline);
+    uint64_t flags = spin_lock_irqsave(&dl_admission_lock);
+
+    //Whatever the task already holds is given back before checking the new parameters
+    bool was_deadline = current->sched_class == SCHED_CLASS_DEADLINE;
+    int held_cpu = was_deadline ? current->dl.cpu : -1;
+    uint32_t held = was_deadline ? current->dl.bandwidth : 0;
+
+    int cpu = -1;
+    for (int i = 0; i < cpu_count; i++) {
+        //Try the cpu it is on first, it can start right away there
+        int candidate = (i == 0) ? current->cpu : (i <= current->cpu ? i - 1 : i);
+        if (!(current->affinity & (1ULL << candidate))) continue;
+
+        uint32_t used = run_queues[candidate].dl_bandwidth - (candidate == held_cpu ? held : 0);
+        if (used + bandwidth <= SCHED_DL_MAX_BANDWIDTH) {
+            cpu = candidate;
+            break;
+        }
+    }
+
+    if (cpu < 0) {
+        spin_unlock_irqrestore(&dl_admission_lock, flags);
+        kprintf("sched_setdeadline: admission control rejected %s\n", current->name);
+        return -1;
+    }
+
+    if (was_deadline) run_queues[held_cpu].dl_bandwidth -= held;
+    run_queues[cpu].dl_bandwidth += bandwidth;
+
+    memset(&current->dl, 0, sizeof(DeadlineParams));
+    current->dl.runtime = runtime;
+    current->dl.deadline = deadline;
+    current->dl.period = period;
+    current->dl.bandwidth = bandwidth;
+    current->dl.cpu = cpu;
+    current->dl.next_release = timer_get_ticks();
+    current->affinity = 1ULL << cpu;
+    current->sched_class = SCHED_CLASS_DEADLINE;
+    dl_start_job(current, current->dl.next_release);
+    current->dl.job_dispatched = 1;
+    spin_unlock(&dl_admission_lock);
+
+    //Admitted somewhere else: requeueing moves it over once it is off this cpu
+    if (cpu != current->cpu) schedule();
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+    return 0;
+}
+
+//Back to the normal classes, releases the bandwidth of the calling task
+void sched_clear_deadline() {
+    Process* current = get_current_process();
+    if (!current || current->sched_class != SCHED_CLASS_DEADLINE) return;
+
+    uint64_t flags = spin_lock_irqsave(&dl_admission_lock);
+    run_queues[current->dl.cpu].dl_bandwidth -= current->dl.bandwidth;
+    current->sched_class = SCHED_CLASS_NORMAL;
+    current->affinity = CPU_AFFINITY_ALL;
+    current->ticks_left = SCHED_QUANTUM(current->priority);
+    spin_unlock_irqrestore(&dl_admission_lock, flags);
+}
+
+//End of the current job: sleep until the next release
+void dl_wait_next_period() {
+    Process* current = get_current_process();
+    if (!current || current->sched_class != SCHED_CLASS_DEADLINE) return;
+
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+
+    uint64_t now = timer_get_ticks();
+    dl_check_miss(current, now);
+    current->dl.job_active = 0;
+
+    if (now >= current->dl.next_release) {
+        //Already late for the next job, start it straight away
+        dl_start_job(current, now);
+        current->dl.job_dispatched = 1;
+    } else {
+        dl_park(current);
+        schedule();
+    }
+
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+//Timer side: release due jobs and charge the running task's budget
+void dl_tick(int cpu, uint64_t now) {
+    RunQueue* rq = &run_queues[cpu];
+
+    for (;;) {
+        spin_lock(&rq->lock);
+        Process* process = rq->dl_waiting.head;
+        if (process && process->dl.next_release <= now) pop_head(&rq->dl_waiting);
+        else process = NULL;
+        spin_unlock(&rq->lock);
+        if (!process) break;
+
+        dl_start_job(process, now);
+        process->state = READY;
+        enqueue_process_local(process, cpu);
+    }
+
+    spin_lock(&rq->lock);
+    for (Process* p = rq->dl_queue.head; p; p = p->next) dl_check_miss(p, now);
+    spin_unlock(&rq->lock);
+
+    Process* current = rq->current;
+    if (!current || current->sched_class != SCHED_CLASS_DEADLINE || !current->dl.job_active) return;
+
+    dl_check_miss(current, now);
+    if (current->dl.runtime_left > 0) current->dl.runtime_left--;
+    if (current->dl.runtime_left == 0) {
+        //Out of budget: the job cannot finish in time, hold it until the next release
+        if (!current->dl.job_missed) current->dl.misses++;
+        current->dl.throttles++;
+        current->dl.job_active = 0;
+        dl_park(current);
+        rq->need_resched = 1;
+    }
+}
+
+//Release jitter: how long after its release a job first got the cpu
+void dl_note_dispatch(Process* process) {
+    DeadlineParams* dl = &process->dl;
+    if (process->sched_class != SCHED_CLASS_DEADLINE || !dl->job_active || dl->job_dispatched) return;
+    dl->job_dispatched = 1;
+
+    uint64_t now_us = timer_get_us();
+    uint64_t release_us = dl->release * (1000000 / TIMER_HZ);
+    uint64_t jitter = now_us > release_us ? now_us - release_us : 0;
+
+    if (jitter > dl->jitter_max_us) dl->jitter_max_us = jitter;
+    dl->jitter_total_us += jitter;
+}
+
+void dl_dump_stats() {
+    int max = process_total();
+    ProcessInfo* processes = kmalloc(max * sizeof(ProcessInfo));
+    if (!processes) return;
+    int count = process_snapshot(processes, max);
+
+    for (int i = 0; i < count; i++) {
+        ProcessInfo* p = &processes[i];
+        if (p->sched_class != SCHED_CLASS_DEADLINE) continue;
+
+        DeadlineParams* dl = &p->dl;
+        uint32_t jobs = dl->activations ? dl->activations : 1;
+        kprintf("%s: %u/%u/%u ms on cpu%d, %u jobs, %u missed, %u throttled, jitter max %u us avg %u us\n",
+                p->name, (uint32_t)dl->runtime, (uint32_t)dl->deadline, (uint32_t)dl->period, dl->cpu,
+                dl->activations, dl->misses, dl->throttles,
+                (uint32_t)dl->jitter_max_us, (uint32_t)(dl->jitter_total_us / jobs));
+    }
+    kfree(processes);
+}
\ No newline at end of file
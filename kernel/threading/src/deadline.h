@@ -0,0 +1,18 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "process.h"
+
+#define DL_BW_UNIT (1 << 20)
+//Leave some of every cpu to the normal classes
+#define SCHED_DL_MAX_BANDWIDTH (DL_BW_UNIT / 100 * 90)
+
+void dl_queue_insert(ProcessQueue* queue, Process* process);
+int sched_setdeadline(uint64_t runtime, uint64_t deadline, uint64_t period);
+void sched_clear_deadline();
+void dl_wait_next_period();
+void dl_tick(int cpu, uint64_t now);
+void dl_note_dispatch(Process* process);
+void dl_dump_stats();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "elf.h"
+#include "../../mm/heap.h"
+#include "../../mm/paging.h"
+#include "../../fs/fs.h"
+#include "../../mm/pagecache.h"
+
+/*
+ * Nothing is read up front except the headers: every PT_LOAD segment
+ * becomes an area backed by the file, and pages are read the first time
+ * they are touched. The part of a segment past filesz (bss) is zero-fill
+ * and costs nothing until it is written. Headers and pages both go through
+ * the page cache, so running a program again does not touch the disk and
+ * its read-only pages are shared with every other instance.
+ */
+
+static int check_header(Elf64Header* header) {
+    if (header->magic != ELF_MAGIC) return -3;
+    if (header->class != ELF_CLASS64 || header->data != ELF_DATA_LSB) return -6;
+    if (header->machine != ELF_MACHINE_X86_64) return -6;
+    if (header->type != ET_EXEC && header->type != ET_DYN) return -6;
+    if (header->phentsize != sizeof(Elf64ProgramHeader)) return -6;
+    if (header->phnum == 0 || header->phnum > ELF_MAX_PHDRS) return -6;
+    return 0;
+}
+
+static int map_segment(Elf64ProgramHeader* ph, uint64_t bias, VmFile* file, VmArea** areas) {
+    uint64_t vaddr = ph->vaddr + bias;
+    uint64_t page_offset = vaddr & (PAGE_SIZE - 1);
+
+    //File pages can only be mapped where file offset and address agree within a page
+    if (ph->filesz > ph->memsz || page_offset != (ph->offset & (PAGE_SIZE - 1))) return -6;
+
+    uint64_t start = vaddr - page_offset;
+    uint64_t end = (vaddr + ph->memsz + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (start < USER_SPACE_START || end > USER_STACK_TOP - USER_STACK_SIZE || end <= start) return -6;
+
+    uint64_t flags = PAGE_USER;
+    if (ph->flags & PF_W) flags |= PAGE_WRITABLE;
+
+    uint64_t file_size = ph->filesz ? ph->filesz + page_offset : 0;
+    VmArea* area = vma_create(start, end, flags, file_size ? file : NULL,
+                              ph->offset - page_offset, file_size);
+    if (!area) return -4;
+    if (!vma_insert(areas, area)) {
+        kprintf("load_elf: segments share a page\n");
+        kfree(area);
+        return -6;
+    }
+    if (file_size) vm_file_get(file);
+    return 0;
+}
+
+//Sets up the areas for every PT_LOAD segment of path, no page is read yet
+int load_elf(const char* path, uint64_t* entry_point, VmArea** areas) {
+    Inode* start_dir = (path[0] == '/') ? get_root() : get_current_dir();
+    Inode* inode = NULL;
+    if (!start_dir || !vfs_lookup(start_dir, path, &inode) || !inode) return -1;
+
+    Elf64Header header;
+    if (page_cache_read(inode, 0, &header, sizeof(header)) != sizeof(header)) {
+        kfree(inode);
+        return -2;
+    }
+
+    int result = check_header(&header);
+    if (result != 0) {
+        kfree(inode);
+        return result;
+    }
+
+    uint32_t ph_size = header.phnum * sizeof(Elf64ProgramHeader);
+    Elf64ProgramHeader* phdrs = kmalloc(ph_size);
+    if (!phdrs) {
+        kfree(inode);
+        return -4;
+    }
+    if (page_cache_read(inode, header.phoff, phdrs, ph_size) != (int)ph_size) {
+        kfree(phdrs);
+        kfree(inode);
+        return -5;
+    }
+
+    VmFile* file = vm_file_create(inode);
+    if (!file) {
+        kfree(phdrs);
+        kfree(inode);
+        return -4;
+    }
+
+    //Position independent images go to the start of the user half
+    uint64_t bias = (header.type == ET_DYN) ? USER_IMAGE_BASE : 0;
+
+    *areas = NULL;
+    for (int i = 0; i < header.phnum && result == 0; i++) {
+        if (phdrs[i].type != PT_LOAD || phdrs[i].memsz == 0) continue;
+        result = map_segment(&phdrs[i], bias, file, areas);
+    }
+
+    kfree(phdrs);
+    vm_file_put(file);
+    if (result != 0) {
+        vma_free_list(*areas);
+        *areas = NULL;
+        return result;
+    }
+
+    *entry_point = header.entry + bias;
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "../../../lib/definitions.h"
+#include "../../mm/vma.h"
+
+#define ELF_MAGIC 0x464C457F    //"\x7FELF"
+#define ELF_CLASS64 2
+#define ELF_DATA_LSB 1
+#define ELF_MACHINE_X86_64 0x3E
+
+#define ET_EXEC 2
+#define ET_DYN 3
+
+#define PT_LOAD 1
+
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+#define ELF_MAX_PHDRS 32
+
+typedef struct {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t osabi;
+    uint8_t padding[8];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t elf_version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) Elf64Header;
+
+typedef struct {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} __attribute__((packed)) Elf64ProgramHeader;
+
+int load_elf(const char* path, uint64_t* entry_point, VmArea** areas);
+
+#endif
\ No newline at end of file
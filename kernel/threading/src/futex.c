@@ -0,0 +1,86 @@
+#include "futex.h"
+#include "../threading.h"
+#include "../../mm/paging.h"
+
+/*
+ * Waiters are keyed by the physical address of the word, so processes that
+ * map the same page at different addresses still meet on the same futex.
+ * Each waiter lives on the stack of the process sleeping on it.
+ */
+typedef struct FutexWaiter {
+    uint64_t key;
+    Process* process;
+    struct FutexWaiter* next;
+} FutexWaiter;
+
+typedef struct FutexBucket {
+    spinlock_t lock;
+    FutexWaiter* waiters;
+} FutexBucket;
+
+static FutexBucket futex_table[FUTEX_BUCKETS];
+
+static inline FutexBucket* bucket_of(uint64_t key) {
+    return &futex_table[((key >> 2) * 2654435761ULL >> 16) % FUTEX_BUCKETS];
+}
+
+static uint64_t futex_key(uint32_t* uaddr) {
+    if (!uaddr || ((uint64_t)uaddr & 3)) return 0;
+
+    //Fault the page in for writing first, it cannot be done under the bucket lock. A read
+    //would leave an untouched page on the shared zero frame, or on a frame copy-on-write
+    //replaces, and waiter and waker would then compute different keys
+    asm volatile ("lock addl $0, %0" : "+m"(*(volatile uint32_t*)uaddr) : : "memory");
+    return get_physical_address((uint64_t)uaddr);
+}
+
+//Sleeps as long as *uaddr still holds expected. 0 once woken, -1 if the value had already changed
+int futex_wait(uint32_t* uaddr, uint32_t expected) {
+    Process* current = get_current_process();
+    uint64_t key = futex_key(uaddr);
+    if (!current || !key) return -1;
+
+    FutexBucket* bucket = bucket_of(key);
+    FutexWaiter waiter = {key, current, NULL};
+
+    //A waker changes the value before taking this lock, so checking it here cannot miss a wake-up
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+    if (*(volatile uint32_t*)uaddr != expected) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return -1;
+    }
+
+    FutexWaiter** link = &bucket->waiters;
+    while (*link) link = &(*link)->next;
+    *link = &waiter;
+
+    current->state = WAITING;
+    spin_unlock(&bucket->lock);
+    schedule();
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+    return 0;
+}
+
+//Wakes up to count processes waiting on uaddr, oldest first, and returns how many
+int futex_wake(uint32_t* uaddr, int count) {
+    uint64_t key = futex_key(uaddr);
+    if (!key) return -1;
+
+    FutexBucket* bucket = bucket_of(key);
+    int woken = 0;
+
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+    FutexWaiter** link = &bucket->waiters;
+    while (*link && woken < count) {
+        FutexWaiter* waiter = *link;
+        if (waiter->key != key) {
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        wake_up_process(waiter->process);
+        woken++;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "../../../lib/definitions.h"
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+#define FUTEX_BUCKETS 64
+
+int futex_wait(uint32_t* uaddr, uint32_t expected);
+int futex_wake(uint32_t* uaddr, int count);
+
+#endif
\ No newline at end of file
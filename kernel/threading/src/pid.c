@@ -0,0 +1,78 @@
+#include "pid.h"
+
+/*
+ * Pids come from a bitmap and are handed out in increasing order, wrapping
+ * around at PID_MAX, so a pid is not reused right after its process goes
+ * away. Live processes are also chained into a hash table by pid.
+ */
+static uint64_t pid_bitmap[PID_MAX / 64];
+static int last_pid = 0;
+static Process* pid_hash[PID_HASH_BUCKETS];
+static spinlock_t pid_lock = SPINLOCK_INIT;
+
+static int find_free_pid(int from, int to) {
+    for (int word = from / 64; word * 64 < to; word++) {
+        uint64_t free = ~pid_bitmap[word];
+        if (word == from / 64) free &= ~0ULL << (from % 64);
+        if (!free) continue;
+
+        int pid = word * 64 + __builtin_ctzll(free);
+        return pid < to ? pid : -1;
+    }
+    return -1;
+}
+
+//Next free pid after the last one handed out, -1 when all are taken
+int pid_alloc() {
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+
+    int pid = find_free_pid(last_pid + 1, PID_MAX);
+    if (pid < 0) pid = find_free_pid(1, last_pid + 1);
+    if (pid > 0) {
+        pid_bitmap[pid / 64] |= 1ULL << (pid % 64);
+        last_pid = pid;
+    }
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return pid > 0 ? pid : -1;
+}
+
+void pid_free(int pid) {
+    if (pid <= 0 || pid >= PID_MAX) return;
+
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    pid_bitmap[pid / 64] &= ~(1ULL << (pid % 64));
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+static inline uint32_t pid_bucket(int pid) {
+    return (uint32_t)pid % PID_HASH_BUCKETS;
+}
+
+void pid_hash_add(Process* process) {
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    uint32_t bucket = pid_bucket(process->pid);
+    process->hash_next = pid_hash[bucket];
+    pid_hash[bucket] = process;
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+void pid_hash_remove(Process* process) {
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    Process** link = &pid_hash[pid_bucket(process->pid)];
+    while (*link && *link != process) link = &(*link)->hash_next;
+    if (*link) *link = process->hash_next;
+    process->hash_next = NULL;
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+//NULL if no process has that pid
+Process* find_process(int pid) {
+    if (pid <= 0 || pid >= PID_MAX) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    Process* process = pid_hash[pid_bucket(pid)];
+    while (process && process->pid != pid) process = process->hash_next;
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return process;
+}
\ No newline at end of file
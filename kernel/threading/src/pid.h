@@ -0,0 +1,15 @@
+#ifndef PID_H
+#define PID_H
+
+#include "process.h"
+
+#define PID_MAX 32768               //pid 0 is the boot process and never handed out
+#define PID_HASH_BUCKETS 256
+
+int pid_alloc();
+void pid_free(int pid);
+void pid_hash_add(Process* process);
+void pid_hash_remove(Process* process);
+Process* find_process(int pid);
+
+#endif
\ No newline at end of file
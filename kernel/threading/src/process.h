@@ -2,14 +2,24 @@
 #define PROCESS_H
 
 #include "../../../lib/definitions.h"
+#include "spinlock.h"
 
-#define MAX_PROCESSES 256
+#define PROCESS_NAME_LEN 32
+#define MAX_CPUS 8
+#define PRIORITY_LEVELS 5
+
+#define SCHED_TIMESLICE_TICKS 10
+#define SCHED_REBALANCE_TICKS 100
+#define SCHED_AGING_TICKS 200       //time spent queued before a process is boosted one level
+#define SCHED_AGING_CEILING HIGH    //aging lifts from IDLE up, but never into CRITICAL
+#define CPU_AFFINITY_ALL (~0ULL)
 
 typedef enum ProcessState {
     READY,
     RUNNING,
     WAITING,
-    TERMINATED
+    TERMINATED,
+    ZOMBIE                      //resources released, the parent has not collected the exit code yet
 } ProcessState;
 
 typedef enum ProcessPriority {
@@ -20,6 +30,34 @@ typedef enum ProcessPriority {
     CRITICAL
 } ProcessPriority;
 
+//Lower levels run less often, so they get longer quanta to make up for it
+#define SCHED_QUANTUM(priority) (SCHED_TIMESLICE_TICKS * (PRIORITY_LEVELS - (priority)))
+
+typedef enum SchedClass {
+    SCHED_CLASS_NORMAL,
+    SCHED_CLASS_DEADLINE        //EDF, always runs before any normal priority level
+} SchedClass;
+
+typedef struct DeadlineParams {
+    uint64_t runtime;           //budget per period, in ticks
+    uint64_t deadline;          //relative to the release
+    uint64_t period;
+    uint32_t bandwidth;         //runtime/deadline in DL_BW_UNIT, charged to the cpu at admission
+    uint8_t cpu;                //the cpu it was admitted on and pinned to
+    uint64_t release;           //current job
+    uint64_t abs_deadline;
+    uint64_t runtime_left;
+    uint64_t next_release;
+    uint8_t job_active;
+    uint8_t job_missed;
+    uint8_t job_dispatched;
+    uint32_t activations;
+    uint32_t misses;
+    uint32_t throttles;         //jobs that ran out of budget
+    uint64_t jitter_max_us;     //release to first dispatch
+    uint64_t jitter_total_us;
+} DeadlineParams;
+
 typedef struct __attribute__((packed)) CpuState {
     uint64_t rax;
     uint64_t rbx;
@@ -60,19 +98,75 @@ typedef struct FpuState {
 } FpuState;
 
 typedef struct Process {        //basic, but should do the job for now
-    ProcessPriority priority;
+    ProcessPriority priority;   //current MLFQ level
+    ProcessPriority base_priority;
     CpuState cpu_state;
     ProcessState state;
     uint64_t cr3;
+    struct VmArea* vmas;        //demand paged ranges of the address space, sorted by address
+    struct FdTable* files;      //NULL until a kernel thread first uses an fd
     char* name;
+    char comm[PROCESS_NAME_LEN];
     uint16_t pid;
+    struct Process* parent;     //NULL for kernel threads, they are reaped on exit
+    int exit_code;
+    uint8_t cpu;                //run queue the process belongs to
+    uint64_t affinity;          //bit n set = may run on cpu n
+    uint32_t ticks_left;        //allotment left at the current level, kept across blocking
+    volatile uint8_t on_cpu;    //context still live on a cpu, must not be stolen
+    void* kstack;               //NULL for the boot process, which runs on the loader stack
+    uint64_t wake_tick;         //deadline while on the sleep queue
+    int sleep_index;            //slot in the sleep heap, -1 when not sleeping
+    uint64_t runtime_ticks;
+    uint64_t wait_ticks;        //time spent runnable but queued
+    uint64_t ready_since;
+    uint32_t switches;
+    uint32_t preemptions;       //switches where the process was still runnable
+    SchedClass sched_class;
+    DeadlineParams dl;
     struct Process* next;
     struct Process* prev;
+    struct Process* task_next;  //list of every process, for ps and reparenting
+    struct Process* task_prev;
+    struct Process* hash_next;  //pid hash chain
 } Process;
 
+//What ps shows of a process, copied while it cannot exit and be freed
+typedef struct ProcessInfo {
+    char name[PROCESS_NAME_LEN];
+    uint16_t pid;
+    ProcessState state;
+    ProcessPriority priority;
+    ProcessPriority base_priority;
+    SchedClass sched_class;
+    uint8_t cpu;
+    uint64_t runtime_ticks;
+    uint64_t wait_ticks;
+    uint32_t switches;
+    uint32_t preemptions;
+    DeadlineParams dl;
+} ProcessInfo;
+
 typedef struct ProcessQueue {
     Process* head;
     Process* tail;
 } ProcessQueue;
 
+typedef struct RunQueue {
+    spinlock_t lock;
+    ProcessQueue queues[PRIORITY_LEVELS];
+    ProcessQueue dl_queue;      //runnable deadline tasks, earliest deadline first
+    ProcessQueue dl_waiting;    //deadline tasks waiting for their next release, soonest first
+    uint32_t dl_bandwidth;      //admitted deadline bandwidth in DL_BW_UNIT
+    volatile uint8_t need_resched;
+    uint32_t nr_running;
+    Process* current;
+    Process* prev;              //process switched away from, released after the switch
+    uint64_t busy_ticks;
+    uint64_t idle_ticks;
+    uint64_t migrations_in;
+    uint64_t migrations_out;
+    uint64_t steals;
+} RunQueue;
+
 #endif
\ No newline at end of file
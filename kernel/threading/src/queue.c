@@ -1,42 +1,268 @@
 #include "process.h"
+#include "deadline.h"
+#include "../../cpu/src/pic.h"
 
-Process process_list[MAX_PROCESSES];
-int process_count = 0;
+RunQueue run_queues[MAX_CPUS];
+int cpu_count = 0;
 
-ProcessQueue priority_queues[5];
+static uint8_t cpu_apic_ids[MAX_CPUS];
 
-Process* current_process = NULL;
-int next_pid = 1;
+static inline uint8_t read_apic_id() {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (uint8_t)(ebx >> 24);
+}
 
-void enqueue_process(Process* process) {
-    int priority = process->priority;
+//Called once by every cpu that joins the scheduler, returns its run queue index
+int cpu_register() {
+    if (cpu_count >= MAX_CPUS) return -1;
+
+    int cpu = cpu_count;
+    cpu_apic_ids[cpu] = read_apic_id();
+    memset(&run_queues[cpu], 0, sizeof(RunQueue));
+    cpu_count++;
+    return cpu;
+}
+
+int this_cpu() {
+    if (cpu_count <= 1) return 0;
+
+    uint8_t apic_id = read_apic_id();
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpu_apic_ids[i] == apic_id) return i;
+    }
+    return 0;
+}
+
+static inline bool cpu_allowed(Process* process, int cpu) {
+    return (process->affinity & (1ULL << cpu)) != 0;
+}
+
+static inline ProcessQueue* queue_of(RunQueue* rq, Process* process) {
+    if (process->sched_class == SCHED_CLASS_DEADLINE) return &rq->dl_queue;
+    return &rq->queues[process->priority];
+}
+
+static void queue_push_tail(RunQueue* rq, Process* process) {
+    if (process->sched_class == SCHED_CLASS_DEADLINE) {
+        dl_queue_insert(&rq->dl_queue, process);
+        rq->nr_running++;
+
+        Process* current = rq->current;
+        if (!current || current->sched_class != SCHED_CLASS_DEADLINE ||
+            process->dl.abs_deadline < current->dl.abs_deadline) {
+            rq->need_resched = 1;
+        }
+        return;
+    }
+
+    ProcessQueue* queue = &rq->queues[process->priority];
     process->next = NULL;
-    process->prev = NULL;
+    process->prev = queue->tail;
 
-    if (priority_queues[priority].head == NULL) {
-        priority_queues[priority].head = process;
-        priority_queues[priority].tail = process;
-    } else {
-        process->prev = priority_queues[priority].tail;
-        priority_queues[priority].tail->next = process;
-        priority_queues[priority].tail = process;
+    if (queue->tail) queue->tail->next = process;
+    else queue->head = process;
+    queue->tail = process;
+    rq->nr_running++;
+}
+
+static void queue_remove(RunQueue* rq, Process* process) {
+    ProcessQueue* queue = queue_of(rq, process);
+
+    if (process->prev) process->prev->next = process->next;
+    else queue->head = process->next;
+    if (process->next) process->next->prev = process->prev;
+    else queue->tail = process->prev;
+
+    process->prev = process->next = NULL;
+    rq->nr_running--;
+}
+
+//Stay on the last cpu unless another allowed one is clearly less loaded
+static int select_cpu(Process* process) {
+    int best = -1;
+    if (process->cpu < cpu_count && cpu_allowed(process, process->cpu)) {
+        best = process->cpu;
+    }
+
+    for (int i = 0; i < cpu_count; i++) {
+        if (!cpu_allowed(process, i)) continue;
+        if (best < 0 || run_queues[i].nr_running + 1 < run_queues[best].nr_running) {
+            best = i;
+        }
     }
+    return best < 0 ? 0 : best;
+}
+
+static void note_migration(Process* process, int to) {
+    if (process->cpu == to || process->cpu >= cpu_count) return;
+    run_queues[process->cpu].migrations_out++;
+    run_queues[to].migrations_in++;
+}
+
+void enqueue_process(Process* process) {
+    int cpu = select_cpu(process);
+    RunQueue* rq = &run_queues[cpu];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    note_migration(process, cpu);
+    process->cpu = cpu;
+    process->ready_since = timer_get_ticks();
+    queue_push_tail(rq, process);
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
-Process* dequeue_process(ProcessPriority priority) {
-    Process* process = priority_queues[priority].head;
+//Requeue on the cpu it is running on, the context is still live so it cannot move yet
+void enqueue_process_local(Process* process, int cpu) {
+    RunQueue* rq = &run_queues[cpu];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    process->cpu = cpu;
+    process->ready_since = timer_get_ticks();
+    queue_push_tail(rq, process);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+Process* dequeue_process(RunQueue* rq, ProcessPriority priority) {
+    Process* process = rq->queues[priority].head;
     if (!process) return NULL;
-    Process* next = process->next;
-    if (next) next->prev = NULL;
-    else priority_queues[priority].tail = NULL;
-    priority_queues[priority].head = next;
-    process->prev = process->next = NULL;
+    queue_remove(rq, process);
     return process;
 }
 
-int highest_priority_nonempty() {
-    for (int i = 4; i >= 0; i--) {
-        if (priority_queues[i].head != NULL) return i;
+int highest_priority_nonempty(RunQueue* rq) {
+    for (int i = PRIORITY_LEVELS - 1; i >= 0; i--) {
+        if (rq->queues[i].head != NULL) return i;
     }
     return -1;
+}
+
+//Boost every process that has been queued for SCHED_AGING_TICKS by one level
+void age_run_queue(int cpu, uint64_t now) {
+    RunQueue* rq = &run_queues[cpu];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    //Top down, so a process lifted this round is not looked at again
+    for (int i = SCHED_AGING_CEILING - 1; i >= IDLE; i--) {
+        Process* p = rq->queues[i].head;
+        while (p) {
+            Process* next = p->next;
+            if (now - p->ready_since >= SCHED_AGING_TICKS) {
+                queue_remove(rq, p);
+                p->wait_ticks += now - p->ready_since;
+                p->ready_since = now;
+                p->priority = i + 1;
+                p->ticks_left = SCHED_QUANTUM(p->priority);
+                queue_push_tail(rq, p);
+            }
+            p = next;
+        }
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+//Take from the tail: the most recently queued process has the coldest cache on the victim
+static Process* steal_process(RunQueue* victim, int cpu) {
+    for (int i = PRIORITY_LEVELS - 1; i >= 0; i--) {
+        for (Process* p = victim->queues[i].tail; p; p = p->prev) {
+            if (p->on_cpu || !cpu_allowed(p, cpu)) continue;
+            queue_remove(victim, p);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int find_busiest_cpu(int cpu) {
+    int busiest = -1;
+    uint32_t max_running = 0;
+
+    for (int i = 0; i < cpu_count; i++) {
+        if (i == cpu) continue;
+        if (run_queues[i].nr_running > max_running) {
+            max_running = run_queues[i].nr_running;
+            busiest = i;
+        }
+    }
+    return busiest;
+}
+
+static Process* steal_work(int cpu) {
+    int busiest = find_busiest_cpu(cpu);
+    if (busiest < 0) return NULL;
+
+    RunQueue* victim = &run_queues[busiest];
+    uint64_t flags = spin_lock_irqsave(&victim->lock);
+    Process* process = steal_process(victim, cpu);
+    spin_unlock_irqrestore(&victim->lock, flags);
+
+    if (process) {
+        note_migration(process, cpu);
+        process->cpu = cpu;
+        run_queues[cpu].steals++;
+    }
+    return process;
+}
+
+Process* pick_next_process(int cpu) {
+    RunQueue* rq = &run_queues[cpu];
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    Process* next = rq->dl_queue.head;
+    if (next) {
+        queue_remove(rq, next);
+    } else {
+        int priority = highest_priority_nonempty(rq);
+        next = (priority >= 0) ? dequeue_process(rq, priority) : NULL;
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (!next && cpu_count > 1) next = steal_work(cpu);
+    return next;
+}
+
+//Periodic pull: even out queue lengths between this cpu and the busiest one
+void load_balance(int cpu) {
+    if (cpu_count <= 1) return;
+
+    int busiest = find_busiest_cpu(cpu);
+    if (busiest < 0) return;
+
+    RunQueue* rq = &run_queues[cpu];
+    RunQueue* victim = &run_queues[busiest];
+    if (victim->nr_running <= rq->nr_running + 1) return;
+
+    uint32_t imbalance = (victim->nr_running - rq->nr_running) / 2;
+    while (imbalance--) {
+        uint64_t flags = spin_lock_irqsave(&victim->lock);
+        Process* process = steal_process(victim, cpu);
+        spin_unlock_irqrestore(&victim->lock, flags);
+        if (!process) break;
+
+        flags = spin_lock_irqsave(&rq->lock);
+        note_migration(process, cpu);
+        process->cpu = cpu;
+        queue_push_tail(rq, process);
+        spin_unlock_irqrestore(&rq->lock, flags);
+    }
+}
+
+int sched_set_affinity(Process* process, uint64_t mask) {
+    uint64_t online = (cpu_count >= 64) ? CPU_AFFINITY_ALL : ((1ULL << cpu_count) - 1);
+    if (!process || !(mask & online)) return -1;
+    //Deadline tasks stay on the cpu their bandwidth was admitted on
+    if (process->sched_class == SCHED_CLASS_DEADLINE && mask != process->affinity) return -1;
+
+    process->affinity = mask;
+    if (cpu_allowed(process, process->cpu) || process->state != READY) return 0;
+
+    //Queued on a cpu it may no longer use: pull it off and place it again
+    RunQueue* rq = &run_queues[process->cpu];
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    bool queued = !process->on_cpu;
+    if (queued) queue_remove(rq, process);
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (queued) enqueue_process(process);
+    return 0;
 }
\ No newline at end of file
@@ -1,13 +1,470 @@
 #include "process.h"
+#include "../threading.h"
+#include "../../cpu/src/pic.h"
 #include "../../mm/stack.h"
+#include "../../mm/paging.h"
+#include "../../mm/vma.h"
+#include "../../fs/src/file.h"
+#include "../../mm/slab.h"
 
-Process* process_list = NULL;
-Process* current_process = NULL;
+extern void context_switch(CpuState* old_state, CpuState* new_state, uint64_t cr3);
+extern void kthread_start();
+extern void fork_return();
 
-void idle_process() {
-    while (1) asm volatile ("hlt");
+static Process boot_process;
+static SlabCache* process_cache;
+static Process* task_list = NULL;          //every process but the boot one, newest first
+static spinlock_t task_list_lock = SPINLOCK_INIT;
+static int process_count = 0;
+static volatile int scheduler_ready = 0;
+static WaitQueue child_exit_queue = WAIT_QUEUE_INIT;
+
+void scheduler_init() {
+    int cpu = cpu_register();
+
+    memset(&boot_process, 0, sizeof(Process));
+    boot_process.name = "kernel";
+    boot_process.pid = 0;
+    boot_process.priority = MEDIUM;
+    boot_process.base_priority = MEDIUM;
+    boot_process.state = RUNNING;
+    boot_process.cpu = cpu;
+    boot_process.affinity = CPU_AFFINITY_ALL;
+    boot_process.ticks_left = SCHED_QUANTUM(MEDIUM);
+    boot_process.on_cpu = 1;
+    boot_process.sleep_index = -1;
+
+    process_cache = slab_cache_create("process", sizeof(Process));
+    run_queues[cpu].current = &boot_process;
+    scheduler_ready = 1;
+
+    kprintf("Scheduler initialized on cpu %d\n", cpu);
+}
+
+Process* get_current_process() {
+    return run_queues[this_cpu()].current;
+}
+
+//Zeroed slot with a pid, invisible to find_process() and ps until publish_process()
+static Process* reserve_process_slot() {
+    int pid = pid_alloc();
+    if (pid < 0) return NULL;
+
+    Process* process = slab_alloc(process_cache);
+    if (!process) {
+        pid_free(pid);
+        return NULL;
+    }
+    process->pid = pid;
+    return process;
+}
+
+static void publish_process(Process* process) {
+    uint64_t flags = spin_lock_irqsave(&task_list_lock);
+    process->task_prev = NULL;
+    process->task_next = task_list;
+    if (task_list) task_list->task_prev = process;
+    task_list = process;
+    process_count++;
+    spin_unlock_irqrestore(&task_list_lock, flags);
+
+    pid_hash_add(process);
+}
+
+static void unpublish_process(Process* process) {
+    uint64_t flags = spin_lock_irqsave(&task_list_lock);
+    if (process->task_prev || task_list == process) {
+        if (process->task_prev) process->task_prev->task_next = process->task_next;
+        else task_list = process->task_next;
+        if (process->task_next) process->task_next->task_prev = process->task_prev;
+        process_count--;
+    }
+    spin_unlock_irqrestore(&task_list_lock, flags);
+
+    pid_hash_remove(process);
+}
+
+static void release_process_resources(Process* process) {
+    if (process->kstack) stack_free(process->kstack);
+    if (process->cr3) address_space_destroy(process->cr3);
+    vma_free_list(process->vmas);
+    fd_table_destroy(process->files);
+    process->kstack = NULL;
+    process->cr3 = 0;
+    process->vmas = NULL;
+    process->files = NULL;
+}
+
+static void free_process_slot(Process* process) {
+    release_process_resources(process);
+    unpublish_process(process);
+    pid_free(process->pid);
+    slab_free(process_cache, process);
+}
+
+static void set_process_name(Process* process, const char* name) {
+    strncpy(process->comm, name ? name : "?", PROCESS_NAME_LEN - 1);
+    process->comm[PROCESS_NAME_LEN - 1] = '\0';
+    process->name = process->comm;
+}
+
+//The process starts in kthread_start, which calls entry(arg) on stack_top
+static void process_setup(Process* process, const char* name, ProcessPriority priority,
+                          uint64_t cr3, uint64_t stack_top, uint64_t entry, uint64_t arg) {
+    set_process_name(process, name);
+    process->priority = priority;
+    process->base_priority = priority;
+    process->state = READY;
+    process->cr3 = cr3;
+    process->cpu = this_cpu();
+    process->affinity = CPU_AFFINITY_ALL;
+    process->ticks_left = SCHED_QUANTUM(priority);
+    process->sleep_index = -1;
+
+    memset(&process->cpu_state, 0, sizeof(CpuState));
+    process->cpu_state.rip = (uint64_t)kthread_start;
+    process->cpu_state.rsp = stack_top;
+    process->cpu_state.rflags = 0x2;
+    process->cpu_state.r12 = entry;
+    process->cpu_state.r13 = arg;
+}
+
+//Entry runs on its own S_STACK_SIZE stack; returning from it is the same as kthread_exit()
+Process* kthread_create(const char* name, int (*entry)(void*), void* arg, ProcessPriority priority) {
+    if (!entry) return NULL;
+
+    Process* process = reserve_process_slot();
+    if (!process) return NULL;
+
+    void* stack = stack_alloc();
+    if (!stack) {
+        free_process_slot(process);
+        return NULL;
+    }
+
+    process_setup(process, name, priority, 0, stack_top(stack), (uint64_t)entry, (uint64_t)arg);
+    process->kstack = stack;
+
+    publish_process(process);
+    enqueue_process(process);
+    return process;
+}
+
+//Runs entry in the given address space, which the process owns from now on together with vmas.
+//The caller becomes the parent and collects the exit code with process_wait(); the child inherits its fds
+Process* process_spawn(const char* name, uint64_t cr3, VmArea* vmas, uint64_t entry,
+                       uint64_t stack_top, ProcessPriority priority) {
+    Process* parent = get_current_process();
+    FdTable* files = fd_table_clone(parent ? parent->files : NULL);
+    if (!files) return NULL;
+
+    Process* process = reserve_process_slot();
+    if (!process) {
+        fd_table_destroy(files);
+        return NULL;
+    }
+
+    process_setup(process, name, priority, cr3, stack_top, entry, 0);
+    process->vmas = vmas;
+    process->files = files;
+    process->parent = parent;
+
+    publish_process(process);
+    enqueue_process(process);
+    return process;
 }
 
-Process* create_process(void(*entry_point)()) {
-    Process* new_process = (Process*)kmalloc(sizeof(Process));
+//Child of the calling process that resumes from the same syscall frame with 0 in rax
+int process_fork(void* frame) {
+    Process* parent = get_current_process();
+    if (!parent || !parent->cr3) {
+        kprintf("fork: %s has no address space of its own\n", parent ? parent->name : "?");
+        return -1;
+    }
+
+    Process* child = reserve_process_slot();
+    if (!child) return -1;
+
+    VmArea* vmas = vma_clone_list(parent->vmas);
+    if (parent->vmas && !vmas) {
+        free_process_slot(child);
+        return -1;
+    }
+
+    FdTable* files = fd_table_clone(parent->files);
+    if (!files) {
+        vma_free_list(vmas);
+        free_process_slot(child);
+        return -1;
+    }
+
+    uint64_t cr3 = address_space_clone(parent->cr3);
+    if (!cr3) {
+        fd_table_destroy(files);
+        vma_free_list(vmas);
+        free_process_slot(child);
+        return -1;
+    }
+
+    uint16_t pid = child->pid;
+    memcpy(child, parent, sizeof(Process));
+    child->pid = pid;
+    child->task_next = child->task_prev = child->hash_next = NULL;
+    child->name = child->comm;
+    child->parent = parent;
+    child->exit_code = 0;
+    child->cr3 = cr3;
+    child->vmas = vmas;
+    child->files = files;
+    child->kstack = NULL;
+    child->state = READY;
+    child->on_cpu = 0;
+    child->next = child->prev = NULL;
+    child->sleep_index = -1;
+    child->runtime_ticks = child->wait_ticks = 0;
+    child->switches = child->preemptions = 0;
+    child->ticks_left = SCHED_QUANTUM(child->priority);
+
+    //Admitted bandwidth cannot be duplicated, the child starts in the normal classes
+    if (child->sched_class == SCHED_CLASS_DEADLINE) {
+        child->sched_class = SCHED_CLASS_NORMAL;
+        child->affinity = CPU_AFFINITY_ALL;
+        memset(&child->dl, 0, sizeof(DeadlineParams));
+    }
+
+    memset(&child->cpu_state, 0, sizeof(CpuState));
+    child->cpu_state.rip = (uint64_t)fork_return;
+    child->cpu_state.rsp = (uint64_t)frame;
+    child->cpu_state.rflags = 0x2;
+
+    publish_process(child);
+    enqueue_process(child);
+    return pid;
+}
+
+//Blocks until child exits, then frees its slot and returns the exit code
+int process_wait(Process* child) {
+    Process* current = get_current_process();
+    if (!child || !current || child->parent != current) return -1;
+
+    wait_event(&child_exit_queue, child->state == ZOMBIE);
+
+    int code = child->exit_code;
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    free_process_slot(child);
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+    return code;
+}
+
+//Nobody is left to wait for them: zombies go now, the rest are reaped on exit
+static void reparent_children(Process* parent) {
+    Process* zombies = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&task_list_lock);
+    for (Process* p = task_list; p; ) {
+        Process* next = p->task_next;
+        if (p->parent == parent) {
+            p->parent = NULL;
+            if (p->state == ZOMBIE) {
+                //Unlinked here, freed once the list lock is dropped
+                if (p->task_prev) p->task_prev->task_next = p->task_next;
+                else task_list = p->task_next;
+                if (p->task_next) p->task_next->task_prev = p->task_prev;
+                p->task_prev = p->task_next = NULL;
+                process_count--;
+
+                p->next = zombies;
+                zombies = p;
+            }
+        }
+        p = next;
+    }
+    spin_unlock_irqrestore(&task_list_lock, flags);
+
+    while (zombies) {
+        Process* p = zombies;
+        zombies = p->next;
+        free_process_slot(p);
+    }
+}
+
+void wake_up_process(Process* process) {
+    process->state = READY;
+    if (process->on_cpu) {
+        //Still inside schedule() on its cpu, it has to be picked up there
+        enqueue_process_local(process, process->cpu);
+    } else {
+        enqueue_process(process);
+    }
+}
+
+void kthread_exit(int code) {
+    sched_clear_deadline();
+    Process* current = get_current_process();
+
+    //Dirty MAP_SHARED pages go back to their files while we can still sleep on the disk
+    if (current->cr3) vma_sync(current->cr3, current->vmas, USER_SPACE_START, USER_SPACE_END);
+
+    asm volatile ("cli");
+    current->exit_code = code;
+    reparent_children(current);
+    current->state = TERMINATED;
+    schedule();
+    for (;;) asm volatile ("hlt");
+}
+
+//Runs on the stack of the process we just switched to
+void finish_context_switch() {
+    RunQueue* rq = &run_queues[this_cpu()];
+    Process* prev = rq->prev;
+    rq->prev = NULL;
+    if (!prev) return;
+
+    prev->on_cpu = 0;
+    if (prev->state == TERMINATED && prev != &boot_process) {
+        //Nobody runs on its stack or in its address space any more
+        if (!prev->parent) {
+            free_process_slot(prev);
+            return;
+        }
+        release_process_resources(prev);
+        prev->state = ZOMBIE;
+        wake_up_all(&child_exit_queue);
+        return;
+    }
+    if (prev->state == READY && !(prev->affinity & (1ULL << prev->cpu))) {
+        sched_set_affinity(prev, prev->affinity);
+    }
+}
+
+void schedule() {
+    if (!scheduler_ready) return;
+
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+
+    int cpu = this_cpu();
+    RunQueue* rq = &run_queues[cpu];
+    Process* prev = rq->current;
+
+    bool preempted = prev && prev->state == RUNNING;
+    if (preempted) {
+        prev->state = READY;
+        enqueue_process_local(prev, cpu);
+    }
+
+    Process* next = pick_next_process(cpu);
+    while (!next) {
+        //Nothing runnable anywhere: idle on this stack until an interrupt readies something
+        rq->current = NULL;
+        asm volatile ("sti; hlt; cli" : : : "memory");
+        next = pick_next_process(cpu);
+    }
+
+    next->state = RUNNING;
+    next->cpu = cpu;
+    next->on_cpu = 1;
+    next->wait_ticks += timer_get_ticks() - next->ready_since;
+    if (next->ticks_left == 0) next->ticks_left = SCHED_QUANTUM(next->priority);
+    rq->current = next;
+    rq->need_resched = 0;
+    dl_note_dispatch(next);
+
+    if (next != prev) {
+        if (prev) {
+            prev->switches++;
+            if (preempted) prev->preemptions++;
+        }
+        rq->prev = prev;
+        context_switch(prev ? &prev->cpu_state : NULL, &next->cpu_state, next->cr3);
+        finish_context_switch();
+    }
+
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+//Used up its whole allotment: treat it as CPU bound and drop a level
+static void mlfq_demote(Process* process) {
+    if (process->priority == CRITICAL || process->priority <= LOW) return;
+    process->priority--;
+}
+
+void scheduler_tick() {
+    if (!scheduler_ready) return;
+
+    int cpu = this_cpu();
+    RunQueue* rq = &run_queues[cpu];
+    Process* current = rq->current;
+
+    if (current) rq->busy_ticks++;
+    else rq->idle_ticks++;
+
+    uint64_t now = timer_get_ticks();
+    if (now % SCHED_REBALANCE_TICKS == 0) {
+        age_run_queue(cpu, now);
+        load_balance(cpu);
+    }
+
+    dl_tick(cpu, now);
+
+    if (!current) return;
+    current->runtime_ticks++;
+    if (current->sched_class == SCHED_CLASS_NORMAL) {
+        if (current->ticks_left > 0) current->ticks_left--;
+        if (current->ticks_left == 0) {
+            mlfq_demote(current);
+            rq->need_resched = 1;
+        }
+    }
+    if (rq->need_resched) schedule();
+}
+
+static void process_info(ProcessInfo* info, Process* p) {
+    strncpy(info->name, p->name ? p->name : "?", PROCESS_NAME_LEN - 1);
+    info->name[PROCESS_NAME_LEN - 1] = '\0';
+    info->pid = p->pid;
+    info->state = p->state;
+    info->priority = p->priority;
+    info->base_priority = p->base_priority;
+    info->sched_class = p->sched_class;
+    info->cpu = p->cpu;
+    info->runtime_ticks = p->runtime_ticks;
+    info->wait_ticks = p->wait_ticks;
+    info->switches = p->switches;
+    info->preemptions = p->preemptions;
+    memcpy(&info->dl, &p->dl, sizeof(DeadlineParams));
+}
+
+//Fills out with the boot process and every other one, oldest first, returns how many were written.
+//Copies, since a process may exit and be freed as soon as the lock is dropped
+int process_snapshot(ProcessInfo* out, int max) {
+    int count = 0;
+
+    uint64_t flags = spin_lock_irqsave(&task_list_lock);
+    if (scheduler_ready && count < max) process_info(&out[count++], &boot_process);
+
+    Process* oldest = task_list;
+    while (oldest && oldest->task_next) oldest = oldest->task_next;
+    for (Process* p = oldest; p && count < max; p = p->task_prev) process_info(&out[count++], p);
+    spin_unlock_irqrestore(&task_list_lock, flags);
+
+    return count;
+}
+
+//Upper bound for process_snapshot(), the boot process included
+int process_total() {
+    return process_count + 1;
+}
+
+void sched_dump_stats() {
+    for (int i = 0; i < cpu_count; i++) {
+        RunQueue* rq = &run_queues[i];
+        uint64_t total = rq->busy_ticks + rq->idle_ticks;
+        int util = total ? (int)(rq->busy_ticks * 100 / total) : 0;
+
+        kprintf("cpu%d: %d%c busy, %d queued, %d in, %d out, %d stolen\n",
+                i, util, '%', rq->nr_running, (int)rq->migrations_in,
+                (int)rq->migrations_out, (int)rq->steals);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "sleepqueue.h"
+#include "../threading.h"
+#include "../../mm/heap.h"
+#include "../../cpu/src/pic.h"
+
+/*
+ * Binary min-heap of sleeping processes keyed by wake_tick.
+ * The timer only looks at the root, so a tick with nothing due is O(1)
+ * and every insert/expire/cancel is O(log n).
+ */
+static Process** sleep_heap = NULL;
+static uint32_t sleep_heap_size = 0;
+static uint32_t sleep_heap_capacity = 0;
+static spinlock_t sleep_lock = SPINLOCK_INIT;
+
+static inline void heap_set(uint32_t index, Process* process) {
+    sleep_heap[index] = process;
+    process->sleep_index = index;
+}
+
+static void sift_up(uint32_t index) {
+    Process* process = sleep_heap[index];
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (sleep_heap[parent]->wake_tick <= process->wake_tick) break;
+        heap_set(index, sleep_heap[parent]);
+        index = parent;
+    }
+    heap_set(index, process);
+}
+
+static void sift_down(uint32_t index) {
+    Process* process = sleep_heap[index];
+    for (;;) {
+        uint32_t child = index * 2 + 1;
+        if (child >= sleep_heap_size) break;
+        if (child + 1 < sleep_heap_size &&
+            sleep_heap[child + 1]->wake_tick < sleep_heap[child]->wake_tick) {
+            child++;
+        }
+        if (process->wake_tick <= sleep_heap[child]->wake_tick) break;
+        heap_set(index, sleep_heap[child]);
+        index = child;
+    }
+    heap_set(index, process);
+}
+
+static void heap_remove_at(uint32_t index) {
+    Process* removed = sleep_heap[index];
+    removed->sleep_index = -1;
+
+    sleep_heap_size--;
+    if (index == sleep_heap_size) return;
+
+    heap_set(index, sleep_heap[sleep_heap_size]);
+    if (index > 0 && sleep_heap[(index - 1) / 2]->wake_tick > sleep_heap[index]->wake_tick) {
+        sift_up(index);
+    } else {
+        sift_down(index);
+    }
+}
+
+//Grow outside the lock, kmalloc must not run from the timer
+static int heap_reserve(uint32_t needed) {
+    while (needed > sleep_heap_capacity) {
+        uint32_t capacity = sleep_heap_capacity ? sleep_heap_capacity * 2 : SLEEP_HEAP_INITIAL;
+        Process** grown = kmalloc(capacity * sizeof(Process*));
+        if (!grown) return 0;
+
+        uint64_t flags = spin_lock_irqsave(&sleep_lock);
+        if (capacity > sleep_heap_capacity) {
+            if (sleep_heap) memcpy(grown, sleep_heap, sleep_heap_size * sizeof(Process*));
+            Process** old = sleep_heap;
+            sleep_heap = grown;
+            sleep_heap_capacity = capacity;
+            grown = old;
+        }
+        spin_unlock_irqrestore(&sleep_lock, flags);
+        if (grown) kfree(grown);
+    }
+    return 1;
+}
+
+//Without a process or room on the queue the sleep still lasts its full length
+static void sleep_spin(uint64_t tick) {
+    while (timer_get_ticks() < tick) asm volatile ("hlt");
+}
+
+void sleep_until(uint64_t tick) {
+    Process* current = get_current_process();
+    if (!current || !heap_reserve(sleep_heap_size + 1)) {
+        sleep_spin(tick);
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&sleep_lock);
+    while (sleep_heap_size == sleep_heap_capacity) {
+        //Another cpu took the slot we reserved
+        spin_unlock_irqrestore(&sleep_lock, flags);
+        if (!heap_reserve(sleep_heap_size + 1)) {
+            sleep_spin(tick);
+            return;
+        }
+        flags = spin_lock_irqsave(&sleep_lock);
+    }
+    if (timer_get_ticks() >= tick) {
+        spin_unlock_irqrestore(&sleep_lock, flags);
+        return;
+    }
+
+    current->wake_tick = tick;
+    current->state = WAITING;
+    heap_set(sleep_heap_size, current);
+    sift_up(sleep_heap_size++);
+    spin_unlock(&sleep_lock);
+
+    schedule();
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+//Take a process off the sleep queue early, returns 1 if it was sleeping
+int sleep_cancel(Process* process) {
+    uint64_t flags = spin_lock_irqsave(&sleep_lock);
+    int sleeping = process->sleep_index >= 0;
+    if (sleeping) heap_remove_at(process->sleep_index);
+    spin_unlock_irqrestore(&sleep_lock, flags);
+
+    if (sleeping) wake_up_process(process);
+    return sleeping;
+}
+
+void sleep_queue_tick(uint64_t now) {
+    if (sleep_heap_size == 0) return;
+
+    spin_lock(&sleep_lock);
+    while (sleep_heap_size > 0 && sleep_heap[0]->wake_tick <= now) {
+        Process* process = sleep_heap[0];
+        heap_remove_at(0);
+        wake_up_process(process);
+    }
+    spin_unlock(&sleep_lock);
+}
+
+uint32_t sleep_queue_length() {
+    return sleep_heap_size;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#ifndef SLEEPQUEUE_H
+#define SLEEPQUEUE_H
+
+#include "process.h"
+
+#define SLEEP_HEAP_INITIAL 64
+
+void sleep_until(uint64_t tick);
+int sleep_cancel(Process* process);
+void sleep_queue_tick(uint64_t now);
+uint32_t sleep_queue_length();
+
+#endif
\ No newline at end of file
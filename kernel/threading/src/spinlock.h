@@ -0,0 +1,37 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "../../../lib/definitions.h"
+
+typedef volatile uint32_t spinlock_t;
+
+#define SPINLOCK_INIT 0
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*lock) asm volatile ("pause");
+    }
+}
+
+static inline int spin_trylock(spinlock_t* lock) {
+    return __sync_lock_test_and_set(lock, 1) == 0;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __sync_lock_release(lock);
+}
+
+//The timer ISR takes run queue locks, so every other path has to mask interrupts first
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags;
+    asm volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "waitqueue.h"
+#include "../threading.h"
+
+void wait_queue_init(WaitQueue* wq) {
+    wq->lock = SPINLOCK_INIT;
+    wq->waiters.head = NULL;
+    wq->waiters.tail = NULL;
+}
+
+static void waiters_remove(WaitQueue* wq, Process* process) {
+    if (process->prev) process->prev->next = process->next;
+    else if (wq->waiters.head == process) wq->waiters.head = process->next;
+    else return;
+
+    if (process->next) process->next->prev = process->prev;
+    else wq->waiters.tail = process->prev;
+    process->prev = process->next = NULL;
+}
+
+//Queue the current process as WAITING; interrupts stay off until wait_sleep/wait_cancel
+uint64_t wait_prepare(WaitQueue* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    Process* current = get_current_process();
+
+    if (current) {
+        current->state = WAITING;
+        current->next = NULL;
+        current->prev = wq->waiters.tail;
+        if (wq->waiters.tail) wq->waiters.tail->next = current;
+        else wq->waiters.head = current;
+        wq->waiters.tail = current;
+    }
+    return flags;
+}
+
+void wait_cancel(WaitQueue* wq, uint64_t flags) {
+    Process* current = get_current_process();
+    if (current) {
+        waiters_remove(wq, current);
+        current->state = RUNNING;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_sleep(WaitQueue* wq, uint64_t flags) {
+    Process* current = get_current_process();
+    spin_unlock(&wq->lock);
+
+    if (current) {
+        schedule();
+    } else {
+        //No scheduler yet: the boot path just waits for the next interrupt
+        asm volatile ("sti; hlt; cli" : : : "memory");
+    }
+    asm volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+int wake_up(WaitQueue* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    Process* process = wq->waiters.head;
+    if (process) {
+        waiters_remove(wq, process);
+        wake_up_process(process);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return process != NULL;
+}
+
+int wake_up_all(WaitQueue* wq) {
+    int woken = 0;
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->waiters.head) {
+        Process* process = wq->waiters.head;
+        waiters_remove(wq, process);
+        wake_up_process(process);
+        woken++;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include "process.h"
+
+typedef struct WaitQueue {
+    spinlock_t lock;
+    ProcessQueue waiters;
+} WaitQueue;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, { NULL, NULL } }
+
+void wait_queue_init(WaitQueue* wq);
+uint64_t wait_prepare(WaitQueue* wq);
+void wait_cancel(WaitQueue* wq, uint64_t flags);
+void wait_sleep(WaitQueue* wq, uint64_t flags);
+int wake_up(WaitQueue* wq);
+int wake_up_all(WaitQueue* wq);
+
+/*
+ * The condition is tested after the caller is on the queue with interrupts
+ * off, so a wake_up() from an ISR between the test and the sleep is not lost.
+ */
+#define wait_event(wq, condition) do {                  \
+    for (;;) {                                          \
+        uint64_t __wq_flags = wait_prepare(wq);         \
+        if (condition) {                                \
+            wait_cancel(wq, __wq_flags);                \
+            break;                                      \
+        }                                               \
+        wait_sleep(wq, __wq_flags);                     \
+    }                                                   \
+} while (0)
+
+#endif
\ No newline at end of file
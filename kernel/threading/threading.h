@@ -0,0 +1,42 @@
+#ifndef THREADING_H
+#define THREADING_H
+
+#include "src/process.h"
+#include "src/waitqueue.h"
+#include "src/sleepqueue.h"
+#include "src/deadline.h"
+#include "src/futex.h"
+#include "src/pid.h"
+
+extern RunQueue run_queues[MAX_CPUS];
+extern int cpu_count;
+
+int cpu_register();
+int this_cpu();
+
+void enqueue_process(Process* process);
+void enqueue_process_local(Process* process, int cpu);
+Process* dequeue_process(RunQueue* rq, ProcessPriority priority);
+int highest_priority_nonempty(RunQueue* rq);
+void age_run_queue(int cpu, uint64_t now);
+Process* pick_next_process(int cpu);
+void load_balance(int cpu);
+int sched_set_affinity(Process* process, uint64_t mask);
+
+void scheduler_init();
+void schedule();
+void scheduler_tick();
+void finish_context_switch();
+Process* kthread_create(const char* name, int (*entry)(void*), void* arg, ProcessPriority priority);
+void kthread_exit(int code);
+Process* process_spawn(const char* name, uint64_t cr3, struct VmArea* vmas, uint64_t entry,
+                       uint64_t stack_top, ProcessPriority priority);
+int process_fork(void* frame);
+int process_wait(Process* child);
+void wake_up_process(Process* process);
+Process* get_current_process();
+int process_snapshot(ProcessInfo* out, int max);
+int process_total();
+void sched_dump_stats();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "definitions.h"
+
+#define SYS_FUTEX 9
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+/*
+ * Lock for programs: 0 = free, 1 = held, 2 = held with waiters. Taking a
+ * free lock and releasing one nobody waits for never enter the kernel.
+ */
+typedef struct {
+    volatile uint32_t state;
+} mutex_t;
+
+#define MUTEX_INIT { 0 }
+
+static inline int sys_futex(volatile uint32_t* uaddr, int op, uint32_t val) {
+    uint64_t result;
+    asm volatile ("int $0x80"
+                  : "=a"(result)
+                  : "a"((uint64_t)SYS_FUTEX), "D"(uaddr), "S"((uint64_t)op), "d"((uint64_t)val)
+                  : "memory");
+    return (int)result;
+}
+
+static inline void mutex_lock(mutex_t* mutex) {
+    uint32_t state = __sync_val_compare_and_swap(&mutex->state, 0, 1);
+    if (state == 0) return;
+
+    //Contended: mark it as having waiters and sleep until it is released
+    if (state != 2) state = __sync_lock_test_and_set(&mutex->state, 2);
+    while (state != 0) {
+        sys_futex(&mutex->state, FUTEX_WAIT, 2);
+        state = __sync_lock_test_and_set(&mutex->state, 2);
+    }
+}
+
+static inline int mutex_trylock(mutex_t* mutex) {
+    return __sync_val_compare_and_swap(&mutex->state, 0, 1) == 0;
+}
+
+static inline void mutex_unlock(mutex_t* mutex) {
+    if (__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        sys_futex(&mutex->state, FUTEX_WAKE, 1);
+    }
+}
+
+#endif
\ No newline at end of file
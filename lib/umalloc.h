@@ -0,0 +1,148 @@
+#ifndef UMALLOC_H
+#define UMALLOC_H
+
+#include "definitions.h"
+
+#define SYS_MMAP 13
+#define SYS_MUNMAP 14
+
+#define UMALLOC_PROT_RW 0x3
+#define UMALLOC_MAP_ANON 0x22       //MAP_PRIVATE | MAP_ANONYMOUS
+
+#define UMALLOC_CLASSES 8           //16 to 2048 bytes, powers of two
+#define UMALLOC_MAX_SMALL 2048
+#define UMALLOC_ARENA (64 * 1024)
+#define UMALLOC_HEADER 16
+
+/*
+ * malloc for programs, on top of anonymous mmap. Small blocks come from
+ * per-size-class free lists carved out of 64KB arenas; anything larger gets
+ * a mapping of its own that free() hands straight back. Arenas are only
+ * reserved address space until touched, so a program pays for what it uses.
+ * Like mutex.h it is header only: include it from one file of the program.
+ */
+typedef struct UmallocHeader {
+    uint64_t size;                  //class size, or the whole mapping for large blocks
+    uint64_t large;
+} UmallocHeader;
+
+static void* umalloc_free_lists[UMALLOC_CLASSES];
+static uint8_t* umalloc_arena_next;
+static uint8_t* umalloc_arena_end;
+
+static inline void* sys_mmap(void* addr, uint64_t length, int prot, int flags) {
+    uint64_t result;
+    register uint64_t r10 asm("r10") = (uint64_t)flags;
+    register uint64_t r8 asm("r8") = (uint64_t)-1;
+    register uint64_t r9 asm("r9") = 0;
+    asm volatile ("int $0x80"
+                  : "=a"(result)
+                  : "a"((uint64_t)SYS_MMAP), "D"(addr), "S"(length), "d"((uint64_t)prot),
+                    "r"(r10), "r"(r8), "r"(r9)
+                  : "memory");
+    return (void*)result;
+}
+
+static inline int sys_munmap(void* addr, uint64_t length) {
+    uint64_t result;
+    asm volatile ("int $0x80"
+                  : "=a"(result)
+                  : "a"((uint64_t)SYS_MUNMAP), "D"(addr), "S"(length)
+                  : "memory");
+    return (int)result;
+}
+
+static int umalloc_class(uint64_t size) {
+    int class = 0;
+    uint64_t class_size = 16;
+    while (class_size < size) {
+        class_size <<= 1;
+        class++;
+    }
+    return class;
+}
+
+static void* umalloc_carve(uint64_t size) {
+    if (umalloc_arena_next + size > umalloc_arena_end) {
+        void* arena = sys_mmap(NULL, UMALLOC_ARENA, UMALLOC_PROT_RW, UMALLOC_MAP_ANON);
+        if (arena == (void*)-1) return NULL;
+        umalloc_arena_next = (uint8_t*)arena;
+        umalloc_arena_end = umalloc_arena_next + UMALLOC_ARENA;
+    }
+
+    void* block = umalloc_arena_next;
+    umalloc_arena_next += size;
+    return block;
+}
+
+static void* malloc(uint64_t size) {
+    if (size == 0) return NULL;
+
+    uint64_t total = size + UMALLOC_HEADER;
+    if (total > UMALLOC_MAX_SMALL) {
+        total = (total + 4095) & ~4095ULL;
+        UmallocHeader* header = (UmallocHeader*)sys_mmap(NULL, total, UMALLOC_PROT_RW, UMALLOC_MAP_ANON);
+        if (header == (void*)-1) return NULL;
+        header->size = total;
+        header->large = 1;
+        return (uint8_t*)header + UMALLOC_HEADER;
+    }
+
+    int class = umalloc_class(total);
+    UmallocHeader* header = (UmallocHeader*)umalloc_free_lists[class];
+    if (header) {
+        umalloc_free_lists[class] = *(void**)header;
+    } else {
+        header = (UmallocHeader*)umalloc_carve(16ULL << class);
+        if (!header) return NULL;
+    }
+    header->size = 16ULL << class;
+    header->large = 0;
+    return (uint8_t*)header + UMALLOC_HEADER;
+}
+
+static void free(void* ptr) {
+    if (!ptr) return;
+
+    UmallocHeader* header = (UmallocHeader*)((uint8_t*)ptr - UMALLOC_HEADER);
+    if (header->large) {
+        sys_munmap(header, header->size);
+        return;
+    }
+
+    int class = umalloc_class(header->size);
+    *(void**)header = umalloc_free_lists[class];
+    umalloc_free_lists[class] = header;
+}
+
+static void* calloc(uint64_t count, uint64_t size) {
+    uint64_t total = count * size;
+    if (size && total / size != count) return NULL;
+
+    //Large blocks are fresh mappings and already read as zero
+    uint8_t* ptr = (uint8_t*)malloc(total);
+    if (ptr && total + UMALLOC_HEADER <= UMALLOC_MAX_SMALL) {
+        for (uint64_t i = 0; i < total; i++) ptr[i] = 0;
+    }
+    return ptr;
+}
+
+static void* realloc(void* ptr, uint64_t size) {
+    if (!ptr) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    UmallocHeader* header = (UmallocHeader*)((uint8_t*)ptr - UMALLOC_HEADER);
+    uint64_t usable = header->size - UMALLOC_HEADER;
+    if (size <= usable) return ptr;
+
+    uint8_t* copy = (uint8_t*)malloc(size);
+    if (!copy) return NULL;
+    for (uint64_t i = 0; i < usable; i++) copy[i] = ((uint8_t*)ptr)[i];
+    free(ptr);
+    return copy;
+}
+
+#endif
\ No newline at end of file
@@ -13,7 +13,13 @@ Command commands[] = {
     {"ls", ls},
     {"touch", touch},
     {"rm", rm},
-    {"rmdir", rmdir}
+    {"rmdir", rmdir},
+    {"ps", ps},
+    {"pipebench", pipebench},
+    {"iostat", iostat},
+    {"blkbench", blkbench},
+    {"ramdisk", ramdisk},
+    {"exit", exit}
 };
 
 void shell_init() {
@@ -0,0 +1,94 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/drivers/vga/vga.h"
+#include "../../kernel/drivers/block/block.h"
+#include "../../kernel/mm/frame.h"
+#include "../../kernel/mm/paging.h"
+#include "../../kernel/cpu/src/pic.h"
+#include "commands.h"
+
+#define BENCH_IOS 2048
+#define BENCH_MAX_DEPTH 32
+#define BENCH_SECTORS (PAGE_SIZE / BLOCK_SECTOR_SIZE)
+
+static const uint32_t depths[] = {1, 4, 32};
+
+static uint32_t bench_seed;
+
+static uint32_t bench_random() {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static void bench_submit(BlockRequest* req, uint32_t pages) {
+    req->io.lba = (bench_random() % pages) * BENCH_SECTORS;
+    req->io.sectors = BENCH_SECTORS;
+    req->io.write = false;
+    block_submit(req);
+}
+
+//Keeps depth reads in flight, reissuing each slot as soon as its read is back
+static void run_bench(BlockDevice* dev, uint32_t depth, BlockRequest* reqs) {
+    uint32_t pages = dev->sectors / BENCH_SECTORS;
+    uint32_t issued = 0;
+    uint32_t errors = 0;
+    bench_seed = 0x2545F491;
+
+    uint64_t start = timer_get_us();
+    for (uint32_t i = 0; i < depth; i++, issued++) bench_submit(&reqs[i], pages);
+    for (uint32_t done = 0; done < BENCH_IOS; done++) {
+        BlockRequest* req = &reqs[done % depth];
+        if (block_wait(req) != 0) errors++;
+        if (issued < BENCH_IOS) {
+            bench_submit(req, pages);
+            issued++;
+        }
+    }
+    uint64_t us = timer_get_us() - start;
+    if (!us) us = 1;
+
+    kprintf("%u", depth);
+    kprintf("\t%u", BENCH_IOS);
+    kprintf("\t%u", (uint32_t)us);
+    kprintf("\t%u", (uint32_t)((uint64_t)BENCH_IOS * 1000000 / us));
+    kprintf("\t%u", (uint32_t)((uint64_t)BENCH_IOS * (PAGE_SIZE / 1024) * 1000000 / us));
+    kprintf("\t%u\n", errors);
+}
+
+//4K random reads at several queue depths, on the named device or the fastest disk. A ramdisk
+//only shows memcpy speed, so it has to be named
+void blkbench(char* args) {
+    BlockDevice* dev = args[0] ? block_find(args) : block_get(block_fastest(true));
+    if (!dev) {
+        kprint("blkbench: no such block device\n");
+        return;
+    }
+    if (dev->sectors < BENCH_SECTORS) {
+        kprintf("blkbench: %s is too small\n", dev->name);
+        return;
+    }
+
+    BlockRequest reqs[BENCH_MAX_DEPTH];
+    memset(reqs, 0, sizeof(reqs));
+    int ok = 1;
+    for (int i = 0; i < BENCH_MAX_DEPTH; i++) {
+        reqs[i].dev = dev;
+        reqs[i].buffer = (void*)frame_alloc();
+        if (!reqs[i].buffer) ok = 0;
+    }
+
+    if (ok) {
+        set_color(LIGHT_BROWN);
+        kprintf("%s, 4K random reads\nDEPTH\tIOS\tUS\tIOPS\tKB/S\tERRORS\n", dev->name);
+        set_color(LIGHT_GREEN);
+        int count = (int)(sizeof(depths) / sizeof(depths[0]));
+        for (int i = 0; i < count; i++) run_bench(dev, depths[i], reqs);
+    } else {
+        kprint("blkbench: out of memory\n");
+    }
+
+    for (int i = 0; i < BENCH_MAX_DEPTH; i++) {
+        if (reqs[i].buffer) frame_free((uint64_t)reqs[i].buffer);
+    }
+}
\ No newline at end of file
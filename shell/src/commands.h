@@ -16,6 +16,12 @@ void ls(char* args);
 void touch(char* args);
 void rm(char* args);
 void rmdir(char* args);
+void ps(char* args);
+void pipebench(char* args);
+void iostat(char* args);
+void blkbench(char* args);
+void ramdisk(char* args);
+void exit(char* args);
 int exec(const char* path);
 
 #endif
\ No newline at end of file
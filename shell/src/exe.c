@@ -1,16 +1,46 @@
 #include "../../kernel/threading/src/binary.h"
+#include "../../kernel/threading/src/elf.h"
+#include "../../kernel/threading/threading.h"
+#include "../../kernel/mm/paging.h"
 #include "commands.h"
 
+//Runs the binary as its own process in a fresh address space and waits for it
 int exec(const char* path) {
+    uint64_t cr3 = address_space_create();
+    if (!cr3) {
+        kprintf("exec: out of memory\n");
+        return -1;
+    }
+
     uint64_t entry_point;
-    int result = load_binary(path, &entry_point);
+    VmArea* areas = NULL;
+    int result = load_elf(path, &entry_point, &areas);
+    if (result == -3) {
+        //Not ELF, fall back to the flat binary format
+        result = load_binary(path, cr3, &entry_point);
+    }
     
     if (result != 0) {
+        address_space_destroy(cr3);
         kprintf("Failed to load binary: %d\n", result);
         return result;
     }
     
-    typedef int (*binary_entry_t)(void);
-    binary_entry_t entry = (binary_entry_t)entry_point;
-    return entry();
+    //The stack is mapped up front: faults are delivered on it, so it can never be demand paged
+    if (!address_space_alloc(cr3, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER)) {
+        vma_free_list(areas);
+        address_space_destroy(cr3);
+        kprintf("exec: out of memory\n");
+        return -1;
+    }
+    
+    Process* process = process_spawn(path, cr3, areas, entry_point, USER_STACK_TOP, MEDIUM);
+    if (!process) {
+        vma_free_list(areas);
+        address_space_destroy(cr3);
+        kprintf("exec: no free process slot\n");
+        return -1;
+    }
+    
+    return process_wait(process);
 }
\ No newline at end of file
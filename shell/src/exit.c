@@ -0,0 +1,12 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/fs/fs.h"
+#include "commands.h"
+
+//Writes every filesystem back to its medium and stops; the machine can be switched off after
+void exit(char* args) {
+    kprint("Unmounting filesystems\n");
+    fs_shutdown();
+    kprint("It is now safe to turn off the computer\n");
+    asm volatile ("cli");
+    for (;;) asm volatile ("hlt");
+}
\ No newline at end of file
@@ -38,7 +38,24 @@ void help(char* args) {
     kprintcolor("<filename> <text>", LIGHT_MAGENTA);
     kprintcolor(" -", WHITE);
     kprint(" Write text to a file\n");
+    kprintcolor("  ps ", LIGHT_BROWN);
+    kprintcolor("-", WHITE);
+    kprint(" List processes with their scheduling statistics\n");
+    kprintcolor("  pipebench ", LIGHT_BROWN);
+    kprintcolor("-", WHITE);
+    kprint(" Compare pipe and shared memory throughput for several write sizes\n");
+    kprintcolor("  iostat ", LIGHT_BROWN);
+    kprintcolor("-", WHITE);
+    kprint(" Show request merging, queue wait times and transfers per block device\n");
+    kprintcolor("  blkbench ", LIGHT_BROWN);
+    kprintcolor("[device] ", LIGHT_MAGENTA);
+    kprintcolor("-", WHITE);
+    kprint(" Measure 4K random read IOPS at queue depths 1, 4 and 32\n");
+    kprintcolor("  ramdisk ", LIGHT_BROWN);
+    kprintcolor("<sectors> [device [lba]] ", LIGHT_MAGENTA);
+    kprintcolor("-", WHITE);
+    kprint(" Create a ramdisk, loaded from a device's image if one is named\n");
     kprintcolor("  exit ", LIGHT_BROWN);
     kprintcolor("-", WHITE);
-    kprint(" Exit the shell\n");
+    kprint(" Write every filesystem back to disk and halt\n");
 }
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/drivers/vga/vga.h"
+#include "../../kernel/drivers/block/block.h"
+#include "commands.h"
+
+//Per block device: what its elevator made of the requests, then what was transferred
+void iostat(char* args) {
+    set_color(LIGHT_BROWN);
+    kprint("DEVICE\tREQS\tCMDS\tMERGED\tMERGE%\tEXPIRED\tAVG US\tMAX US\n");
+    set_color(LIGHT_GREEN);
+
+    for (int id = 0; id < block_count(); id++) {
+        BlockStats stats;
+        if (!block_get_stats(id, &stats)) continue;
+
+        uint64_t requests = stats.queue.requests ? stats.queue.requests : 1;
+        kprintf("%s", block_get(id)->name);
+        kprintf("\t%u", (uint32_t)stats.queue.requests);
+        kprintf("\t%u", (uint32_t)stats.queue.commands);
+        kprintf("\t%u", (uint32_t)stats.queue.merged);
+        kprintf("\t%u", (uint32_t)(stats.queue.merged * 100 / requests));
+        kprintf("\t%u", (uint32_t)stats.queue.expired);
+        kprintf("\t%u", (uint32_t)(stats.queue.wait_us / requests));
+        kprintf("\t%u\n", (uint32_t)stats.queue.max_wait_us);
+    }
+
+    set_color(LIGHT_BROWN);
+    kprint("DEVICE\tREADS\tWRITES\tKB READ\tKB WRIT\tFLUSHES\tERRORS\n");
+    set_color(LIGHT_GREEN);
+
+    for (int id = 0; id < block_count(); id++) {
+        BlockStats stats;
+        if (!block_get_stats(id, &stats)) continue;
+
+        kprintf("%s", block_get(id)->name);
+        kprintf("\t%u", (uint32_t)stats.reads);
+        kprintf("\t%u", (uint32_t)stats.writes);
+        kprintf("\t%u", (uint32_t)(stats.sectors_read / 2));
+        kprintf("\t%u", (uint32_t)(stats.sectors_written / 2));
+        kprintf("\t%u", (uint32_t)stats.flushes);
+        kprintf("\t%u\n", (uint32_t)stats.errors);
+    }
+}
\ No newline at end of file
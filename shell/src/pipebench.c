@@ -0,0 +1,247 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/drivers/vga/vga.h"
+#include "../../kernel/threading/threading.h"
+#include "../../kernel/mm/paging.h"
+#include "../../kernel/mm/mmap.h"
+#include "../../kernel/mm/shm.h"
+#include "../../kernel/mm/frame.h"
+#include "../../kernel/cpu/src/pic.h"
+#include "../../kernel/fs/src/pipe.h"
+#include "../../kernel/threading/src/futex.h"
+#include "../../kernel/syscalls/sys.h"
+#include "commands.h"
+
+#define BENCH_TOTAL (1024 * 1024)
+#define BENCH_MAX_CHUNK (64 * 1024)
+#define BENCH_BUFFER USER_SPACE_START
+#define SHM_BENCH_NAME "pipebench"
+#define SHM_BENCH_RING (64 * 1024)
+
+static const uint32_t chunk_sizes[] = {64, 512, 4096, 16384, 65536};
+
+//Both ends run in address spaces of their own, so page-sized chunks can be remapped
+static int bench_fds[2];
+static uint32_t bench_chunk;
+static uint64_t bench_start;
+static uint64_t bench_end;
+static uint64_t bench_received;
+static volatile uint64_t bench_checksum;
+
+//First page of the shared segment, the ring follows it. seq and ack only ever grow, so a
+//waiter that snapshots one before checking the ring cannot miss the wake-up
+typedef struct ShmRing {
+    volatile uint32_t head;     //bytes produced
+    volatile uint32_t tail;     //bytes consumed
+    volatile uint32_t done;
+    volatile uint32_t seq;      //bumped by the producer
+    volatile uint32_t ack;      //bumped by the consumer
+    volatile uint32_t abort;    //one side never started or could not map the ring
+} ShmRing;
+
+//The same page through the kernel's identity map, so that whoever fails can still reach the
+//other side, even without a mapping of its own
+static ShmRing* bench_ring;
+
+static int bench_writer(void* unused) {
+    close(bench_fds[0]);
+    bench_start = timer_get_us();
+    for (uint32_t sent = 0; sent < BENCH_TOTAL; sent += bench_chunk) {
+        if (write(bench_fds[1], (void*)BENCH_BUFFER, bench_chunk) != (ssize_t)bench_chunk) break;
+    }
+    close(bench_fds[1]);
+    return 0;
+}
+
+static int bench_reader(void* unused) {
+    close(bench_fds[1]);
+    ssize_t n;
+    while ((n = read(bench_fds[0], (void*)BENCH_BUFFER, bench_chunk)) > 0) {
+        bench_received += n;
+    }
+    bench_end = timer_get_us();
+    return 0;
+}
+
+static ShmRing* map_ring() {
+    int fd = shm_open(SHM_BENCH_NAME, 0, 0);
+    if (fd < 0) return NULL;
+    void* segment = mmap(NULL, PAGE_SIZE + SHM_BENCH_RING, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return segment == MAP_FAILED ? NULL : (ShmRing*)segment;
+}
+
+//Both waiters wake up and see abort, whichever of them is running
+static void shm_abort() {
+    bench_ring->abort = 1;
+    __sync_fetch_and_add(&bench_ring->seq, 1);
+    __sync_fetch_and_add(&bench_ring->ack, 1);
+    futex((uint32_t*)&bench_ring->seq, FUTEX_WAKE, 1);
+    futex((uint32_t*)&bench_ring->ack, FUTEX_WAKE, 1);
+}
+
+static int shm_producer(void* unused) {
+    ShmRing* ring = map_ring();
+    if (!ring) {
+        shm_abort();
+        return 1;
+    }
+    uint8_t* data = (uint8_t*)ring + PAGE_SIZE;
+
+    bench_start = timer_get_us();
+    for (uint32_t sent = 0; sent < BENCH_TOTAL && !ring->abort; sent += bench_chunk) {
+        uint32_t ack = ring->ack;
+        while (!ring->abort && ring->head - ring->tail + bench_chunk > SHM_BENCH_RING) {
+            futex((uint32_t*)&ring->ack, FUTEX_WAIT, ack);
+            ack = ring->ack;
+        }
+        if (ring->abort) break;
+        //Chunk sizes divide the ring, so a chunk never wraps
+        memcpy(data + ring->head % SHM_BENCH_RING, (void*)BENCH_BUFFER, bench_chunk);
+        ring->head += bench_chunk;
+        __sync_fetch_and_add(&ring->seq, 1);
+        futex((uint32_t*)&ring->seq, FUTEX_WAKE, 1);
+    }
+    ring->done = 1;
+    __sync_fetch_and_add(&ring->seq, 1);
+    futex((uint32_t*)&ring->seq, FUTEX_WAKE, 1);
+    return 0;
+}
+
+static int shm_consumer(void* unused) {
+    ShmRing* ring = map_ring();
+    if (!ring) {
+        shm_abort();
+        return 1;
+    }
+    uint8_t* data = (uint8_t*)ring + PAGE_SIZE;
+
+    uint64_t sum = 0;
+    while (!ring->abort) {
+        uint32_t seq = ring->seq;
+        if (ring->head == ring->tail) {
+            if (ring->done) break;
+            futex((uint32_t*)&ring->seq, FUTEX_WAIT, seq);
+            continue;
+        }
+
+        //Used in place, nothing is copied out of the segment
+        uint64_t* words = (uint64_t*)(data + ring->tail % SHM_BENCH_RING);
+        for (uint32_t i = 0; i < bench_chunk / sizeof(uint64_t); i++) sum += words[i];
+        bench_received += bench_chunk;
+        ring->tail += bench_chunk;
+        __sync_fetch_and_add(&ring->ack, 1);
+        futex((uint32_t*)&ring->ack, FUTEX_WAKE, 1);
+    }
+    bench_checksum = sum;
+    bench_end = timer_get_us();
+    return 0;
+}
+
+static Process* spawn_bench(const char* name, int (*entry)(void*)) {
+    uint64_t cr3 = address_space_create();
+    if (!cr3) return NULL;
+
+    uint64_t flags = PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    if (!address_space_alloc(cr3, BENCH_BUFFER, BENCH_MAX_CHUNK, flags) ||
+        !address_space_alloc(cr3, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, flags)) {
+        address_space_destroy(cr3);
+        return NULL;
+    }
+
+    Process* process = process_spawn(name, cr3, NULL, (uint64_t)entry, USER_STACK_TOP, MEDIUM);
+    if (!process) address_space_destroy(cr3);
+    return process;
+}
+
+static void print_row(uint32_t chunk, uint64_t copied, uint64_t moved) {
+    uint64_t us = bench_end > bench_start ? bench_end - bench_start : 1;
+    kprintf("%u", chunk);
+    kprintf("\t%u", (uint32_t)bench_received);
+    kprintf("\t%u", (uint32_t)us);
+    kprintf("\t%u", (uint32_t)(bench_received * 1000 / us));
+    kprintf("\t%u", (uint32_t)copied);
+    kprintf("\t%u\n", (uint32_t)moved);
+}
+
+static void run_bench(uint32_t chunk) {
+    if (pipe(bench_fds) < 0) {
+        kprintf("pipebench: cannot create pipe\n");
+        return;
+    }
+    bench_chunk = chunk;
+    bench_received = 0;
+
+    //Both children inherit both ends, so each closes the one it does not use and so do we
+    Process* reader = spawn_bench("pipe-reader", bench_reader);
+    Process* writer = reader ? spawn_bench("pipe-writer", bench_writer) : NULL;
+    close(bench_fds[1]);
+    if (!writer) {
+        kprintf("pipebench: cannot start processes\n");
+        if (reader) process_wait(reader);
+        close(bench_fds[0]);
+        return;
+    }
+    process_wait(writer);
+    process_wait(reader);
+
+    Pipe* channel = fd_get(bench_fds[0])->pipe;
+    uint64_t copied = channel->bytes_copied;
+    uint64_t moved = channel->pages_moved;
+    close(bench_fds[0]);
+
+    print_row(chunk, copied, moved);
+}
+
+static void run_shm_bench(uint32_t chunk) {
+    //Created here so neither side has to win a race to it, and unlinked once both are done
+    ShmObject* shm = shm_open_object(SHM_BENCH_NAME, true, PAGE_SIZE + SHM_BENCH_RING);
+    uint64_t header = shm ? shm_get_frame(shm, 0) : 0;
+    if (!header) {
+        kprintf("pipebench: cannot create shared memory\n");
+        if (shm) {
+            shm_unlink(SHM_BENCH_NAME);
+            shm_put(shm);
+        }
+        return;
+    }
+    bench_ring = (ShmRing*)header;
+    memset(bench_ring, 0, sizeof(ShmRing));
+    bench_chunk = chunk;
+    bench_received = 0;
+
+    Process* consumer = spawn_bench("shm-consumer", shm_consumer);
+    Process* producer = consumer ? spawn_bench("shm-producer", shm_producer) : NULL;
+    if (!producer) {
+        kprintf("pipebench: cannot start processes\n");
+        if (consumer) {
+            shm_abort();
+            process_wait(consumer);
+        }
+    } else {
+        process_wait(producer);
+        process_wait(consumer);
+    }
+    bool completed = producer && !bench_ring->abort;
+    shm_unlink(SHM_BENCH_NAME);
+    frame_free(header);
+    shm_put(shm);
+
+    //Nothing goes through the kernel, so there is nothing it copied or remapped
+    if (completed) print_row(chunk, 0, 0);
+    else if (producer) kprintf("pipebench: shared memory run aborted\n");
+}
+
+//Pushes 1MB through a pipe, then through a shared memory ring, at each chunk size
+void pipebench(char* args) {
+    int chunks = (int)(sizeof(chunk_sizes) / sizeof(chunk_sizes[0]));
+
+    set_color(LIGHT_BROWN);
+    kprint("pipe\nCHUNK\tBYTES\tUS\tKB/S\tCOPIED\tREMAPPED\n");
+    set_color(LIGHT_GREEN);
+    for (int i = 0; i < chunks; i++) run_bench(chunk_sizes[i]);
+
+    set_color(LIGHT_BROWN);
+    kprint("shared memory\nCHUNK\tBYTES\tUS\tKB/S\tCOPIED\tREMAPPED\n");
+    set_color(LIGHT_GREEN);
+    for (int i = 0; i < chunks; i++) run_shm_bench(chunk_sizes[i]);
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/drivers/vga/vga.h"
+#include "../../kernel/threading/threading.h"
+#include "../../kernel/mm/heap.h"
+#include "commands.h"
+
+static const char* state_names[] = {"ready", "run", "wait", "dead", "zomb"};
+static const char* priority_names[] = {"idle", "low", "med", "high", "crit"};
+
+static int digits(uint64_t value) {
+    int n = 1;
+    while (value >= 10) {
+        value /= 10;
+        n++;
+    }
+    return n;
+}
+
+static void pad(int used, int width) {
+    while (used++ < width) kprint(" ");
+}
+
+static void print_column(const char* text, int width) {
+    kprintf("%s", text);
+    pad(strlen(text), width);
+}
+
+static void print_number(uint64_t value, int width) {
+    kprintf("%u", (uint32_t)value);
+    pad(digits(value), width);
+}
+
+void ps(char* args) {
+    int max = process_total();
+    ProcessInfo* processes = kmalloc(max * sizeof(ProcessInfo));
+    if (!processes) {
+        kprintf("ps: out of memory\n");
+        return;
+    }
+    int count = process_snapshot(processes, max);
+
+    set_color(LIGHT_BROWN);
+    kprint("PID   NAME          STATE PRI       CPU RUN(ms)  WAIT(ms) SWITCH PREEMPT\n");
+    set_color(LIGHT_GREEN);
+
+    for (int i = 0; i < count; i++) {
+        ProcessInfo* p = &processes[i];
+        char priority[12];
+
+        //Current level, with the level it started at when they differ
+        if (p->sched_class == SCHED_CLASS_DEADLINE) {
+            strcpy(priority, "dl");
+        } else {
+            strcpy(priority, priority_names[p->priority]);
+        }
+        if (p->sched_class == SCHED_CLASS_NORMAL && p->priority != p->base_priority) {
+            strcat(priority, "/");
+            strcat(priority, priority_names[p->base_priority]);
+        }
+
+        print_number(p->pid, 6);
+        print_column(p->name, 14);
+        print_column(state_names[p->state], 6);
+        print_column(priority, 10);
+        print_number(p->cpu, 4);
+        print_number(p->runtime_ticks, 9);
+        print_number(p->wait_ticks, 9);
+        print_number(p->switches, 7);
+        print_number(p->preemptions, 0);
+        kprint("\n");
+    }
+    kfree(processes);
+
+    dl_dump_stats();
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "../../lib/definitions.h"
+#include "../../kernel/drivers/ramdisk/ramdisk.h"
+#include "commands.h"
+
+//Digits at *args, which is left past them and any spaces after. false if there are none
+static bool next_number(char** args, uint32_t* value) {
+    if (**args < '0' || **args > '9') return false;
+    *value = 0;
+    while (**args >= '0' && **args <= '9') *value = *value * 10 + (*(*args)++ - '0');
+    while (**args == ' ') (*args)++;
+    return true;
+}
+
+//ramdisk <sectors> [device [lba]]: a new ramdisk of that size, filled from the device's
+//image at lba if one is named
+void ramdisk(char* args) {
+    uint32_t sectors;
+    if (!next_number(&args, &sectors) || sectors == 0) {
+        kprint("Usage: ramdisk <sectors> [device [lba]]\n");
+        return;
+    }
+
+    char source[BLOCK_NAME_LEN] = {0};
+    int i = 0;
+    while (*args && *args != ' ' && i < BLOCK_NAME_LEN - 1) source[i++] = *args++;
+    while (*args == ' ') args++;
+    uint32_t lba = 0;
+    if (*args && !next_number(&args, &lba)) {
+        kprint("Usage: ramdisk <sectors> [device [lba]]\n");
+        return;
+    }
+
+    BlockDevice* src = NULL;
+    if (source[0]) {
+        src = block_find(source);
+        if (!src) {
+            kprintf("ramdisk: no such block device %s\n", source);
+            return;
+        }
+    }
+
+    int id = ramdisk_create(sectors);
+    if (id < 0) {
+        kprint("ramdisk: cannot create a ramdisk that large\n");
+        return;
+    }
+    BlockDevice* dev = block_get(id);
+    if (src) {
+        if (!ramdisk_load(id, src->id, lba)) {
+            kprintf("ramdisk: %s is left empty\n", dev->name);
+            return;
+        }
+        kprintf("%s holds %d sectors of %s from sector %d\n", dev->name, (uint32_t)dev->sectors, src->name, lba);
+    } else {
+        kprintf("%s holds %d empty sectors\n", dev->name, (uint32_t)dev->sectors);
+    }
+}
\ No newline at end of file